@@ -0,0 +1,770 @@
+/**
+ * @file archive.c
+ * @brief Archive support for Symbol Modifier for COFF (SMC).
+ *
+ * Note:
+ *     This file is part of the SMC tool and is intended to be used in
+ *     conjunction with the main application. It is not designed to be used
+ *     independently.
+ *
+ * License:
+ *     This program is free software; you can redistribute it and/or modify it
+ *     under the terms  of the GNU General Public License as published by the
+ *     Free Software Foundation; either version 2 of the License, or (at your
+ *     option) any later version.
+ */
+
+
+#include "smc.h"
+#include "smclib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/**
+ * An archive is the signature '!<arch>\n' followed by members, each with a
+ * 60-byte header of space-padded text fields and padded to an even size.
+ * Both MS and GNU archives start with the symbol index '/', which lists the
+ * names defined by each member along with the offset of the member header as
+ * big-endian numbers. MS archives follow it with a second '/' member holding
+ * the same names sorted, with little-endian member indices, and GNU archives
+ * larger than 4 GB use '/SYM64/' with 64-bit offsets instead. Long member
+ * names are kept in '//'.
+ *
+ * The COFF and ELF members are renamed in parallel, each on its own, and the
+ * new archive is written in one pass: the members are laid out first, then
+ * the symbol index is patched with the new names and offsets. Members that
+ * are not object files, such as import objects, and members none of whose
+ * names changed are copied through byte for byte, straight from the input,
+ * so only the members matching a rule are rebuilt.
+ *
+ * Patching the symbol index costs in proportion to the renamed names: names
+ * of members without changes are copied as they are, and only the changed
+ * names of the second linker member are sorted and merged into the rest,
+ * which is still in order.
+ */
+
+#define ARCHIVE_MAGIC      "!<arch>\n"
+#define ARCHIVE_MAGIC_SIZE 8
+
+/**
+ * @brief Header of an archive member.
+ */
+typedef struct {
+	char name[16]; ///< Member name, '/' for the symbol index.
+	char date[12]; ///< Modification time.
+	char uid[6];   ///< Owner.
+	char gid[6];   ///< Group.
+	char mode[8];  ///< File mode in octal.
+	char size[10]; ///< Size of the member in decimal.
+	char end[2];   ///< "`\n".
+} ar_header_t;
+
+/**
+ * @brief Kinds of archive members.
+ */
+enum {
+	MEM_INDEX,     ///< First linker member '/'.
+	MEM_INDEX2,    ///< Second linker member '/' of MS archives.
+	MEM_INDEX64,   ///< GNU 64-bit symbol index '/SYM64/'.
+	MEM_LONGNAMES, ///< Long member names '//'.
+	MEM_FILE,      ///< Any other member.
+};
+
+typedef struct archive_t archive_t;
+
+/**
+ * @brief A member of an archive.
+ */
+typedef struct {
+	archive_t         *ar;      ///< The archive.
+	const ar_header_t *head;    ///< Header of the member in the input.
+	char              *data;    ///< Contents of the member in the input.
+	size_t             size;    ///< Size of the contents.
+	int                kind;    ///< One of MEM_*.
+	uint16_t           index;   ///< 1-based index among MEM_FILE members.
+	coff_t            *coff;    ///< The renamed COFF object, or NULL if copied through.
+	buf_t             *content; ///< New contents of a symbol index, or NULL.
+	size_t             newsize; ///< Size of the member in the output.
+	size_t             newoff;  ///< Offset of the member header in the output.
+	plan_t             plan;    ///< What renaming changes in an object member, for '--dry-run'.
+} member_t;
+
+/**
+ * @brief A name listed in the symbol index.
+ */
+typedef struct {
+	const char *name;    ///< The name in the input.
+	size_t      len;     ///< Length of the name.
+	member_t   *member;  ///< The member defining the name.
+	const char *newname; ///< The new name, which is `name` unless it changed.
+	size_t      newlen;  ///< Length of the new name.
+} symbol_t;
+
+/**
+ * @brief An archive being renamed.
+ */
+struct archive_t {
+	const rules_t  *rules;     ///< Renaming rules to apply.
+	const char     *infile;    ///< Name of the input file.
+	char           *data;      ///< Contents of the input file.
+	size_t          size;      ///< Size of the input file.
+	bool           *hit;       ///< Marks of the renaming rules matched by any member.
+	member_t       *members;   ///< Members in archive order.
+	size_t          nmember;   ///< Number of members.
+	const member_t *longnames; ///< The long member names, or NULL.
+	symbol_t       *symbols;   ///< Names listed in the symbol index.
+	size_t          nsymbol;   ///< Number of names in the symbol index.
+	size_t          strsize;   ///< Size of the new names of the symbol index.
+	symbol_t       *sorted;    ///< Names listed in the second linker member, sorted.
+	size_t          nsorted;   ///< Number of names in the second linker member.
+	size_t          strsize2;  ///< Size of the new names of the second linker member.
+	arena_t        *names;     ///< Storage for the names that changed.
+	size_t          newsize;   ///< Size of the new archive.
+	pool_t         *pool;      ///< Threads renaming the members, while running.
+	pthread_mutex_t lock;      ///< Protects the error below.
+	bool            failed;    ///< Whether renaming a member failed.
+	char            error[ERROR_MAX]; ///< Message of the first failure.
+};
+
+/**
+ * @brief Tell whether a buffer holds an archive.
+ *
+ * @param data The contents.
+ * @param size Size of the contents.
+ * @return true if the contents start with the archive signature.
+ */
+bool
+is_archive(const void *data, size_t size)
+{
+	return size >= ARCHIVE_MAGIC_SIZE && memcmp(data, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) == 0;
+}
+
+/**
+ * @brief Read a big-endian number.
+ *
+ * @param p     The bytes.
+ * @param width Number of bytes.
+ * @return The number.
+ */
+static uint64_t
+get_be(const char *p, int width)
+{
+	uint64_t v = 0;
+	for (int i = 0; i < width; ++i)
+		v = v << 8 | (uint8_t)p[i];
+	return v;
+}
+
+/**
+ * @brief Read a little-endian number.
+ *
+ * @param p     The bytes.
+ * @param width Number of bytes.
+ * @return The number.
+ */
+static uint64_t
+get_le(const char *p, int width)
+{
+	uint64_t v = 0;
+	for (int i = width; i-- > 0;)
+		v = v << 8 | (uint8_t)p[i];
+	return v;
+}
+
+/**
+ * @brief Write a number as big-endian.
+ *
+ * @param p     Destination.
+ * @param v     The number.
+ * @param width Number of bytes.
+ */
+static void
+put_be(char *p, uint64_t v, int width)
+{
+	for (int i = width; i-- > 0; v >>= 8)
+		p[i] = (char)v;
+}
+
+/**
+ * @brief Write a number as little-endian.
+ *
+ * @param p     Destination.
+ * @param v     The number.
+ * @param width Number of bytes.
+ */
+static void
+put_le(char *p, uint64_t v, int width)
+{
+	for (int i = 0; i < width; ++i, v >>= 8)
+		p[i] = (char)v;
+}
+
+/**
+ * @brief Tell whether a member name field holds a given name.
+ *
+ * @param field The space-padded name field.
+ * @param name  The name.
+ * @return true if the field holds exactly `name`.
+ */
+static bool
+is_name(const char field[16], const char *name)
+{
+	size_t len = strlen(name);
+	if (memcmp(field, name, len) != 0)
+		return false;
+	while (len < 16 && field[len] == ' ')
+		++len;
+	return len == 16;
+}
+
+/**
+ * @brief Get the name of a member for messages, as 'archive(member)'.
+ *
+ * @param ar  The archive.
+ * @param m   The member.
+ * @param buf Receives the name.
+ * @param size Size of `buf`.
+ */
+static void
+member_name(const archive_t *ar, const member_t *m, char *buf, size_t size)
+{
+	const char *name = m->head->name;
+	size_t len = 16;
+	if (name[0] == '/' && name[1] >= '0' && name[1] <= '9' && ar->longnames) {
+		size_t off = strtoul(name + 1, NULL, 10);
+		if (off < ar->longnames->size) {
+			name = ar->longnames->data + off;
+			len  = ar->longnames->size - off;
+		}
+	}
+	len = strcspn(name, "/\n") < len ? strcspn(name, "/\n") : len;
+	while (len && name[len - 1] == ' ')
+		--len;
+	snprintf(buf, size, "%s(%.*s)", ar->infile, (int)len, name);
+}
+
+/**
+ * @brief Split an archive into members.
+ *
+ * @param ar The archive.
+ */
+static void
+read_members(archive_t *ar)
+{
+	size_t cap = 0;
+	for (size_t off = ARCHIVE_MAGIC_SIZE; off < ar->size;) {
+		if (ar->size - off < sizeof(ar_header_t))
+			error("Invalid archive '%s'.", ar->infile);
+		const ar_header_t *head = (const ar_header_t*)(ar->data + off);
+		char digits[sizeof(head->size) + 1] = { 0 }, *end;
+		memcpy(digits, head->size, sizeof(head->size));
+		unsigned long long size = strtoull(digits, &end, 10);
+		off += sizeof(ar_header_t);
+		if (memcmp(head->end, "`\n", 2) != 0 || end == digits
+		 || strspn(end, " ") != strlen(end) || size > ar->size - off)
+			error("Invalid archive '%s'.", ar->infile);
+		if (ar->nmember == cap) {
+			cap = cap ? cap * 2 : 64;
+			member_t *members = realloc(ar->members, cap * sizeof(member_t));
+			if (!members)
+				error("Memory allocation failed.");
+			ar->members = members;
+		}
+		member_t *m = &ar->members[ar->nmember++];
+		*m = (member_t){ .ar = ar, .head = head, .data = ar->data + off, .size = size,
+		                 .kind = MEM_FILE, .newsize = size };
+		if (is_name(head->name, "/"))
+			m->kind = ar->nmember > 1 && m[-1].kind == MEM_INDEX ? MEM_INDEX2 : MEM_INDEX;
+		else if (is_name(head->name, "/SYM64/"))
+			m->kind = MEM_INDEX64;
+		else if (is_name(head->name, "//"))
+			m->kind = MEM_LONGNAMES;
+		off += size + (size & 1);
+	}
+	// Number the members the second linker member refers to.
+	size_t index = 0;
+	for (size_t i = 0; i < ar->nmember; ++i) {
+		member_t *m = &ar->members[i];
+		if (m->kind == MEM_LONGNAMES)
+			ar->longnames = m;
+		else if (m->kind == MEM_FILE && ++index <= UINT16_MAX)
+			m->index = index;
+	}
+}
+
+/**
+ * @brief Find a member by the offset of its header.
+ *
+ * @param ar  The archive.
+ * @param off Offset of the member header in the input.
+ * @return The member.
+ */
+static member_t *
+find_member(archive_t *ar, uint64_t off)
+{
+	size_t lo = 0, hi = ar->nmember;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if ((uint64_t)((const char*)ar->members[mid].head - ar->data) < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == ar->nmember || (uint64_t)((const char*)ar->members[lo].head - ar->data) != off)
+		error("Invalid archive '%s'.", ar->infile);
+	return &ar->members[lo];
+}
+
+/**
+ * @brief Read the null-terminated names of a symbol index.
+ *
+ * @param ar   The archive.
+ * @param list The names, whose `name` and `len` are filled in.
+ * @param n    Number of names.
+ * @param s    Start of the names.
+ * @param end  End of the symbol index.
+ */
+static void
+read_names(archive_t *ar, symbol_t *list, size_t n, const char *s, const char *end)
+{
+	for (size_t i = 0; i < n; ++i) {
+		list[i].name = s;
+		list[i].len  = strnlen(s, end - s);
+		if (list[i].len == (size_t)(end - s))
+			error("Invalid archive '%s'.", ar->infile);
+		s += list[i].len + 1;
+	}
+}
+
+/**
+ * @brief Read the names listed in the symbol index and in the second linker
+ *        member.
+ *
+ * @param ar The archive.
+ */
+static void
+read_symbols(archive_t *ar)
+{
+	for (size_t i = 0; i < ar->nmember; ++i) {
+		const member_t *m = &ar->members[i];
+		const char *p = m->data, *end = p + m->size;
+		if ((m->kind == MEM_INDEX || m->kind == MEM_INDEX64) && !ar->symbols) {
+			// Big-endian count and member offsets in the order of the names.
+			int width = m->kind == MEM_INDEX64 ? 8 : 4;
+			uint64_t n = m->size < (size_t)width ? UINT64_MAX : get_be(p, width);
+			if (n > (m->size - width) / width)
+				error("Invalid archive '%s'.", ar->infile);
+			if (!(ar->symbols = calloc(n + 1, sizeof(symbol_t))))
+				error("Memory allocation failed.");
+			ar->nsymbol = n;
+			const char *offsets = p + width;
+			read_names(ar, ar->symbols, n, offsets + n * width, end);
+			for (size_t j = 0; j < n; ++j)
+				ar->symbols[j].member = find_member(ar, get_be(offsets + j * width, width));
+		} else if (m->kind == MEM_INDEX2 && !ar->sorted) {
+			// Little-endian member offsets, then the sorted names with the
+			// indices of their members.
+			uint64_t nmem = m->size < 4 ? UINT64_MAX : get_le(p, 4);
+			if (nmem > (m->size - 8) / 4)
+				error("Invalid archive '%s'.", ar->infile);
+			const char *offsets = p + 4;
+			p = offsets + 4 * nmem;
+			uint64_t n = get_le(p, 4);
+			p += 4;
+			if (n > (size_t)(end - p) / 2)
+				error("Invalid archive '%s'.", ar->infile);
+			if (!(ar->sorted = calloc(n + 1, sizeof(symbol_t))))
+				error("Memory allocation failed.");
+			ar->nsorted = n;
+			read_names(ar, ar->sorted, n, p + 2 * n, end);
+			for (size_t j = 0; j < n; ++j) {
+				uint64_t index = get_le(p + 2 * j, 2);
+				if (index < 1 || index > nmem)
+					error("Invalid archive '%s'.", ar->infile);
+				ar->sorted[j].member = find_member(ar, get_le(offsets + 4 * (index - 1), 4));
+			}
+		}
+	}
+}
+
+/**
+ * @brief Worker task renaming one COFF or ELF member.
+ *
+ * @param arg The member.
+ */
+static void
+rename_member(void *arg)
+{
+	member_t *m = arg;
+	archive_t *ar = m->ar;
+	if (setjmp(_buf)) {
+		pthread_mutex_lock(&ar->lock);
+		if (!ar->failed) {
+			__atomic_store_n(&ar->failed, true, __ATOMIC_RELAXED);
+			memcpy(ar->error, _errmsg, ERROR_MAX);
+		}
+		pthread_mutex_unlock(&ar->lock);
+		return;
+	}
+	if (__atomic_load_n(&ar->failed, __ATOMIC_RELAXED))
+		return;
+	char name[ERROR_MAX / 2];
+	member_name(ar, m, name, sizeof(name));
+	m->coff = new_coff(m->data, m->size);
+	index_coff(m->coff, name, false, 1);
+	rename_coff(m->coff, ar->rules, ar->hit);
+	if (rules_dry_run(ar->rules))
+		coff_plan(m->coff, &m->plan);
+	if (!coff_changed(m->coff)) {
+		// Nothing to rebuild, so the member is copied through.
+		del_coff(m->coff);
+		m->coff = NULL;
+		return;
+	}
+	m->newsize = coff_size(m->coff);
+}
+
+/**
+ * @brief Find the new names of the names listed in a symbol index.
+ *
+ * Only members with changed names are looked into, and only the names that
+ * changed are copied. Names made static are dropped from the list, which
+ * otherwise keeps its order.
+ *
+ * @param ar   The archive, whose members have been renamed.
+ * @param list The names.
+ * @param n    Number of names, updated to the number kept.
+ * @return Total size of the new names, including null terminators.
+ */
+static size_t
+rename_names(archive_t *ar, symbol_t *list, size_t *n)
+{
+	size_t size = 0, kept = 0;
+	for (size_t i = 0; i < *n; ++i) {
+		symbol_t *sym = &list[kept];
+		const coff_t *coff = list[i].member->coff;
+		*sym = list[i];
+		if (coff && coff_localized(coff, sym->name, sym->len))
+			continue;
+		++kept;
+		size_t e = coff ? coff_renamed(coff, sym->name, sym->len) : DICT_NONE;
+		sym->newname = sym->name;
+		sym->newlen  = sym->len;
+		if (e != DICT_NONE) {
+			sym->newlen = coff_name_length(coff, e);
+			char *p = arena_alloc(ar->names, sym->newlen + 1);
+			coff_emit_name(coff, e, p);
+			p[sym->newlen] = '\0';
+			sym->newname = p;
+		}
+		size += sym->newlen + 1;
+	}
+	*n = kept;
+	return size;
+}
+
+/**
+ * @brief Order names of the second linker member by name, then by member.
+ *
+ * @param a The first name.
+ * @param b The second name.
+ * @return Negative, zero or positive, as for qsort.
+ */
+static int
+compare_names(const void *a, const void *b)
+{
+	const symbol_t *x = a, *y = b;
+	int c = memcmp(x->newname, y->newname, (x->newlen < y->newlen ? x->newlen : y->newlen) + 1);
+	if (c)
+		return c;
+	return (x->member->index > y->member->index) - (x->member->index < y->member->index);
+}
+
+/**
+ * @brief Restore the order of the second linker member after renaming.
+ *
+ * The names that did not change are still in order, so only the changed
+ * ones are sorted, and then merged into the others.
+ *
+ * @param ar The archive, whose names have been renamed.
+ */
+static void
+sort_names(archive_t *ar)
+{
+	size_t nchanged = 0;
+	for (size_t i = 0; i < ar->nsorted; ++i)
+		nchanged += ar->sorted[i].newname != ar->sorted[i].name;
+	if (!nchanged)
+		return;
+	symbol_t *changed = malloc(nchanged * sizeof(symbol_t));
+	symbol_t *merged  = malloc(ar->nsorted * sizeof(symbol_t));
+	if (!changed || !merged) {
+		free(changed);
+		free(merged);
+		error("Memory allocation failed.");
+	}
+	// Move the changed names out, keeping the others in place.
+	size_t kept = 0, c = 0;
+	for (size_t i = 0; i < ar->nsorted; ++i) {
+		if (ar->sorted[i].newname != ar->sorted[i].name)
+			changed[c++] = ar->sorted[i];
+		else
+			ar->sorted[kept++] = ar->sorted[i];
+	}
+	qsort(changed, nchanged, sizeof(symbol_t), compare_names);
+	size_t i = 0, j = 0, k = 0;
+	while (i < kept && j < nchanged)
+		merged[k++] = compare_names(&ar->sorted[i], &changed[j]) <= 0 ? ar->sorted[i++] : changed[j++];
+	while (i < kept)
+		merged[k++] = ar->sorted[i++];
+	while (j < nchanged)
+		merged[k++] = changed[j++];
+	free(changed);
+	free(ar->sorted);
+	ar->sorted = merged;
+}
+
+/**
+ * @brief Build the new contents of a symbol index member.
+ *
+ * @param ar The archive, laid out.
+ * @param m  The symbol index member.
+ */
+static void
+build_index(archive_t *ar, member_t *m)
+{
+	buf_t *buf = m->content = new_buf();
+	buf_reserve(buf, m->newsize);
+	char *p = buf->buf;
+	const symbol_t *list = ar->symbols;
+	size_t n = ar->nsymbol;
+	if (m->kind == MEM_INDEX2) {
+		// Member offsets, then member indices of the sorted names.
+		size_t nfile = 0;
+		for (size_t i = 0; i < ar->nmember; ++i)
+			if (ar->members[i].index)
+				put_le(p + 4 + 4 * nfile++, ar->members[i].newoff, 4);
+		put_le(p, nfile, 4);
+		p += 4 + 4 * nfile;
+		list = ar->sorted;
+		n    = ar->nsorted;
+		put_le(p, n, 4);
+		p += 4;
+		for (size_t i = 0; i < n; ++i, p += 2)
+			put_le(p, list[i].member->index, 2);
+	} else {
+		// Member offsets in the order of the names.
+		int width = m->kind == MEM_INDEX64 ? 8 : 4;
+		put_be(p, n, width);
+		p += width;
+		for (size_t i = 0; i < n; ++i, p += width) {
+			size_t off = list[i].member->newoff;
+			if (width == 4 && off > UINT32_MAX)
+				error("Archive '%s' is too large for its symbol index.", ar->infile);
+			put_be(p, off, width);
+		}
+	}
+	for (size_t i = 0; i < n; ++i, p += list[i - 1].newlen + 1)
+		memcpy(p, list[i].newname, list[i].newlen + 1);
+	buf->cnt = p - (char*)buf->buf;
+}
+
+/**
+ * @brief Lay out the new archive and build its symbol index.
+ *
+ * @param ar The archive, whose members have been renamed.
+ */
+static void
+layout_archive(archive_t *ar)
+{
+	ar->names    = new_arena();
+	ar->strsize  = rename_names(ar, ar->symbols, &ar->nsymbol);
+	ar->strsize2 = rename_names(ar, ar->sorted, &ar->nsorted);
+	sort_names(ar);
+	size_t nfile = 0;
+	for (size_t i = 0; i < ar->nmember; ++i)
+		nfile += ar->members[i].index != 0;
+	for (size_t i = 0; i < ar->nmember; ++i) {
+		member_t *m = &ar->members[i];
+		if (m->kind == MEM_INDEX2 && nfile > UINT16_MAX)
+			error("Archive '%s' has too many members.", ar->infile);
+		if (m->kind == MEM_INDEX)
+			m->newsize = 4 + 4 * ar->nsymbol + ar->strsize;
+		else if (m->kind == MEM_INDEX64)
+			m->newsize = 8 + 8 * ar->nsymbol + ar->strsize;
+		else if (m->kind == MEM_INDEX2)
+			m->newsize = 4 + 4 * nfile + 4 + 2 * ar->nsorted + ar->strsize2;
+	}
+	size_t off = ARCHIVE_MAGIC_SIZE;
+	for (size_t i = 0; i < ar->nmember; ++i) {
+		member_t *m = &ar->members[i];
+		m->newoff = off;
+		off += sizeof(ar_header_t) + m->newsize + (m->newsize & 1);
+	}
+	ar->newsize = off;
+	for (size_t i = 0; i < ar->nmember; ++i)
+		if (ar->members[i].kind <= MEM_INDEX64)
+			build_index(ar, &ar->members[i]);
+}
+
+/**
+ * @brief Write the new archive.
+ *
+ * @param ar  The archive, laid out.
+ * @param out The output.
+ */
+static void
+write_archive(const archive_t *ar, out_t *out)
+{
+	out_write(out, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+	for (size_t i = 0; i < ar->nmember;) {
+		const member_t *m = &ar->members[i];
+		if (!m->coff && !m->content) {
+			// Copy a run of unchanged members through, headers and padding
+			// included, in one piece.
+			const char *start = (const char*)m->head;
+			while (i < ar->nmember && !ar->members[i].coff && !ar->members[i].content)
+				++i;
+			const member_t *last = &ar->members[i - 1];
+			const char *end = last->data + last->size;
+			out_write(out, start, end - start);
+			if (last->size & 1)
+				out_byte(out, end < ar->data + ar->size ? *end : '\n');
+			continue;
+		}
+		++i;
+		ar_header_t head = *m->head;
+		char digits[32];
+		int n = snprintf(digits, sizeof(digits), "%llu", (unsigned long long)m->newsize);
+		if (n > (int)sizeof(head.size))
+			error("Archive member of '%s' is too large.", ar->infile);
+		memset(head.size, ' ', sizeof(head.size));
+		memcpy(head.size, digits, n);
+		out_write(out, &head, sizeof(head));
+		if (m->coff)
+			write_coff(m->coff, out);
+		else
+			out_write(out, m->content->buf, m->content->cnt);
+		if (m->newsize & 1)
+			out_byte(out, '\n');
+	}
+}
+
+/**
+ * @brief Write the new archive for save_output().
+ *
+ * @param ar  The archive, laid out.
+ * @param out The output.
+ */
+static void
+emit_archive(const void *ar, out_t *out)
+{
+	write_archive(ar, out);
+}
+
+/**
+ * @brief Print the plan of every object member of an archive, then the
+ *        totals, with the size of the new archive.
+ *
+ * @param ar The archive, laid out.
+ */
+static void
+print_archive_plan(const archive_t *ar)
+{
+	plan_t total = { .size = ar->newsize };
+	for (size_t i = 0; i < ar->nmember; ++i) {
+		const member_t *m = &ar->members[i];
+		if (m->kind != MEM_FILE || !is_object(m->data, m->size))
+			continue;
+		char name[ERROR_MAX / 2];
+		member_name(ar, m, name, sizeof(name));
+		print_plan(name, &m->plan);
+		total.renamed   += m->plan.renamed;
+		total.localized += m->plan.localized;
+		total.stripped  += m->plan.stripped;
+		total.strsize   += m->plan.strsize;
+	}
+	print_plan(ar->infile, &total);
+}
+
+/**
+ * @brief Free an archive along with the renamed members.
+ *
+ * @param ar The archive, which may be partially processed.
+ */
+static void
+del_archive(archive_t *ar)
+{
+	if (ar->pool)
+		del_pool(ar->pool);
+	for (size_t i = 0; i < ar->nmember; ++i) {
+		if (ar->members[i].coff)
+			del_coff(ar->members[i].coff);
+		if (ar->members[i].content)
+			del_buf(ar->members[i].content);
+	}
+	free(ar->members);
+	free(ar->symbols);
+	free(ar->sorted);
+	if (ar->names)
+		del_arena(ar->names);
+	pthread_mutex_destroy(&ar->lock);
+	free(ar);
+}
+
+/**
+ * @brief Rename the symbols of every COFF or ELF member of an archive.
+ *
+ * A renaming rule needs to match a symbol in one member only.
+ *
+ * @param rules   Renaming rules to apply.
+ * @param infile  Name of the input file.
+ * @param data    Contents of the input file.
+ * @param size    Size of the input file.
+ * @param key     Key of the input in the output cache, from cache_fetch().
+ * @param hit     Marks the renaming rules that match a symbol.
+ * @param outfile Name of the output file.
+ * @param out     The output stream, or NULL to open outfile.
+ */
+void
+rename_archive(const rules_t *rules, const char *infile, void *data, size_t size,
+               const char *key, bool *hit, const char *outfile, FILE *out)
+{
+	archive_t *ar = calloc(1, sizeof(archive_t));
+	if (!ar)
+		error("Memory allocation failed.");
+	*ar = (archive_t){ .rules = rules, .infile = infile, .data = data, .size = size, .hit = hit };
+	pthread_mutex_init(&ar->lock, NULL);
+	// Release the archive before passing an error on.
+	jmp_buf outer;
+	memcpy(outer, _buf, sizeof(jmp_buf));
+	if (setjmp(_buf)) {
+		del_archive(ar);
+		memcpy(_buf, outer, sizeof(jmp_buf));
+		longjmp(_buf, 1);
+	}
+	read_members(ar);
+	read_symbols(ar);
+	// Rename the COFF and ELF members in parallel.
+	ar->pool = new_pool(rules_jobs(rules));
+	for (size_t i = 0; i < ar->nmember; ++i) {
+		member_t *m = &ar->members[i];
+		if (m->kind == MEM_FILE && is_object(m->data, m->size))
+			pool_submit(ar->pool, rename_member, m);
+	}
+	del_pool(ar->pool);
+	ar->pool = NULL;
+	if (ar->failed)
+		error("%s", ar->error);
+	check_hits(rules, hit);
+	// Write the new archive.
+	layout_archive(ar);
+	if (rules_dry_run(rules)) {
+		print_archive_plan(ar);
+	} else {
+		cache_save(rules, key, outfile, out, ar->newsize, emit_archive, ar);
+	}
+	memcpy(_buf, outer, sizeof(jmp_buf));
+	del_archive(ar);
+}
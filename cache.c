@@ -0,0 +1,273 @@
+/**
+ * @file cache.c
+ * @brief Output cache for Symbol Modifier for COFF (SMC).
+ *
+ * Note:
+ *     This file is part of the SMC tool and is intended to be used in
+ *     conjunction with the main application. It is not designed to be used
+ *     independently.
+ *
+ * License:
+ *     This program is free software; you can redistribute it and/or modify it
+ *     under the terms  of the GNU General Public License as published by the
+ *     Free Software Foundation; either version 2 of the License, or (at your
+ *     option) any later version.
+ */
+
+
+#include "smc.h"
+#include "smclib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+/**
+ * The same objects are often renamed with the same rules again, on other
+ * branches or by other builds. The cache keeps every output under the digest
+ * of the input and of the rules, as told by rules_digest(), so that renaming
+ * the same input with the same rules again is a copy from the cache.
+ *
+ * Outputs are kept in 16 subdirectories, by the first hex digit of the key,
+ * and written by save_atomic(), so that processes sharing the cache never
+ * see a partial output. Each subdirectory is kept under 1/16 of
+ * the size of the cache: once an output stored there makes it larger, the
+ * least recently used outputs are removed, by modification time, which a
+ * hit sets to the current time. Only the subdirectory written to is looked
+ * over, so that storing costs in proportion to 1/16 of the cache.
+ *
+ * Outputs are copied from the cache rather than linked to it, since a hard
+ * link would share its modification time with the other files linked to
+ * the same output, and whatever rewrote such a file in place would change
+ * the cache with it.
+ *
+ * The cache is a speedup only: failing to store an output, or to make room,
+ * is not an error.
+ */
+
+#define CACHE_DIRS  16   ///< Number of subdirectories.
+#define PATH_SIZE   4096 ///< Size of the path buffers.
+
+/**
+ * @brief An output kept in the cache, as found when making room.
+ */
+typedef struct {
+	char  *name;  ///< Name of the file in its subdirectory.
+	size_t size;  ///< Size of the file.
+	time_t mtime; ///< When the file was last stored or used.
+} blob_t;
+
+/**
+ * @brief Contents to save, for save_output().
+ */
+typedef struct {
+	const void *data; ///< The contents.
+	size_t      size; ///< Size of the contents.
+} bytes_t;
+
+/**
+ * @brief Make the key of an input renamed with some rules.
+ *
+ * @param rules The compiled rules.
+ * @param data  Contents of the input file.
+ * @param size  Size of the input file.
+ * @param key   Receives the key in hex digits.
+ */
+static void
+make_key(const rules_t *rules, const void *data, size_t size, char key[CACHE_KEY_SIZE])
+{
+	digest_t d = *rules_digest(rules);
+	digest_update(&d, data, size);
+	snprintf(key, CACHE_KEY_SIZE, "%016llx%016llx", (unsigned long long)d.h[0], (unsigned long long)d.h[1]);
+}
+
+/**
+ * @brief Make the path of a file in the cache.
+ *
+ * @param path Receives the path.
+ * @param dir  Directory of the cache.
+ * @param key  Key of the output, whose first digit picks the subdirectory.
+ * @param name Name of the file in the subdirectory, or NULL for the
+ *             subdirectory itself.
+ */
+static void
+cache_path(char path[PATH_SIZE], const char *dir, const char *key, const char *name)
+{
+	int n = name ? snprintf(path, PATH_SIZE, "%s/%c/%s", dir, key[0], name)
+	             : snprintf(path, PATH_SIZE, "%s/%c", dir, key[0]);
+	if (n < 0 || n >= PATH_SIZE)
+		error("Cache directory name '%s' is too long.", dir);
+}
+
+/**
+ * @brief Create a directory unless it exists.
+ *
+ * @param path The directory.
+ */
+static void
+make_dir(const char *path)
+{
+#ifdef _WIN32
+	_mkdir(path);
+#else
+	mkdir(path, 0777);
+#endif
+}
+
+/**
+ * @brief Write contents for save_output().
+ *
+ * @param src The contents.
+ * @param out The output.
+ */
+static void
+emit_bytes(const void *src, out_t *out)
+{
+	const bytes_t *b = src;
+	out_write(out, b->data, b->size);
+}
+
+/**
+ * @brief Copy the output of an input renamed with some rules from the
+ *        cache, if it holds it.
+ *
+ * The input is digested once: the key is kept for cache_save() to store the
+ * output under on a miss.
+ *
+ * @param rules   The compiled rules.
+ * @param data    Contents of the input file.
+ * @param size    Size of the input file.
+ * @param key     Receives the key of the input, or an empty string if there
+ *                is no cache.
+ * @param outfile Name of the output file.
+ * @param out     The output stream, or NULL to open outfile.
+ * @return true if the output was found and saved.
+ */
+bool
+cache_fetch(const rules_t *rules, const void *data, size_t size, char key[CACHE_KEY_SIZE],
+            const char *outfile, FILE *out)
+{
+	size_t limit;
+	const char *dir = rules_cache(rules, &limit);
+	*key = '\0';
+	if (!dir)
+		return false;
+	char path[PATH_SIZE];
+	make_key(rules, data, size, key);
+	cache_path(path, dir, key, key);
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+	void *blob;
+	size_t n = read_stream(fp, path, &blob);
+	fclose(fp);
+	// Mark the output as used, for the eviction.
+	utime(path, NULL);
+	// Release the output before passing an error on.
+	jmp_buf outer;
+	memcpy(outer, _buf, sizeof(jmp_buf));
+	if (setjmp(_buf)) {
+		free(blob);
+		memcpy(_buf, outer, sizeof(jmp_buf));
+		longjmp(_buf, 1);
+	}
+	bytes_t b = { blob, n };
+	save_output(outfile, out, n, emit_bytes, &b);
+	memcpy(_buf, outer, sizeof(jmp_buf));
+	free(blob);
+	return true;
+}
+
+/**
+ * @brief Order outputs from the least recently used.
+ *
+ * @param a The first output.
+ * @param b The second output.
+ * @return Negative, zero or positive, as for qsort.
+ */
+static int
+compare_blobs(const void *a, const void *b)
+{
+	const blob_t *x = a, *y = b;
+	return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/**
+ * @brief Remove the least recently used outputs of a subdirectory until it
+ *        is 10% under its share of the cache, if it is over.
+ *
+ * @param sub   The subdirectory.
+ * @param keep  Name of the output just stored, which is kept even though
+ *              others may have been used at the same second.
+ * @param limit Size the subdirectory is kept under.
+ */
+static void
+evict(const char *sub, const char *keep, size_t limit)
+{
+	DIR *d = opendir(sub);
+	if (!d)
+		return;
+	arena_t *names = new_arena();
+	buf_t *list = new_buf();
+	size_t total = 0;
+	char path[PATH_SIZE];
+	for (struct dirent *ent; (ent = readdir(d));) {
+		struct stat st;
+		if (snprintf(path, sizeof(path), "%s/%s", sub, ent->d_name) >= (int)sizeof(path)
+		 || stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		total += st.st_size;
+		if (strcmp(ent->d_name, keep) == 0)
+			continue;
+		blob_t b = { arena_strndup(names, ent->d_name, strlen(ent->d_name)), st.st_size, st.st_mtime };
+		buf_ncat(list, (const char*)&b, sizeof(b));
+	}
+	closedir(d);
+	if (total > limit) {
+		blob_t *blobs = list->buf;
+		size_t n = list->cnt / sizeof(blob_t);
+		qsort(blobs, n, sizeof(blob_t), compare_blobs);
+		for (size_t i = 0; i < n && total > limit - limit / 10; ++i) {
+			if (snprintf(path, sizeof(path), "%s/%s", sub, blobs[i].name) < (int)sizeof(path)
+			 && remove(path) == 0)
+				total -= blobs[i].size;
+		}
+	}
+	del_buf(list);
+	del_arena(names);
+}
+
+/**
+ * @brief Save the output of an input renamed with some rules, and keep a
+ *        copy in the cache.
+ *
+ * @param rules   The compiled rules.
+ * @param key     Key of the input, as cache_fetch() made it.
+ * @param outfile Name of the output file.
+ * @param out     The output stream, or NULL to open outfile.
+ * @param outsize Size of the output.
+ * @param write   Writes the output.
+ * @param src     What to pass to `write`.
+ */
+void
+cache_save(const rules_t *rules, const char *key, const char *outfile, FILE *out,
+           size_t outsize, writer_t write, const void *src)
+{
+	save_output(outfile, out, outsize, write, src);
+	size_t limit;
+	const char *dir = rules_cache(rules, &limit);
+	if (!dir || !*key)
+		return;
+	char sub[PATH_SIZE], path[PATH_SIZE];
+	cache_path(sub, dir, key, NULL);
+	cache_path(path, dir, key, key);
+	make_dir(dir);
+	make_dir(sub);
+	if (save_atomic(path, write, src))
+		evict(sub, key, limit / CACHE_DIRS);
+}
@@ -0,0 +1,133 @@
+#ifndef _COFF_H
+#define _COFF_H
+
+/**
+ * COFF structures as declared by <windows.h>. Elsewhere the subset used by
+ * SMC is declared here under the same names, so that SMC can also be built
+ * on POSIX systems.
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdint.h>
+
+typedef uint8_t  BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int16_t  SHORT;
+typedef int32_t  LONG;
+
+#pragma pack(push, 2)
+
+typedef struct _IMAGE_FILE_HEADER {
+	WORD  Machine;
+	WORD  NumberOfSections;
+	DWORD TimeDateStamp;
+	DWORD PointerToSymbolTable;
+	DWORD NumberOfSymbols;
+	WORD  SizeOfOptionalHeader;
+	WORD  Characteristics;
+} IMAGE_FILE_HEADER, *PIMAGE_FILE_HEADER;
+
+typedef struct _IMAGE_SYMBOL {
+	union {
+		BYTE ShortName[8];
+		struct {
+			DWORD Short;
+			DWORD Long;
+		} Name;
+		DWORD LongName[2];
+	} N;
+	DWORD Value;
+	SHORT SectionNumber;
+	WORD  Type;
+	BYTE  StorageClass;
+	BYTE  NumberOfAuxSymbols;
+} IMAGE_SYMBOL, *PIMAGE_SYMBOL;
+
+typedef struct _IMAGE_SYMBOL_EX {
+	union {
+		BYTE ShortName[8];
+		struct {
+			DWORD Short;
+			DWORD Long;
+		} Name;
+		DWORD LongName[2];
+	} N;
+	DWORD Value;
+	LONG  SectionNumber;
+	WORD  Type;
+	BYTE  StorageClass;
+	BYTE  NumberOfAuxSymbols;
+} IMAGE_SYMBOL_EX, *PIMAGE_SYMBOL_EX;
+
+typedef struct _IMAGE_SECTION_HEADER {
+	BYTE  Name[8];
+	union {
+		DWORD PhysicalAddress;
+		DWORD VirtualSize;
+	} Misc;
+	DWORD VirtualAddress;
+	DWORD SizeOfRawData;
+	DWORD PointerToRawData;
+	DWORD PointerToRelocations;
+	DWORD PointerToLinenumbers;
+	WORD  NumberOfRelocations;
+	WORD  NumberOfLinenumbers;
+	DWORD Characteristics;
+} IMAGE_SECTION_HEADER, *PIMAGE_SECTION_HEADER;
+
+#pragma pack(pop)
+
+typedef struct ANON_OBJECT_HEADER_BIGOBJ {
+	WORD  Sig1;
+	WORD  Sig2;
+	WORD  Version;
+	WORD  Machine;
+	DWORD TimeDateStamp;
+	BYTE  ClassID[16];
+	DWORD SizeOfData;
+	DWORD Flags;
+	DWORD MetaDataSize;
+	DWORD MetaDataOffset;
+	DWORD NumberOfSections;
+	DWORD PointerToSymbolTable;
+	DWORD NumberOfSymbols;
+} ANON_OBJECT_HEADER_BIGOBJ;
+
+#define IMAGE_SIZEOF_SYMBOL    18
+#define IMAGE_SIZEOF_SYMBOL_EX 20
+
+#define IMAGE_SIZEOF_SHORT_NAME     8
+#define IMAGE_SIZEOF_SECTION_HEADER 40
+
+#define IMAGE_SCN_LNK_INFO         0x00000200
+#define IMAGE_SCN_LNK_NRELOC_OVFL  0x01000000
+
+#define IMAGE_SIZEOF_RELOCATION 10
+
+#define IMAGE_COMDAT_SELECT_ASSOCIATIVE 5
+
+#define IMAGE_SYM_UNDEFINED ((SHORT)0)
+#define IMAGE_SYM_ABSOLUTE  ((SHORT)-1)
+#define IMAGE_SYM_DEBUG     ((SHORT)-2)
+
+#define IMAGE_SYM_DTYPE_FUNCTION 2
+
+#define IMAGE_SYM_CLASS_EXTERNAL      0x0002
+#define IMAGE_SYM_CLASS_STATIC        0x0003
+#define IMAGE_SYM_CLASS_LABEL         0x0006
+#define IMAGE_SYM_CLASS_FUNCTION      0x0065
+#define IMAGE_SYM_CLASS_FILE          0x0067
+#define IMAGE_SYM_CLASS_SECTION       0x0068
+#define IMAGE_SYM_CLASS_WEAK_EXTERNAL 0x0069
+
+#define N_BTMASK 0x000f
+#define N_TMASK  0x0030
+#define N_BTSHFT 4
+#define ISFCN(x) (((x) & N_TMASK) == (IMAGE_SYM_DTYPE_FUNCTION << N_BTSHFT))
+
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,1365 @@
+/**
+ * @file demangle.c
+ * @brief C++ Name Demangler for Symbol Modifier for COFF (SMC).
+ *
+ * @author Dangfer
+ * @date 2024-01-07
+ * @version 1.0.0
+ *
+ * Note:
+ *     This file is part of the SMC tool and is intended to be used in
+ *     conjunction with the main application. It is not designed to be used
+ *     independently.
+ *
+ * License:
+ *     This program is free software; you can redistribute it and/or modify it
+ *     under the terms  of the GNU General Public License as published by the
+ *     Free Software Foundation; either version 2 of the License, or (at your
+ *     option) any later version.
+ */
+
+
+#include "demangle.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Demangler */
+/**
+ * The demangler turns MSVC ('?name@scope@@...') and Itanium ('_Z...') names
+ * into the same spelling, so that one rule matches the symbol of either
+ * toolchain:
+ *
+ *     ?foo@ns@@YAHPEBDH@Z  ->  ns::foo(char const*, int)
+ *     _ZN2ns3fooEPKci      ->  ns::foo(char const*, int)
+ *
+ * Only the qualified name, the parameter list and the cv-qualifiers of member
+ * functions are produced; return types, calling conventions and access
+ * specifiers are dropped. Constructs outside the supported subset (function
+ * pointers, arrays, expressions, lambdas, thunks, RTTI descriptors) make the
+ * demangler give up rather than guess.
+ *
+ * All intermediate strings live in a fixed scratch buffer, so demangling
+ * never allocates.
+ */
+
+#define DEM_BUF   8192 ///< Size of the scratch buffer.
+#define DEM_SUBS  64   ///< Maximum number of substitutions or name back-references.
+#define DEM_TARGS 32   ///< Maximum number of template or argument back-references.
+
+/**
+ * @brief A string in the scratch buffer.
+ */
+typedef struct {
+	uint16_t off; ///< Offset into the scratch buffer.
+	uint16_t len; ///< Length of the string.
+} str_t;
+
+/**
+ * @brief State of the demangler.
+ */
+typedef struct {
+	const char *p;               ///< Next character of the mangled name.
+	const char *end;             ///< End of the mangled name.
+	bool        err;             ///< Unsupported or malformed name.
+	int         nsubs;           ///< Number of substitutions (Itanium) or names (MSVC).
+	int         ntargs;          ///< Number of template arguments (Itanium) or types (MSVC).
+	str_t       subs[DEM_SUBS];  ///< Substitution candidates or name back-references.
+	str_t       targs[DEM_TARGS];///< Template arguments or argument type back-references.
+	size_t      used;            ///< Number of bytes used in `buf`.
+	char        buf[DEM_BUF];    ///< Scratch buffer holding all strings.
+} dem_t;
+
+static const str_t NIL = { 0, 0 };
+
+static inline char
+peek(const dem_t *d)
+{
+	return d->p < d->end ? *d->p : '\0';
+}
+
+static inline char
+peek_at(const dem_t *d, size_t i)
+{
+	return d->p + i < d->end ? d->p[i] : '\0';
+}
+
+static inline bool
+eat(dem_t *d, char c)
+{
+	if (peek(d) != c)
+		return false;
+	++d->p;
+	return true;
+}
+
+static inline bool
+is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+/**
+ * @brief Marks the name as not demangleable.
+ *
+ * @return An empty string, so that callers can return the result directly.
+ */
+static str_t
+fail(dem_t *d)
+{
+	d->err = true;
+	return NIL;
+}
+
+/**
+ * @brief Appends bytes to the scratch buffer.
+ *
+ * Strings are built by remembering `d->used`, appending their parts and
+ * calling done(). Parts may be earlier strings of the scratch buffer, but no
+ * other string may be built in between.
+ */
+static void
+put(dem_t *d, const char *s, size_t len)
+{
+	if (d->used + len > DEM_BUF) {
+		d->err = true;
+		return;
+	}
+	memcpy(d->buf + d->used, s, len);
+	d->used += len;
+}
+
+static inline void
+put_lit(dem_t *d, const char *s)
+{
+	put(d, s, strlen(s));
+}
+
+static inline void
+put_str(dem_t *d, str_t s)
+{
+	put(d, d->buf + s.off, s.len);
+}
+
+static inline str_t
+done(dem_t *d, size_t mark)
+{
+	return d->err ? NIL : (str_t){ mark, d->used - mark };
+}
+
+static str_t
+lit(dem_t *d, const char *s)
+{
+	size_t mark = d->used;
+	put_lit(d, s);
+	return done(d, mark);
+}
+
+static str_t
+cat3(dem_t *d, str_t a, const char *sep, str_t b)
+{
+	size_t mark = d->used;
+	put_str(d, a);
+	put_lit(d, sep);
+	put_str(d, b);
+	return done(d, mark);
+}
+
+/**
+ * @brief Joins template arguments into '<a, b>', with a space between
+ *        consecutive closing brackets.
+ */
+static str_t
+template_list(dem_t *d, const str_t *args, int n)
+{
+	size_t mark = d->used;
+	put(d, "<", 1);
+	for (int i = 0; i < n; ++i) {
+		if (i)
+			put(d, ", ", 2);
+		put_str(d, args[i]);
+	}
+	if (d->used > mark + 1 && d->buf[d->used - 1] == '>')
+		put(d, " ", 1);
+	put(d, ">", 1);
+	return done(d, mark);
+}
+
+/**
+ * @brief Joins parameters into '(a, b)' followed by a qualifier suffix.
+ */
+static str_t
+param_list(dem_t *d, str_t name, const str_t *params, int n, const char *suffix)
+{
+	size_t mark = d->used;
+	put_str(d, name);
+	put(d, "(", 1);
+	for (int i = 0; i < n; ++i) {
+		if (i)
+			put(d, ", ", 2);
+		put_str(d, params[i]);
+	}
+	put(d, ")", 1);
+	put_lit(d, suffix);
+	return done(d, mark);
+}
+
+/* Itanium */
+
+/**
+ * @brief What the Itanium demangler learned about the name of an encoding.
+ */
+typedef struct {
+	bool  targs; ///< The name ends with template arguments.
+	bool  ctor;  ///< Constructor, destructor or conversion: no return type.
+	int   cv;    ///< cv-qualifiers of a member function.
+	int   ref;   ///< Ref-qualifier of a member function: 0, '&' or '&&' (2).
+	str_t last;  ///< Last source name, naming constructors and destructors.
+} itname_t;
+
+enum { CV_RESTRICT = 1, CV_VOLATILE = 2, CV_CONST = 4 };
+
+static str_t it_type(dem_t *d);
+static str_t it_name(dem_t *d, itname_t *ni);
+static str_t it_encoding(dem_t *d);
+
+static void
+it_push(dem_t *d, str_t s)
+{
+	if (d->nsubs == DEM_SUBS)
+		d->err = true;
+	else
+		d->subs[d->nsubs++] = s;
+}
+
+static int
+it_cv(dem_t *d)
+{
+	int cv = 0;
+	if (eat(d, 'r'))
+		cv |= CV_RESTRICT;
+	if (eat(d, 'V'))
+		cv |= CV_VOLATILE;
+	if (eat(d, 'K'))
+		cv |= CV_CONST;
+	return cv;
+}
+
+static void
+put_cv(dem_t *d, int cv)
+{
+	if (cv & CV_CONST)
+		put_lit(d, " const");
+	if (cv & CV_VOLATILE)
+		put_lit(d, " volatile");
+	if (cv & CV_RESTRICT)
+		put_lit(d, " restrict");
+}
+
+/**
+ * @brief Parses a <number>, which may be negative.
+ */
+static long
+it_number(dem_t *d, bool *neg)
+{
+	*neg = eat(d, 'n');
+	if (!is_digit(peek(d))) {
+		d->err = true;
+		return 0;
+	}
+	long n = 0;
+	while (is_digit(peek(d)) && n < 0x10000000)
+		n = n * 10 + (*d->p++ - '0');
+	return n;
+}
+
+/**
+ * @brief Parses a <seq-id> followed by '_', where a bare '_' is 0.
+ */
+static size_t
+it_seq_id(dem_t *d)
+{
+	size_t n = 0;
+	if (!eat(d, '_')) {
+		while (is_digit(peek(d)) || (peek(d) >= 'A' && peek(d) <= 'Z')) {
+			char c = *d->p++;
+			n = n * 36 + (is_digit(c) ? c - '0' : c - 'A' + 10);
+		}
+		if (!eat(d, '_'))
+			d->err = true;
+		++n;
+	}
+	return n;
+}
+
+static str_t
+it_source_name(dem_t *d)
+{
+	bool neg;
+	long len = it_number(d, &neg);
+	if (d->err || neg || len <= 0 || len > d->end - d->p)
+		return fail(d);
+	const char *s = d->p;
+	d->p += len;
+	if (len >= 10 && memcmp(s, "_GLOBAL__N", 10) == 0)
+		return lit(d, "(anonymous namespace)");
+	size_t mark = d->used;
+	put(d, s, len);
+	return done(d, mark);
+}
+
+static const char *
+it_builtin(dem_t *d)
+{
+	static const char *const types[26] = {
+		['a' - 'a'] = "signed char",   ['b' - 'a'] = "bool",
+		['c' - 'a'] = "char",          ['d' - 'a'] = "double",
+		['e' - 'a'] = "long double",   ['f' - 'a'] = "float",
+		['g' - 'a'] = "__float128",    ['h' - 'a'] = "unsigned char",
+		['i' - 'a'] = "int",           ['j' - 'a'] = "unsigned int",
+		['l' - 'a'] = "long",          ['m' - 'a'] = "unsigned long",
+		['n' - 'a'] = "__int128",      ['o' - 'a'] = "unsigned __int128",
+		['s' - 'a'] = "short",         ['t' - 'a'] = "unsigned short",
+		['v' - 'a'] = "void",          ['w' - 'a'] = "wchar_t",
+		['x' - 'a'] = "long long",     ['y' - 'a'] = "unsigned long long",
+		['z' - 'a'] = "...",
+	};
+	char c = peek(d);
+	if (c >= 'a' && c <= 'z' && types[c - 'a']) {
+		++d->p;
+		return types[c - 'a'];
+	}
+	if (c == 'D') {
+		const char *t = NULL;
+		switch (peek_at(d, 1)) {
+		case 'n': t = "decltype(nullptr)"; break;
+		case 's': t = "char16_t"; break;
+		case 'i': t = "char32_t"; break;
+		case 'u': t = "char8_t"; break;
+		case 'a': t = "auto"; break;
+		case 'c': t = "decltype(auto)"; break;
+		}
+		if (t)
+			d->p += 2;
+		return t;
+	}
+	return NULL;
+}
+
+static str_t
+it_substitution(dem_t *d)
+{
+	static const char *const std_subs[26] = {
+		['a' - 'a'] = "std::allocator", ['b' - 'a'] = "std::basic_string",
+		['s' - 'a'] = "std::string",    ['i' - 'a'] = "std::istream",
+		['o' - 'a'] = "std::ostream",   ['d' - 'a'] = "std::iostream",
+	};
+	++d->p; // 'S'
+	char c = peek(d);
+	if (c >= 'a' && c <= 'z') {
+		++d->p;
+		return std_subs[c - 'a'] ? lit(d, std_subs[c - 'a']) : fail(d);
+	}
+	size_t n = it_seq_id(d);
+	if (d->err || n >= (size_t)d->nsubs)
+		return fail(d);
+	return d->subs[n];
+}
+
+static str_t
+it_template_param(dem_t *d)
+{
+	++d->p; // 'T'
+	size_t n = it_seq_id(d);
+	if (d->err || n >= (size_t)d->ntargs)
+		return fail(d);
+	return d->targs[n];
+}
+
+/**
+ * @brief Parses an <expr-primary> template argument: a literal or the
+ *        address of an entity.
+ */
+static str_t
+it_expr_primary(dem_t *d)
+{
+	++d->p; // 'L'
+	if (peek(d) == '_' && peek_at(d, 1) == 'Z') {
+		d->p += 2;
+		str_t s = it_encoding(d);
+		return eat(d, 'E') ? s : fail(d);
+	}
+	char t = peek(d);
+	const char *type = it_builtin(d);
+	if (!type)
+		return fail(d);
+	bool neg;
+	long v = it_number(d, &neg);
+	if (d->err || !eat(d, 'E'))
+		return fail(d);
+	size_t mark = d->used;
+	if (t == 'b') {
+		put_lit(d, v ? "true" : "false");
+		return done(d, mark);
+	}
+	const char *suffix = NULL;
+	switch (t) {
+	case 'i': suffix = "";    break;
+	case 'j': suffix = "u";   break;
+	case 'l': suffix = "l";   break;
+	case 'm': suffix = "ul";  break;
+	case 'x': suffix = "ll";  break;
+	case 'y': suffix = "ull"; break;
+	}
+	if (!suffix) {
+		put(d, "(", 1);
+		put_lit(d, type);
+		put(d, ")", 1);
+	}
+	char digits[24];
+	int n = 0;
+	do
+		digits[n++] = '0' + v % 10;
+	while (v /= 10);
+	if (neg)
+		put(d, "-", 1);
+	while (n)
+		put(d, &digits[--n], 1);
+	if (suffix)
+		put_lit(d, suffix);
+	return done(d, mark);
+}
+
+static str_t it_template_arg(dem_t *d);
+
+/**
+ * @brief Parses 'I' <template-arg>+ 'E'.
+ *
+ * @param record Whether the arguments are those of the encoding's name,
+ *               which template parameters ('T_') refer to.
+ */
+static str_t
+it_template_args(dem_t *d, bool record)
+{
+	++d->p; // 'I'
+	str_t args[DEM_TARGS];
+	int n = 0;
+	while (!eat(d, 'E')) {
+		if (d->err || n == DEM_TARGS || d->p == d->end)
+			return fail(d);
+		args[n++] = it_template_arg(d);
+	}
+	if (record) {
+		memcpy(d->targs, args, n * sizeof(str_t));
+		d->ntargs = n;
+	}
+	return template_list(d, args, n);
+}
+
+static str_t
+it_template_arg(dem_t *d)
+{
+	switch (peek(d)) {
+	case 'L':
+		return it_expr_primary(d);
+	case 'J': { // Argument pack.
+		++d->p;
+		str_t args[DEM_TARGS];
+		int n = 0;
+		while (!eat(d, 'E')) {
+			if (d->err || n == DEM_TARGS || d->p == d->end)
+				return fail(d);
+			args[n++] = it_template_arg(d);
+		}
+		size_t mark = d->used;
+		for (int i = 0; i < n; ++i) {
+			if (i)
+				put(d, ", ", 2);
+			put_str(d, args[i]);
+		}
+		return done(d, mark);
+	}
+	case 'X': // Expressions are not supported.
+		return fail(d);
+	}
+	return it_type(d);
+}
+
+static str_t
+it_operator(dem_t *d, itname_t *ni)
+{
+	static const struct {
+		char        code[3];
+		const char *name;
+	} ops[] = {
+		{ "nw", " new" }, { "na", " new[]" }, { "dl", " delete" }, { "da", " delete[]" },
+		{ "ps", "+" },   { "ng", "-" },   { "ad", "&" },   { "de", "*" },
+		{ "co", "~" },   { "pl", "+" },   { "mi", "-" },   { "ml", "*" },
+		{ "dv", "/" },   { "rm", "%" },   { "an", "&" },   { "or", "|" },
+		{ "eo", "^" },   { "aS", "=" },   { "pL", "+=" },  { "mI", "-=" },
+		{ "mL", "*=" },  { "dV", "/=" },  { "rM", "%=" },  { "aN", "&=" },
+		{ "oR", "|=" },  { "eO", "^=" },  { "ls", "<<" },  { "rs", ">>" },
+		{ "lS", "<<=" }, { "rS", ">>=" }, { "eq", "==" },  { "ne", "!=" },
+		{ "lt", "<" },   { "gt", ">" },   { "le", "<=" },  { "ge", ">=" },
+		{ "ss", "<=>" }, { "nt", "!" },   { "aa", "&&" },  { "oo", "||" },
+		{ "pp", "++" },  { "mm", "--" },  { "cm", "," },   { "pm", "->*" },
+		{ "pt", "->" },  { "cl", "()" },  { "ix", "[]" },  { "qu", "?" },
+	};
+	char a = peek(d), b = peek_at(d, 1);
+	d->p += 2;
+	if (a == 'c' && b == 'v') { // Conversion operator.
+		str_t t = it_type(d);
+		if (ni)
+			ni->ctor = true;
+		size_t mark = d->used;
+		put_lit(d, "operator ");
+		put_str(d, t);
+		return done(d, mark);
+	}
+	if (a == 'l' && b == 'i') { // Literal operator.
+		str_t s = it_source_name(d);
+		size_t mark = d->used;
+		put_lit(d, "operator\"\" ");
+		put_str(d, s);
+		return done(d, mark);
+	}
+	for (size_t i = 0; i < sizeof(ops) / sizeof(*ops); ++i) {
+		if (ops[i].code[0] == a && ops[i].code[1] == b) {
+			size_t mark = d->used;
+			put_lit(d, "operator");
+			put_lit(d, ops[i].name);
+			return done(d, mark);
+		}
+	}
+	return fail(d);
+}
+
+/**
+ * @brief Parses an <unqualified-name>, including constructor and destructor
+ *        names and ABI tags.
+ */
+static str_t
+it_unqualified(dem_t *d, itname_t *ni)
+{
+	eat(d, 'L'); // Internal linkage.
+	char c = peek(d);
+	str_t s;
+	if (is_digit(c)) {
+		s = it_source_name(d);
+		ni->last = s;
+	} else if (c == 'C' && is_digit(peek_at(d, 1))) {
+		d->p += 2;
+		s = ni->last;
+		ni->ctor = true;
+	} else if (c == 'D' && is_digit(peek_at(d, 1))) {
+		d->p += 2;
+		size_t mark = d->used;
+		put(d, "~", 1);
+		put_str(d, ni->last);
+		s = done(d, mark);
+		ni->ctor = true;
+	} else if (c >= 'a' && c <= 'z') {
+		s = it_operator(d, ni);
+	} else {
+		return fail(d); // Unnamed types and lambdas.
+	}
+	while (eat(d, 'B')) { // ABI tags.
+		str_t tag = it_source_name(d);
+		size_t mark = d->used;
+		put_str(d, s);
+		put_lit(d, "[abi:");
+		put_str(d, tag);
+		put(d, "]", 1);
+		s = done(d, mark);
+	}
+	return s;
+}
+
+static str_t
+it_nested(dem_t *d, itname_t *ni)
+{
+	++d->p; // 'N'
+	itname_t local = { 0 };
+	bool top = ni != NULL;
+	if (!ni)
+		ni = &local;
+	ni->cv = it_cv(d);
+	if (eat(d, 'R'))
+		ni->ref = 1;
+	else if (eat(d, 'O'))
+		ni->ref = 2;
+	str_t t = NIL;
+	bool have = false, pushed = false;
+	while (!eat(d, 'E')) {
+		if (d->err || d->p == d->end)
+			return fail(d);
+		char c = peek(d);
+		if (c == 'S' && peek_at(d, 1) == 't') {
+			d->p += 2;
+			t = lit(d, "std");
+			have = true;
+			pushed = false;
+			continue;
+		}
+		if (c == 'S') {
+			if (have)
+				return fail(d);
+			t = it_substitution(d);
+			have = true;
+			pushed = false;
+			continue;
+		}
+		if (c == 'I') {
+			if (!have)
+				return fail(d);
+			str_t args = it_template_args(d, top);
+			t = cat3(d, t, "", args);
+			ni->targs = true;
+		} else {
+			str_t u = c == 'T' ? it_template_param(d) : it_unqualified(d, ni);
+			t = have ? cat3(d, t, "::", u) : u;
+			ni->targs = false;
+		}
+		have = true;
+		it_push(d, t);
+		pushed = true;
+	}
+	if (!have)
+		return fail(d);
+	if (pushed)
+		--d->nsubs;
+	return t;
+}
+
+static str_t
+it_local(dem_t *d, itname_t *ni)
+{
+	++d->p; // 'Z'
+	str_t enc = it_encoding(d);
+	if (!eat(d, 'E'))
+		return fail(d);
+	str_t name = eat(d, 's') ? lit(d, "string literal") : it_name(d, ni);
+	if (eat(d, '_')) { // Discriminator.
+		if (eat(d, '_')) {
+			while (is_digit(peek(d)))
+				++d->p;
+			if (!eat(d, '_'))
+				return fail(d);
+		} else if (is_digit(peek(d))) {
+			++d->p;
+		} else {
+			return fail(d);
+		}
+	}
+	return cat3(d, enc, "::", name);
+}
+
+static str_t
+it_name(dem_t *d, itname_t *ni)
+{
+	itname_t local = { 0 };
+	itname_t *info = ni ? ni : &local;
+	str_t t;
+	switch (peek(d)) {
+	case 'N':
+		return it_nested(d, ni);
+	case 'Z':
+		return it_local(d, info);
+	case 'S':
+		if (peek_at(d, 1) != 't') {
+			t = it_substitution(d);
+			if (peek(d) == 'I') {
+				str_t args = it_template_args(d, ni != NULL);
+				info->targs = true;
+				t = cat3(d, t, "", args);
+			}
+			return t;
+		}
+		d->p += 2;
+		t = cat3(d, lit(d, "std"), "::", it_unqualified(d, info));
+		break;
+	default:
+		t = it_unqualified(d, info);
+		break;
+	}
+	if (peek(d) == 'I') {
+		it_push(d, t);
+		str_t args = it_template_args(d, ni != NULL);
+		info->targs = true;
+		t = cat3(d, t, "", args);
+	}
+	return t;
+}
+
+static str_t
+it_type(dem_t *d)
+{
+	const char *builtin = it_builtin(d);
+	if (builtin)
+		return lit(d, builtin);
+	str_t t;
+	size_t mark;
+	switch (peek(d)) {
+	case 'r': case 'V': case 'K': {
+		int cv = it_cv(d);
+		str_t inner = it_type(d);
+		mark = d->used;
+		put_str(d, inner);
+		put_cv(d, cv);
+		t = done(d, mark);
+		break;
+	}
+	case 'P': case 'R': case 'O': {
+		char c = *d->p++;
+		str_t inner = it_type(d);
+		t = cat3(d, inner, c == 'P' ? "*" : c == 'R' ? "&" : "&&", NIL);
+		break;
+	}
+	case 'S':
+		if (peek_at(d, 1) == 't') {
+			t = it_name(d, NULL);
+			break;
+		}
+		t = it_substitution(d);
+		if (peek(d) != 'I')
+			return t; // Substitutions are not candidates again.
+		t = cat3(d, t, "", it_template_args(d, false));
+		break;
+	case 'T':
+		t = it_template_param(d);
+		if (peek(d) == 'I') {
+			it_push(d, t);
+			t = cat3(d, t, "", it_template_args(d, false));
+		}
+		break;
+	case 'D':
+		if (peek_at(d, 1) != 'p')
+			return fail(d);
+		d->p += 2; // Pack expansion.
+		t = cat3(d, it_type(d), "...", NIL);
+		break;
+	case 'N': case 'Z':
+	case '0': case '1': case '2': case '3': case '4':
+	case '5': case '6': case '7': case '8': case '9':
+		t = it_name(d, NULL);
+		break;
+	default: // Function, array and pointer-to-member types are not supported.
+		return fail(d);
+	}
+	it_push(d, t);
+	return t;
+}
+
+static str_t
+it_encoding(dem_t *d)
+{
+	static const struct {
+		char        code[3];
+		const char *name;
+	} specials[] = {
+		{ "TV", "vtable for " }, { "TT", "VTT for " },
+		{ "TI", "typeinfo for " }, { "TS", "typeinfo name for " },
+	};
+	if (peek(d) == 'T' || (peek(d) == 'G' && peek_at(d, 1) == 'V')) {
+		char a = peek(d), b = peek_at(d, 1);
+		d->p += 2;
+		if (a == 'G') {
+			str_t name = it_name(d, NULL);
+			return cat3(d, lit(d, "guard variable for "), "", name);
+		}
+		for (size_t i = 0; i < sizeof(specials) / sizeof(*specials); ++i)
+			if (specials[i].code[0] == a && specials[i].code[1] == b)
+				return cat3(d, lit(d, specials[i].name), "", it_type(d));
+		return fail(d); // Thunks.
+	}
+	itname_t ni = { 0 };
+	str_t name = it_name(d, &ni);
+	if (d->err || d->p == d->end || peek(d) == 'E' || peek(d) == '.')
+		return name; // Data.
+	if (ni.targs && !ni.ctor)
+		it_type(d); // Return type of a function template.
+	str_t params[DEM_TARGS];
+	int n = 0;
+	if (peek(d) == 'v' && (d->p + 1 == d->end || peek_at(d, 1) == 'E' || peek_at(d, 1) == '.'))
+		++d->p;
+	while (!d->err && d->p < d->end && peek(d) != 'E' && peek(d) != '.') {
+		if (n == DEM_TARGS)
+			return fail(d);
+		params[n++] = it_type(d);
+	}
+	const char *suffix[8] = {
+		"", " restrict", " volatile", " volatile restrict",
+		" const", " const restrict", " const volatile", " const volatile restrict",
+	};
+	size_t mark = d->used;
+	str_t s = param_list(d, name, params, n, suffix[ni.cv]);
+	if (ni.ref) {
+		put_lit(d, ni.ref == 1 ? " &" : " &&");
+		s = done(d, mark);
+	}
+	return s;
+}
+
+static str_t
+demangle_itanium(dem_t *d)
+{
+	str_t s = it_encoding(d);
+	if (d->p < d->end && *d->p == '.') { // Clone suffix.
+		size_t mark = d->used;
+		put_str(d, s);
+		put_lit(d, " [clone ");
+		put(d, d->p, d->end - d->p);
+		put(d, "]", 1);
+		d->p = d->end;
+		s = done(d, mark);
+	}
+	return d->p == d->end ? s : fail(d);
+}
+
+/* MSVC */
+
+static str_t ms_type(dem_t *d);
+static str_t ms_qualified(dem_t *d);
+
+/**
+ * @brief Remembers a name for back-references '0'..'9'.
+ */
+static void
+ms_memorize_name(dem_t *d, str_t s)
+{
+	for (int i = 0; i < d->nsubs; ++i)
+		if (d->subs[i].len == s.len && memcmp(d->buf + d->subs[i].off, d->buf + s.off, s.len) == 0)
+			return;
+	if (d->nsubs < 10)
+		d->subs[d->nsubs++] = s;
+}
+
+/**
+ * @brief Parses an encoded number: '0'..'9' for 1..10, or hex digits 'A'..'P'
+ *        terminated by '@', optionally negated by a leading '?'.
+ */
+static long long
+ms_number(dem_t *d, bool *neg)
+{
+	*neg = eat(d, '?');
+	if (is_digit(peek(d)))
+		return *d->p++ - '0' + 1;
+	long long n = 0;
+	while (peek(d) >= 'A' && peek(d) <= 'P')
+		n = n * 16 + (*d->p++ - 'A');
+	if (!eat(d, '@'))
+		d->err = true;
+	return n;
+}
+
+static str_t
+ms_identifier(dem_t *d)
+{
+	const char *s = d->p;
+	while (d->p < d->end && *d->p != '@')
+		++d->p;
+	if (d->p == s || !eat(d, '@'))
+		return fail(d);
+	size_t mark = d->used;
+	put(d, s, d->p - 1 - s);
+	str_t t = done(d, mark);
+	ms_memorize_name(d, t);
+	return t;
+}
+
+/**
+ * @brief Parses '?$' name '@' template-args '@', with back-references scoped
+ *        to the template.
+ */
+static str_t
+ms_template(dem_t *d)
+{
+	d->p += 2; // '?$'
+	int nsubs = d->nsubs, ntargs = d->ntargs;
+	str_t subs[10], targs[10];
+	memcpy(subs, d->subs, sizeof(subs));
+	memcpy(targs, d->targs, sizeof(targs));
+	d->nsubs = d->ntargs = 0;
+	str_t name = ms_identifier(d);
+	str_t args[DEM_TARGS];
+	int n = 0;
+	while (!d->err && !eat(d, '@')) {
+		if (n == DEM_TARGS || d->p == d->end)
+			return fail(d);
+		if (peek(d) == '$' && peek_at(d, 1) == '0') {
+			d->p += 2;
+			bool neg;
+			long long v = ms_number(d, &neg);
+			char digits[24];
+			int k = 0;
+			do
+				digits[k++] = '0' + v % 10;
+			while (v /= 10);
+			size_t mark = d->used;
+			if (neg)
+				put(d, "-", 1);
+			while (k)
+				put(d, &digits[--k], 1);
+			args[n++] = done(d, mark);
+		} else if (peek(d) == '$' && peek_at(d, 1) == '$'
+		        && (peek_at(d, 2) == 'V' || peek_at(d, 2) == 'Z')) {
+			d->p += 3; // Empty pack.
+		} else if (peek(d) == '$') {
+			return fail(d);
+		} else {
+			args[n++] = ms_type(d);
+		}
+	}
+	str_t t = cat3(d, name, "", template_list(d, args, n));
+	memcpy(d->subs, subs, sizeof(subs));
+	memcpy(d->targs, targs, sizeof(targs));
+	d->nsubs  = nsubs;
+	d->ntargs = ntargs;
+	ms_memorize_name(d, t);
+	return t;
+}
+
+/**
+ * @brief Parses a scope fragment of a qualified name.
+ */
+static str_t
+ms_fragment(dem_t *d)
+{
+	char c = peek(d);
+	if (is_digit(c)) {
+		++d->p;
+		return c - '0' < d->nsubs ? d->subs[c - '0'] : fail(d);
+	}
+	if (c != '?')
+		return ms_identifier(d);
+	if (peek_at(d, 1) == '$')
+		return ms_template(d);
+	if (peek_at(d, 1) == 'A') { // Anonymous namespace.
+		while (d->p < d->end && *d->p != '@')
+			++d->p;
+		if (!eat(d, '@'))
+			return fail(d);
+		str_t t = lit(d, "(anonymous namespace)");
+		ms_memorize_name(d, t);
+		return t;
+	}
+	return fail(d); // Function-local scopes.
+}
+
+/**
+ * @brief Parses scope fragments, innermost first, up to the terminating '@'.
+ *
+ * @return Number of fragments stored in `scopes`.
+ */
+static int
+ms_scopes(dem_t *d, str_t *scopes)
+{
+	int n = 0;
+	while (!d->err && !eat(d, '@')) {
+		if (n == DEM_TARGS || d->p == d->end) {
+			d->err = true;
+			break;
+		}
+		scopes[n++] = ms_fragment(d);
+	}
+	return n;
+}
+
+/**
+ * @brief Joins scope fragments, outermost first, and a name with '::'.
+ */
+static str_t
+ms_join(dem_t *d, const str_t *scopes, int n, str_t name)
+{
+	size_t mark = d->used;
+	for (int i = n - 1; i >= 0; --i) {
+		put_str(d, scopes[i]);
+		put(d, "::", 2);
+	}
+	put_str(d, name);
+	return done(d, mark);
+}
+
+static str_t
+ms_qualified(dem_t *d)
+{
+	str_t scopes[DEM_TARGS];
+	str_t name = ms_fragment(d);
+	int n = ms_scopes(d, scopes);
+	return ms_join(d, scopes, n, name);
+}
+
+static const char *
+ms_simple_type(dem_t *d)
+{
+	static const char *const types[26] = {
+		['C' - 'A'] = "signed char",  ['D' - 'A'] = "char",
+		['E' - 'A'] = "unsigned char", ['F' - 'A'] = "short",
+		['G' - 'A'] = "unsigned short", ['H' - 'A'] = "int",
+		['I' - 'A'] = "unsigned int", ['J' - 'A'] = "long",
+		['K' - 'A'] = "unsigned long", ['M' - 'A'] = "float",
+		['N' - 'A'] = "double",       ['O' - 'A'] = "long double",
+		['X' - 'A'] = "void",
+	};
+	static const char *const ext[26] = {
+		['J' - 'A'] = "long long",    ['K' - 'A'] = "unsigned long long",
+		['N' - 'A'] = "bool",         ['W' - 'A'] = "wchar_t",
+		['S' - 'A'] = "char16_t",     ['U' - 'A'] = "char32_t",
+		['Q' - 'A'] = "char8_t",
+	};
+	char c = peek(d);
+	if (c >= 'A' && c <= 'Z' && types[c - 'A']) {
+		++d->p;
+		return types[c - 'A'];
+	}
+	c = peek_at(d, 1);
+	if (peek(d) == '_' && c >= 'A' && c <= 'Z' && ext[c - 'A']) {
+		d->p += 2;
+		return ext[c - 'A'];
+	}
+	return NULL;
+}
+
+/**
+ * @brief Parses the cv-qualifier letter of a pointee, after any '__ptr64',
+ *        '__unaligned' and '__restrict' modifiers.
+ */
+static int
+ms_cv(dem_t *d)
+{
+	while (peek(d) == 'E' || peek(d) == 'F' || peek(d) == 'I')
+		++d->p;
+	switch (peek(d)) {
+	case 'A': ++d->p; return 0;
+	case 'B': ++d->p; return CV_CONST;
+	case 'C': ++d->p; return CV_VOLATILE;
+	case 'D': ++d->p; return CV_CONST | CV_VOLATILE;
+	}
+	d->err = true;
+	return 0;
+}
+
+static str_t
+ms_type(dem_t *d)
+{
+	const char *simple = ms_simple_type(d);
+	if (simple)
+		return lit(d, simple);
+	char c = peek(d);
+	if (is_digit(c)) {
+		++d->p;
+		return c - '0' < d->ntargs ? d->targs[c - '0'] : fail(d);
+	}
+	const char *ptr = NULL, *self = "";
+	switch (c) {
+	case 'P': ptr = "*"; break;
+	case 'Q': ptr = "*"; self = " const"; break;
+	case 'R': ptr = "*"; self = " volatile"; break;
+	case 'S': ptr = "*"; self = " const volatile"; break;
+	case 'A': ptr = "&"; break;
+	case 'B': ptr = "&"; self = " volatile"; break;
+	}
+	if (ptr) {
+		++d->p;
+		if (peek(d) == '6')
+			return fail(d); // Function pointers.
+		int cv = ms_cv(d);
+		str_t inner = ms_type(d);
+		size_t mark = d->used;
+		put_str(d, inner);
+		put_cv(d, cv);
+		put_lit(d, ptr);
+		put_lit(d, self);
+		return done(d, mark);
+	}
+	switch (c) {
+	case 'T': case 'U': case 'V': // Union, struct and class.
+		++d->p;
+		return ms_qualified(d);
+	case 'W': // Enum with its underlying type.
+		d->p += 2;
+		return ms_qualified(d);
+	case '?': { // cv-qualified return or template argument type.
+		++d->p;
+		int cv = ms_cv(d);
+		str_t inner = ms_type(d);
+		size_t mark = d->used;
+		put_str(d, inner);
+		put_cv(d, cv);
+		return done(d, mark);
+	}
+	case '$':
+		if (peek_at(d, 1) == '$' && peek_at(d, 2) == 'Q') { // Rvalue reference.
+			d->p += 3;
+			int cv = ms_cv(d);
+			str_t inner = ms_type(d);
+			size_t mark = d->used;
+			put_str(d, inner);
+			put_cv(d, cv);
+			put_lit(d, "&&");
+			return done(d, mark);
+		}
+		if (peek_at(d, 1) == '$' && peek_at(d, 2) == 'T') {
+			d->p += 3;
+			return lit(d, "std::nullptr_t");
+		}
+		break;
+	}
+	return fail(d);
+}
+
+static const char *
+ms_operator(char a, char b)
+{
+	static const char *const ops[36] = {
+		['2' - '0'] = "operator new",   ['3' - '0'] = "operator delete",
+		['4' - '0'] = "operator=",      ['5' - '0'] = "operator>>",
+		['6' - '0'] = "operator<<",     ['7' - '0'] = "operator!",
+		['8' - '0'] = "operator==",     ['9' - '0'] = "operator!=",
+		['A' - '7'] = "operator[]",     ['C' - '7'] = "operator->",
+		['D' - '7'] = "operator*",      ['E' - '7'] = "operator++",
+		['F' - '7'] = "operator--",     ['G' - '7'] = "operator-",
+		['H' - '7'] = "operator+",      ['I' - '7'] = "operator&",
+		['J' - '7'] = "operator->*",    ['K' - '7'] = "operator/",
+		['L' - '7'] = "operator%",      ['M' - '7'] = "operator<",
+		['N' - '7'] = "operator<=",     ['O' - '7'] = "operator>",
+		['P' - '7'] = "operator>=",     ['Q' - '7'] = "operator,",
+		['R' - '7'] = "operator()",     ['S' - '7'] = "operator~",
+		['T' - '7'] = "operator^",      ['U' - '7'] = "operator|",
+		['V' - '7'] = "operator&&",     ['W' - '7'] = "operator||",
+		['X' - '7'] = "operator*=",     ['Y' - '7'] = "operator+=",
+		['Z' - '7'] = "operator-=",
+	};
+	static const char *const ops_[36] = {
+		['0' - '0'] = "operator/=",     ['1' - '0'] = "operator%=",
+		['2' - '0'] = "operator>>=",    ['3' - '0'] = "operator<<=",
+		['4' - '0'] = "operator&=",     ['5' - '0'] = "operator|=",
+		['6' - '0'] = "operator^=",     ['U' - '7'] = "operator new[]",
+		['V' - '7'] = "operator delete[]",
+	};
+	const char *const *table = ops;
+	if (a == '_') {
+		table = ops_;
+		a = b;
+	}
+	int i = is_digit(a) ? a - '0' : a >= 'A' && a <= 'Z' ? a - '7' : -1;
+	return i < 0 ? NULL : table[i];
+}
+
+enum { MS_NAME, MS_CTOR, MS_DTOR, MS_CONV };
+
+static str_t
+demangle_msvc(dem_t *d)
+{
+	++d->p; // '?'
+	int kind = MS_NAME;
+	str_t name = NIL;
+	if (peek(d) == '?' && peek_at(d, 1) != '$') {
+		++d->p;
+		char a = peek(d), b = peek_at(d, 1);
+		if (a == '0' || a == '1') {
+			kind = a == '0' ? MS_CTOR : MS_DTOR;
+			++d->p;
+		} else if (a == 'B') {
+			kind = MS_CONV;
+			++d->p;
+		} else {
+			const char *op = ms_operator(a, b);
+			if (!op)
+				return fail(d); // Vftables, RTTI and other special names.
+			d->p += a == '_' ? 2 : 1;
+			name = lit(d, op);
+		}
+	} else {
+		name = ms_fragment(d);
+	}
+	str_t scopes[DEM_TARGS];
+	int nscope = ms_scopes(d, scopes);
+	if (kind == MS_CTOR || kind == MS_DTOR) {
+		// Named after the class, without its template arguments.
+		if (!nscope)
+			return fail(d);
+		str_t cls = scopes[0];
+		const char *lt = memchr(d->buf + cls.off, '<', cls.len);
+		size_t mark = d->used;
+		if (kind == MS_DTOR)
+			put(d, "~", 1);
+		put(d, d->buf + cls.off, lt ? (size_t)(lt - d->buf - cls.off) : cls.len);
+		name = done(d, mark);
+	}
+	char c = peek(d);
+	if (d->err)
+		return NIL;
+	if (c >= '0' && c <= '4') { // Data: type and storage class.
+		++d->p;
+		ms_type(d);
+		ms_cv(d);
+		return ms_join(d, scopes, nscope, name);
+	}
+	if (c < 'A' || c > 'Z')
+		return fail(d); // Thunks, vftables and RTTI.
+	++d->p;
+	// Non-static member functions carry the cv-qualifiers of 'this'.
+	int cv = 0;
+	if (c != 'Y' && c != 'Z' && !strchr("CDKLST", c))
+		cv = ms_cv(d);
+	++d->p; // Calling convention.
+	if (!eat(d, '@')) { // Constructors and destructors have no return type.
+		str_t ret = ms_type(d);
+		if (kind == MS_CONV)
+			name = cat3(d, lit(d, "operator "), "", ret);
+	}
+	str_t params[DEM_TARGS];
+	int n = 0;
+	if (!eat(d, 'X')) {
+		while (!d->err && peek(d) != '@' && peek(d) != 'Z') {
+			if (n == DEM_TARGS || d->p == d->end)
+				return fail(d);
+			const char *start = d->p;
+			params[n] = ms_type(d);
+			// Types longer than one character can be referred back to.
+			if (d->p - start > 1 && d->ntargs < 10)
+				d->targs[d->ntargs++] = params[n];
+			++n;
+		}
+		if (!eat(d, '@') && eat(d, 'Z')) {
+			if (n == DEM_TARGS)
+				return fail(d);
+			params[n++] = lit(d, "...");
+		}
+	}
+	if (!eat(d, 'Z')) // Throw specification.
+		return fail(d);
+	const char *suffix[8] = {
+		"", "", " volatile", " volatile", " const", " const", " const volatile", " const volatile",
+	};
+	return param_list(d, ms_join(d, scopes, nscope, name), params, n, suffix[cv]);
+}
+
+/**
+ * @brief Demangles an MSVC or Itanium C++ name.
+ *
+ * @param name Mangled name, which need not be null-terminated.
+ * @param len  Length of the mangled name.
+ * @param out  Buffer receiving the null-terminated demangled name.
+ * @param size Size of `out`.
+ * @return Length of the demangled name, or 0 if `name` is not a mangled
+ *         name in the supported subset or does not fit into `out`.
+ */
+size_t
+demangle(const char *name, size_t len, char *out, size_t size)
+{
+	dem_t d;
+	d.p      = name;
+	d.end    = name + len;
+	d.err    = false;
+	d.nsubs  = 0;
+	d.ntargs = 0;
+	d.used   = 0;
+	str_t s;
+	if (len > 1 && name[0] == '?') {
+		s = demangle_msvc(&d);
+	} else {
+		if (len > 2 && name[0] == '_' && name[1] == '_')
+			++d.p; // Extra underscore of 32-bit targets.
+		if (d.end - d.p < 3 || d.p[0] != '_' || d.p[1] != 'Z')
+			return 0;
+		d.p += 2;
+		s = demangle_itanium(&d);
+	}
+	if (d.err || d.p != d.end || !s.len || s.len >= size)
+		return 0;
+	memcpy(out, d.buf + s.off, s.len);
+	out[s.len] = '\0';
+	return s.len;
+}
+
+
+/* Demangled-name cache */
+/**
+ * The cache maps every mangled name seen during a run to its demangled name,
+ * or to NULL if it cannot be demangled. Both are copied into the arena, as
+ * the names they came from belong to an object that may be gone by the time
+ * the same name shows up again, e.g. in the next member of an archive.
+ *
+ * A cache belongs to a set of rules, which the daemon workers and the
+ * threads of a project share. Like the intern table, it is split into
+ * shards picked by the hash of the mangled name, each with its own lock,
+ * so that threads looking up different names seldom wait for one another.
+ */
+
+#define DEMANGLE_MAX 4096 ///< Longest demangled name kept.
+
+/**
+ * @brief Creates an empty demangled-name cache.
+ *
+ * @return A pointer to the newly created cache.
+ */
+demangler_t *
+new_demangler(void)
+{
+	demangler_t *dm = malloc(sizeof(demangler_t));
+	if (!dm)
+		error("Memory allocation failed.");
+	for (int i = 0; i < DEMANGLE_SHARDS; ++i) {
+		pthread_mutex_init(&dm->shards[i].lock, NULL);
+		dm->shards[i].dict  = new_dict();
+		dm->shards[i].arena = new_arena();
+	}
+	return dm;
+}
+
+/**
+ * @brief Deletes a demangled-name cache and every name it holds.
+ *
+ * @param dm The cache to delete.
+ */
+void
+del_demangler(demangler_t *dm)
+{
+	for (int i = 0; i < DEMANGLE_SHARDS; ++i) {
+		pthread_mutex_destroy(&dm->shards[i].lock);
+		del_dict(dm->shards[i].dict);
+		del_arena(dm->shards[i].arena);
+	}
+	free(dm);
+}
+
+/**
+ * @brief Demangles a name, consulting the cache first.
+ *
+ * Names that do not look mangled are rejected before hashing, so plain C
+ * names cost nothing.
+ *
+ * @param dm   The cache.
+ * @param name Mangled name, which need not be null-terminated.
+ * @param len  Length of the mangled name.
+ * @param dlen Receives the length of the demangled name.
+ * @return The demangled name, or NULL if the name cannot be demangled.
+ */
+const char *
+demangle_cached(demangler_t *dm, const char *name, size_t len, size_t *dlen)
+{
+	if (!(len > 1 && name[0] == '?')
+	 && !(len > 2 && name[0] == '_' && (name[1] == 'Z' || (name[1] == '_' && name[2] == 'Z'))))
+		return NULL;
+	// The high bits of a Fibonacci hash pick the shard, leaving the low bits
+	// of the hash to spread the names within it.
+	hash_t hash = dict_hash(name, len);
+	dm_shard_t *shard = &dm->shards[(uint64_t)hash * 0x9e3779b97f4a7c15u >> (64 - DEMANGLE_BITS)];
+	pthread_mutex_lock(&shard->lock);
+	size_t count = shard->dict->count;
+	size_t e = dict_insert_hashed(shard->dict, name, len, hash);
+	entry_t *entry = &shard->dict->entries[e];
+	if (shard->dict->count != count) { // First sight: demangle and keep copies.
+		char buf[DEMANGLE_MAX];
+		size_t n = demangle(name, len, buf, sizeof(buf));
+		entry->key = arena_strndup(shard->arena, name, len);
+		entry->val = n ? arena_strndup(shard->arena, buf, n) : NULL;
+	}
+	const char *dem = entry->val;
+	pthread_mutex_unlock(&shard->lock);
+	if (dem)
+		*dlen = strlen(dem);
+	return dem;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef _DEMANGLE_H
+#define _DEMANGLE_H
+
+#include <pthread.h>
+#include "smclib.h"
+
+/* Demangler */
+size_t demangle(const char *name, size_t len, char *out, size_t size);
+
+/* Demangled-name cache */
+#define DEMANGLE_BITS   6
+#define DEMANGLE_SHARDS (1 << DEMANGLE_BITS)
+
+/**
+ * @brief Part of a demangled-name cache, holding the names of some hashes.
+ */
+typedef struct {
+	pthread_mutex_t lock;  ///< Protects the dictionary and the arena.
+	dict_t         *dict;  ///< Map of mangled names to demangled ones, or NULL.
+	arena_t        *arena; ///< Storage for the cached names.
+} dm_shard_t;
+
+/**
+ * @brief Cache of demangled names, so that each distinct mangled name is
+ *        demangled at most once per set of rules.
+ */
+typedef struct {
+	dm_shard_t shards[DEMANGLE_SHARDS]; ///< Shards, by hash of the mangled name.
+} demangler_t;
+
+demangler_t *new_demangler(void);
+void del_demangler(demangler_t *dm);
+const char *demangle_cached(demangler_t *dm, const char *name, size_t len, size_t *dlen);
+
+#endif
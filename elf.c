@@ -0,0 +1,547 @@
+/**
+ * @file elf.c
+ * @brief ELF support for Symbol Modifier for COFF (SMC).
+ *
+ * Note:
+ *     This file is part of the SMC tool and is intended to be used in
+ *     conjunction with the main application. It is not designed to be used
+ *     independently.
+ *
+ * License:
+ *     This program is free software; you can redistribute it and/or modify it
+ *     under the terms  of the GNU General Public License as published by the
+ *     Free Software Foundation; either version 2 of the License, or (at your
+ *     option) any later version.
+ */
+
+
+#include "smc.h"
+#include "smclib.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Relocatable little-endian ELF objects, 32- and 64-bit, are supported. The
+ * symbol names of '.symtab' are kept in the string table it links to, which
+ * GNU as keeps apart as '.strtab' and LLVM shares with the section names.
+ *
+ * Renaming replaces that string table only. Renamed sections have their names
+ * moved to it as well, with the file header pointing to it for section names
+ * from then on, and the old section name string table is left unused. The new
+ * string table is put where the old one was, and whatever follows is moved
+ * along by a multiple of the largest alignment found there, so that it stays
+ * aligned. Everything else is copied as it is, save for the name fields of
+ * the symbols and the offsets in the headers. The file is read through a
+ * table of field offsets for its class rather than through structures, as
+ * members of archives need not be aligned.
+ */
+
+#define ELFCLASS32  1
+#define ELFCLASS64  2
+#define ELFDATA2LSB 1
+#define ET_REL      1
+
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_NOBITS 8
+
+#define SHN_UNDEF     0x0000
+#define SHN_LORESERVE 0xff00
+#define SHN_XINDEX    0xffff
+
+#define STB_LOCAL      0
+#define STB_GLOBAL     1
+#define STB_WEAK       2
+#define STB_GNU_UNIQUE 10
+
+#define STT_FUNC    2
+#define STT_SECTION 3
+#define STT_FILE    4
+
+/**
+ * @brief Offset and size of a field of an ELF structure.
+ */
+typedef struct {
+	uint8_t off;   ///< Offset of the field.
+	uint8_t width; ///< Size of the field in bytes.
+} field_t;
+
+/**
+ * @brief Layout of the ELF structures of one class, limited to the fields
+ *        SMC uses.
+ */
+typedef struct {
+	size_t  ehsize;      ///< Size of the file header.
+	size_t  shsize;      ///< Size of a section header.
+	size_t  symsize;     ///< Size of a symbol.
+	field_t e_shoff;     ///< Offset of the section header table.
+	field_t e_shentsize; ///< Size of a section header.
+	field_t e_shnum;     ///< Number of sections.
+	field_t e_shstrndx;  ///< Index of the section name string table.
+	field_t sh_name;     ///< Offset of the section name.
+	field_t sh_type;     ///< Section type.
+	field_t sh_offset;   ///< Offset of the section contents.
+	field_t sh_size;     ///< Size of the section contents.
+	field_t sh_link;     ///< Index of the linked section.
+	field_t sh_align;    ///< Alignment of the section contents.
+	field_t sh_entsize;  ///< Size of a table entry.
+	field_t st_name;     ///< Offset of the symbol name.
+	field_t st_info;     ///< Symbol binding and type.
+	field_t st_shndx;    ///< Index of the section defining the symbol.
+} layout_t;
+
+static const layout_t layouts[] = {
+	[ELFCLASS32] = {
+		52, 40, 16,
+		{ 32, 4 }, { 46, 2 }, { 48, 2 }, { 50, 2 },
+		{ 0, 4 }, { 4, 4 }, { 16, 4 }, { 20, 4 }, { 24, 4 }, { 32, 4 }, { 36, 4 },
+		{ 0, 4 }, { 12, 1 }, { 14, 2 },
+	},
+	[ELFCLASS64] = {
+		64, 64, 24,
+		{ 40, 8 }, { 58, 2 }, { 60, 2 }, { 62, 2 },
+		{ 0, 4 }, { 4, 4 }, { 24, 8 }, { 32, 8 }, { 40, 4 }, { 48, 8 }, { 56, 8 },
+		{ 0, 4 }, { 4, 1 }, { 6, 2 },
+	},
+};
+
+/**
+ * @brief A relocatable ELF file.
+ */
+struct elf_t {
+	char           *data;        ///< Contents of the file.
+	size_t          size;        ///< Size of the file in bytes.
+	const layout_t *lay;         ///< Layout of the structures of the file.
+	size_t          shoff;       ///< Offset of the section header table.
+	size_t          shnum;       ///< Number of sections.
+	size_t          shstrndx;    ///< Index of the section name string table.
+	size_t          symoff;      ///< Offset of the symbol table.
+	size_t          nsym;        ///< Number of symbols, including the null symbol.
+	size_t          strndx;      ///< Index of the symbol name string table.
+	size_t          stroff;      ///< Offset of the string table.
+	size_t          strsize;     ///< Size of the string table.
+	size_t          shstroff;    ///< Offset of the section name string table.
+	size_t          shstrsize;   ///< Size of the section name string table.
+	const char     *newsym;      ///< New symbol table.
+	const char     *newstr;      ///< New string table.
+	size_t          newstrsize;  ///< Size of the new string table.
+	size_t          padding;     ///< Zero bytes after the new string table.
+	char           *newshdrs;    ///< New section header table.
+	char            newehdr[64]; ///< New file header.
+};
+
+/**
+ * @brief Read a field of an ELF structure.
+ *
+ * @param p The structure.
+ * @param f The field.
+ * @return The value of the field.
+ */
+static uint64_t
+get(const char *p, field_t f)
+{
+	uint64_t v = 0;
+	for (int i = f.width; i-- > 0;)
+		v = v << 8 | (uint8_t)p[f.off + i];
+	return v;
+}
+
+/**
+ * @brief Write a field of an ELF structure.
+ *
+ * @param p The structure.
+ * @param f The field.
+ * @param v The value of the field.
+ */
+static void
+set(char *p, field_t f, uint64_t v)
+{
+	for (int i = 0; i < f.width; ++i, v >>= 8)
+		p[f.off + i] = (char)v;
+}
+
+/**
+ * @brief Tell whether a buffer holds a relocatable little-endian ELF file.
+ *
+ * @param data The contents.
+ * @param size Size of the contents.
+ * @return true if the contents look like such an ELF file.
+ */
+bool
+is_elf(const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	if (size < layouts[ELFCLASS32].ehsize || memcmp(p, "\177ELF", 4) != 0)
+		return false;
+	if ((p[4] != ELFCLASS32 && p[4] != ELFCLASS64) || p[5] != ELFDATA2LSB)
+		return false;
+	return size >= layouts[p[4]].ehsize && (p[16] | p[17] << 8) == ET_REL;
+}
+
+/**
+ * @brief Tell whether a range of the file overlaps another.
+ *
+ * @return true if [a, a + alen) and [b, b + blen) overlap.
+ */
+static inline bool
+overlaps(size_t a, size_t alen, size_t b, size_t blen)
+{
+	return alen && blen && a < b + blen && b < a + alen;
+}
+
+/**
+ * @brief Validate the layout of an ELF file and locate its symbol table.
+ *
+ * @param data The contents, which must outlive the ELF file.
+ * @param size Size of the contents.
+ * @param name Name of the file, used in error messages.
+ * @return A pointer to the newly created ELF file.
+ */
+elf_t *
+new_elf(void *data, size_t size, const char *name)
+{
+	if (!is_elf(data, size))
+		error("Invalid ELF file '%s'.", name);
+	elf_t e = { .data = data, .size = size, .lay = &layouts[((uint8_t*)data)[4]] };
+	const layout_t *lay = e.lay;
+	e.shoff    = get(e.data, lay->e_shoff);
+	e.shnum    = get(e.data, lay->e_shnum);
+	e.shstrndx = get(e.data, lay->e_shstrndx);
+	if (e.shoff) {
+		// Section 0 holds the counts that do not fit the file header.
+		if (e.shoff < lay->ehsize || e.shoff > size || size - e.shoff < lay->shsize
+		 || get(e.data, lay->e_shentsize) != lay->shsize)
+			error("Invalid ELF file '%s'.", name);
+		if (e.shnum == 0)
+			e.shnum = get(e.data + e.shoff, lay->sh_size);
+		if (e.shstrndx == SHN_XINDEX)
+			e.shstrndx = get(e.data + e.shoff, lay->sh_link);
+	} else {
+		e.shnum = 0;
+	}
+	if (e.shnum > (size - e.shoff) / lay->shsize)
+		error("Invalid ELF file '%s'.", name);
+	// Locate the symbol table and its string table; without one there is
+	// nothing to rename.
+	const char *sym = NULL;
+	for (size_t i = 0; i < e.shnum && !sym; ++i) {
+		const char *sh = e.data + e.shoff + i * lay->shsize;
+		if (get(sh, lay->sh_type) == SHT_SYMTAB)
+			sym = sh;
+	}
+	if (sym) {
+		e.strndx = get(sym, lay->sh_link);
+		e.symoff = get(sym, lay->sh_offset);
+		uint64_t symsize = get(sym, lay->sh_size);
+		if (e.strndx == 0 || e.strndx >= e.shnum || get(sym, lay->sh_entsize) != lay->symsize
+		 || e.symoff > size || symsize > size - e.symoff)
+			error("Invalid ELF file '%s'.", name);
+		e.nsym = symsize / lay->symsize;
+		const char *str = e.data + e.shoff + e.strndx * lay->shsize;
+		e.stroff  = get(str, lay->sh_offset);
+		e.strsize = get(str, lay->sh_size);
+		if (get(str, lay->sh_type) != SHT_STRTAB || e.stroff > size || e.strsize > size - e.stroff)
+			error("Invalid ELF file '%s'.", name);
+		// The tables that are rewritten must not overlap one another or the
+		// file header.
+		size_t tabsize = e.shnum * lay->shsize;
+		if (overlaps(0, lay->ehsize, e.symoff, symsize) || overlaps(0, lay->ehsize, e.stroff, e.strsize)
+		 || overlaps(e.symoff, symsize, e.stroff, e.strsize)
+		 || overlaps(e.shoff, tabsize, e.symoff, symsize) || overlaps(e.shoff, tabsize, e.stroff, e.strsize))
+			error("Invalid ELF file '%s'.", name);
+		for (size_t i = 0; i < e.shnum; ++i) {
+			const char *sh = e.data + e.shoff + i * lay->shsize;
+			if (i != e.strndx && get(sh, lay->sh_type) != SHT_NOBITS
+			 && overlaps(get(sh, lay->sh_offset), get(sh, lay->sh_size), e.stroff, e.strsize))
+				error("Invalid ELF file '%s'.", name);
+		}
+	}
+	if (e.shstrndx != SHN_UNDEF) {
+		if (e.shstrndx >= e.shnum)
+			error("Invalid ELF file '%s'.", name);
+		const char *shstr = e.data + e.shoff + e.shstrndx * lay->shsize;
+		e.shstroff  = get(shstr, lay->sh_offset);
+		e.shstrsize = get(shstr, lay->sh_size);
+		if (get(shstr, lay->sh_type) != SHT_STRTAB || e.shstroff > size
+		 || e.shstrsize > size - e.shstroff)
+			error("Invalid ELF file '%s'.", name);
+	}
+	elf_t *elf = malloc(sizeof(elf_t));
+	if (!elf)
+		error("Memory allocation failed.");
+	*elf = e;
+	return elf;
+}
+
+/**
+ * @brief Free an ELF file along with its new tables, but not its contents.
+ *
+ * @param elf The ELF file.
+ */
+void
+del_elf(elf_t *elf)
+{
+	free(elf->newshdrs);
+	free(elf);
+}
+
+/**
+ * @brief Get the symbol table of an ELF file.
+ *
+ * The name of a symbol is a 32-bit little-endian string table offset at the
+ * start of its record, in both classes.
+ *
+ * @param elf     The ELF file.
+ * @param nsym    Receives the number of symbols, including the null symbol.
+ * @param symsize Receives the size of a symbol record.
+ * @return The symbol table, or NULL if the file has none.
+ */
+char *
+elf_symtab(const elf_t *elf, size_t *nsym, size_t *symsize)
+{
+	*nsym    = elf->nsym;
+	*symsize = elf->lay->symsize;
+	return elf->nsym ? elf->data + elf->symoff : NULL;
+}
+
+/**
+ * @brief Get the name and attributes of a symbol without copying the name.
+ *
+ * Global, weak and unique symbols are external; local ones are static.
+ * Section and file symbols are given no attributes, so that they are left
+ * alone.
+ *
+ * @param elf   The ELF file.
+ * @param i     Index of the symbol.
+ * @param len   Receives the length of the name.
+ * @param attrs Receives the CLS_* and SYM_* bits of the symbol.
+ * @return Pointer to the name.
+ */
+const char *
+elf_symbol(const elf_t *elf, size_t i, size_t *len, int *attrs)
+{
+	const layout_t *lay = elf->lay;
+	const char *sym = elf->data + elf->symoff + i * lay->symsize;
+	uint64_t off = get(sym, lay->st_name);
+	if (off >= elf->strsize && !(off == 0 && elf->strsize == 0))
+		error("Invalid string table offset %lu.", (unsigned long)off);
+	const char *s = elf->data + elf->stroff + off;
+	*len = elf->strsize ? strnlen(s, elf->strsize - off) : 0;
+	int info = get(sym, lay->st_info), bind = info >> 4, type = info & 0xf;
+	*attrs = 0;
+	if (i == 0 || type == STT_SECTION || type == STT_FILE)
+		return s;
+	if (bind == STB_LOCAL)
+		*attrs = CLS_STATIC;
+	else if (bind == STB_GLOBAL || bind == STB_WEAK || bind == STB_GNU_UNIQUE)
+		*attrs = CLS_EXTERNAL;
+	else
+		return s;
+	if (get(sym, lay->st_shndx) != SHN_UNDEF)
+		*attrs |= SYM_DEFINED;
+	if (type == STT_FUNC)
+		*attrs |= SYM_FUNCTION;
+	return s;
+}
+
+/**
+ * @brief Get the number of sections of an ELF file that can be renamed.
+ *
+ * Section names can only be moved to the symbol name string table, so none
+ * can be renamed in a file without a symbol table.
+ *
+ * @param elf    The ELF file.
+ * @param shared Receives whether the section names already share the symbol
+ *               name string table.
+ * @return The number of sections, including section 0, or 0.
+ */
+size_t
+elf_sections(const elf_t *elf, bool *shared)
+{
+	*shared = elf->nsym && elf->shstrndx == elf->strndx;
+	return elf->nsym && elf->shstrndx != SHN_UNDEF ? elf->shnum : 0;
+}
+
+/**
+ * @brief Get the name of a section without copying it.
+ *
+ * @param elf The ELF file.
+ * @param i   Index of the section.
+ * @param len Receives the length of the name.
+ * @return Pointer to the name.
+ */
+const char *
+elf_section(const elf_t *elf, size_t i, size_t *len)
+{
+	uint64_t off = get(elf->data + elf->shoff + i * elf->lay->shsize, elf->lay->sh_name);
+	if (off >= elf->shstrsize)
+		error("Invalid string table offset %lu.", (unsigned long)off);
+	const char *s = elf->data + elf->shstroff + off;
+	*len = strnlen(s, elf->shstrsize - off);
+	return s;
+}
+
+/**
+ * @brief Lay out a renamed ELF file.
+ *
+ * If the section names are given, the file header is pointed to the new
+ * string table for them, which is where they must be if they share the
+ * string table.
+ *
+ * @param elf      The ELF file.
+ * @param symtab   The new symbol table, which must outlive the ELF file.
+ * @param strtab   The new string table, which must outlive the ELF file.
+ * @param strsize  Size of the new string table.
+ * @param secnames Offset of the name of each section in the new string table,
+ *                 or NULL to leave the section names alone.
+ */
+void
+build_elf(elf_t *elf, const char *symtab, const char *strtab, size_t strsize,
+          const size_t *secnames)
+{
+	const layout_t *lay = elf->lay;
+	size_t tabsize = elf->shnum * lay->shsize;
+	elf->newsym = symtab;
+	elf->newstr = strtab;
+	elf->newstrsize = strsize;
+	if (!(elf->newshdrs = malloc(tabsize ? tabsize : 1)))
+		error("Memory allocation failed.");
+	memcpy(elf->newshdrs, elf->data + elf->shoff, tabsize);
+	memcpy(elf->newehdr, elf->data, lay->ehsize);
+	if (secnames) {
+		for (size_t i = 0; i < elf->shnum; ++i)
+			set(elf->newshdrs + i * lay->shsize, lay->sh_name, secnames[i]);
+		// Section 0 holds an index that does not fit the file header.
+		if (get(elf->newehdr, lay->e_shstrndx) == SHN_XINDEX)
+			set(elf->newshdrs, lay->sh_link, 0);
+		if (elf->strndx >= SHN_LORESERVE) {
+			set(elf->newehdr, lay->e_shstrndx, SHN_XINDEX);
+			set(elf->newshdrs, lay->sh_link, elf->strndx);
+		} else {
+			set(elf->newehdr, lay->e_shstrndx, elf->strndx);
+		}
+	}
+	// Whatever follows the string table moves by a multiple of its largest
+	// alignment.
+	size_t strend = elf->stroff + elf->strsize;
+	uint64_t align = lay->shsize == 64 ? 8 : 4;
+	for (size_t i = 0; i < elf->shnum; ++i) {
+		const char *sh = elf->newshdrs + i * lay->shsize;
+		uint64_t a = get(sh, lay->sh_align);
+		if (i == elf->strndx || get(sh, lay->sh_offset) < strend)
+			continue;
+		if (a & (a - 1))
+			error("Invalid section alignment %lu.", (unsigned long)a);
+		if (a > align)
+			align = a;
+	}
+	elf->padding = (strend - elf->stroff - elf->newstrsize) & (align - 1);
+	size_t newend = elf->stroff + elf->newstrsize + elf->padding;
+	for (size_t i = 0; i < elf->shnum; ++i) {
+		char *sh = elf->newshdrs + i * lay->shsize;
+		uint64_t off = get(sh, lay->sh_offset);
+		if (i == elf->strndx)
+			set(sh, lay->sh_size, elf->newstrsize);
+		else if (off >= strend)
+			set(sh, lay->sh_offset, off - strend + newend);
+	}
+	if (elf->shoff >= strend)
+		set(elf->newehdr, lay->e_shoff, elf->shoff - strend + newend);
+}
+
+/**
+ * @brief Get the size of a renamed ELF file.
+ *
+ * @param elf The ELF file, laid out.
+ * @return Size of the file in bytes.
+ */
+size_t
+elf_size(const elf_t *elf)
+{
+	return elf->size - elf->strsize + elf->newstrsize + elf->padding;
+}
+
+/**
+ * @brief Digest the parts of an ELF file that its symbol index depends on:
+ *        the file header, the section header table, the symbol table and
+ *        the string tables, but no section contents.
+ *
+ * @param elf The ELF file.
+ * @param d   The digest to update.
+ */
+void
+elf_digest(const elf_t *elf, digest_t *d)
+{
+	digest_update(d, elf->data, elf->lay->ehsize);
+	digest_update(d, elf->data + elf->shoff, elf->shnum * elf->lay->shsize);
+	digest_update(d, elf->data + elf->symoff, elf->nsym * elf->lay->symsize);
+	digest_update(d, elf->data + elf->stroff, elf->strsize);
+	digest_update(d, elf->data + elf->shstroff, elf->shstrsize);
+}
+
+/**
+ * @brief Get the size of the string table of an ELF file as read.
+ *
+ * @param elf The ELF file.
+ * @return Size of the string table in bytes.
+ */
+size_t
+elf_strsize(const elf_t *elf)
+{
+	return elf->strsize;
+}
+
+/**
+ * @brief A range of the input replaced in the output.
+ */
+typedef struct {
+	size_t      off;    ///< Offset of the range in the input.
+	size_t      size;   ///< Size of the range in the input.
+	const char *data;   ///< The replacement.
+	size_t      len;    ///< Size of the replacement.
+	size_t      zeros;  ///< Zero bytes following the replacement.
+} patch_t;
+
+/**
+ * @brief Write a renamed ELF file.
+ *
+ * The file is copied in order, with the headers, the symbol table and the
+ * string table replaced.
+ *
+ * @param elf The ELF file, laid out.
+ * @param out The output.
+ */
+void
+write_elf(const elf_t *elf, out_t *out)
+{
+	const layout_t *lay = elf->lay;
+	size_t tabsize = elf->shnum * lay->shsize, symsize = elf->nsym * lay->symsize;
+	patch_t patches[] = {
+		{ 0, lay->ehsize, elf->newehdr, lay->ehsize, 0 },
+		{ elf->shoff, tabsize, elf->newshdrs, tabsize, 0 },
+		{ elf->symoff, symsize, elf->newsym, symsize, 0 },
+		{ elf->stroff, elf->strsize, elf->newstr, elf->newstrsize, elf->padding },
+	};
+	size_t npatch = sizeof(patches) / sizeof(*patches);
+	// Order the patches by offset, an empty range first.
+	for (size_t i = 1; i < npatch; ++i)
+		for (size_t j = i; j > 0 && (patches[j].off < patches[j - 1].off
+		  || (patches[j].off == patches[j - 1].off && patches[j].size < patches[j - 1].size)); --j) {
+			patch_t t = patches[j];
+			patches[j] = patches[j - 1];
+			patches[j - 1] = t;
+		}
+	size_t pos = 0;
+	for (size_t i = 0; i < npatch; ++i) {
+		const patch_t *p = &patches[i];
+		if (!p->size && !p->len)
+			continue;
+		out_write(out, elf->data + pos, p->off - pos);
+		out_write(out, p->data, p->len);
+		for (size_t z = 0; z < p->zeros; ++z)
+			out_byte(out, 0);
+		pos = p->off + p->size;
+	}
+	out_write(out, elf->data + pos, elf->size - pos);
+}
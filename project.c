@@ -0,0 +1,360 @@
+/**
+ * @file project.c
+ * @brief Project-wide renaming for Symbol Modifier for COFF (SMC).
+ *
+ * Note:
+ *     This file is part of the SMC tool and is intended to be used in
+ *     conjunction with the main application. It is not designed to be used
+ *     independently.
+ *
+ * License:
+ *     This program is free software; you can redistribute it and/or modify it
+ *     under the terms  of the GNU General Public License as published by the
+ *     Free Software Foundation; either version 2 of the License, or (at your
+ *     option) any later version.
+ */
+
+
+#include "smc.h"
+#include "smclib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/**
+ * A project is a list of objects renamed with the same rules, such as every
+ * object of a build. The objects are renamed in parallel, each read and
+ * written once, and the old and new names of the external symbols each one
+ * defines are interned into a table shared by all of them. Once every object
+ * is written, the definitions are sorted by new name, and a new name defined
+ * under more than one old name is reported: renaming made two symbols that
+ * were apart collide, which would otherwise only show at link time.
+ *
+ * Names that were defined more than once before renaming, such as COMDAT
+ * functions, are not reported as long as their new names stay alike.
+ *
+ * Outputs are written under temporary names next to them, and only renamed
+ * into place once no collision is found, so that a project that fails leaves
+ * no conflicting objects behind for a build to link.
+ */
+
+typedef struct project_t project_t;
+
+/**
+ * @brief An object of a project.
+ */
+typedef struct {
+	project_t  *proj;    ///< The project.
+	const char *infile;  ///< Name of the input file.
+	const char *outfile; ///< Name of the output file.
+	buf_t      *defs;    ///< Pairs of ids of the old and new name of each definition.
+	buf_t      *scratch; ///< New name being interned.
+	char       *staged;  ///< Temporary file holding the output, or NULL.
+	plan_t      plan;    ///< What renaming changes, for '--dry-run'.
+} job_t;
+
+/**
+ * @brief A definition of an external symbol, by the ids of its names.
+ */
+typedef struct {
+	size_t       newid; ///< Id of the new name.
+	size_t       oldid; ///< Id of the original name.
+	const job_t *job;   ///< The object defining the symbol.
+} def_t;
+
+/**
+ * @brief A project being renamed.
+ */
+struct project_t {
+	const rules_t  *rules;     ///< Renaming rules to apply.
+	bool           *hit;       ///< Marks the renaming rules that match a symbol.
+	intern_t       *names;     ///< Names of the definitions of every object.
+	char           *list;      ///< Contents of the file list, which the jobs borrow names from.
+	job_t          *jobs;      ///< The objects.
+	size_t          njob;      ///< Number of objects.
+	pthread_mutex_t lock;      ///< Protects the error below.
+	bool            failed;    ///< Whether an object failed.
+	char            error[ERROR_MAX]; ///< Message of the first failure.
+};
+
+/**
+ * @brief Read the 'infile outfile' pairs of a file list.
+ *
+ * The file list is tokenized in place, like a listfile of 'old new' pairs.
+ *
+ * @param proj     The project.
+ * @param filename Name of the file list.
+ */
+static void
+read_jobs(project_t *proj, const char *filename)
+{
+	read_file(filename, (void**)&proj->list);
+	const char *tok[2];
+	int n = 0;
+	for (char *p = proj->list; *p;) {
+		while (*p && strchr(" \t\r\n", *p))
+			*p++ = '\0';
+		if (!*p)
+			break;
+		tok[n++] = p;
+		p += strcspn(p, " \t\r\n");
+		if (n < 2)
+			continue;
+		job_t *jobs = realloc(proj->jobs, (proj->njob + 1) * sizeof(job_t));
+		if (!jobs)
+			error("Memory allocation failed.");
+		proj->jobs = jobs;
+		jobs[proj->njob++] = (job_t){ .proj = proj, .infile = tok[0], .outfile = tok[1] };
+		n = 0;
+	}
+	if (n)
+		error("Missing output file for '%s' in '%s'.", tok[0], filename);
+}
+
+/**
+ * @brief Intern the names of the external symbols an object defines.
+ *
+ * @param job  The object.
+ * @param coff The renamed object.
+ */
+static void
+record_definitions(job_t *job, const coff_t *coff)
+{
+	intern_t *names = job->proj->names;
+	job->defs    = new_buf();
+	job->scratch = new_buf();
+	size_t i = 0, len, e;
+	const char *name;
+	while ((name = coff_next_defined(coff, &i, &len, &e))) {
+		size_t ids[2] = { intern(names, name, len) };
+		ids[1] = ids[0];
+		if (coff_renamed(coff, name, len) != DICT_NONE) {
+			size_t nlen = coff_name_length(coff, e);
+			buf_reserve(job->scratch, nlen + 1);
+			coff_emit_name(coff, e, job->scratch->buf);
+			ids[1] = intern(names, job->scratch->buf, nlen);
+		}
+		buf_ncat(job->defs, (const char*)ids, sizeof(ids));
+	}
+}
+
+/**
+ * @brief Worker task renaming one object of a project.
+ *
+ * @param arg The object.
+ */
+static void
+rename_job(void *arg)
+{
+	job_t *job = arg;
+	project_t *proj = job->proj;
+	void *volatile data = NULL;
+	coff_t *volatile coff = NULL;
+	if (setjmp(_buf)) {
+		if (coff)
+			del_coff(coff);
+		free(data);
+		pthread_mutex_lock(&proj->lock);
+		if (!proj->failed) {
+			__atomic_store_n(&proj->failed, true, __ATOMIC_RELAXED);
+			memcpy(proj->error, _errmsg, ERROR_MAX);
+		}
+		pthread_mutex_unlock(&proj->lock);
+		return;
+	}
+	if (__atomic_load_n(&proj->failed, __ATOMIC_RELAXED))
+		return;
+	void *p;
+	size_t size = read_file(job->infile, &p);
+	data = p;
+	if (is_archive(data, size))
+		error("Archive '%s' cannot be part of a project.", job->infile);
+	coff = new_coff(data, size);
+	index_coff(coff, job->infile, rules_sidecar(proj->rules), 1);
+	rename_coff(coff, proj->rules, proj->hit);
+	record_definitions(job, coff);
+	if (rules_dry_run(proj->rules)) {
+		coff_plan(coff, &job->plan);
+	} else {
+		job->staged = stage_coff(coff, job->outfile);
+	}
+	del_coff(coff);
+	coff = NULL;
+	free(data);
+	data = NULL;
+}
+
+/**
+ * @brief Order definitions by new name, then by original name, then by
+ *        object.
+ *
+ * @param a The first definition.
+ * @param b The second definition.
+ * @return Negative, zero or positive, as for qsort.
+ */
+static int
+compare_defs(const void *a, const void *b)
+{
+	const def_t *x = a, *y = b;
+	if (x->newid != y->newid)
+		return x->newid < y->newid ? -1 : 1;
+	if (x->oldid != y->oldid)
+		return x->oldid < y->oldid ? -1 : 1;
+	return (x->job > y->job) - (x->job < y->job);
+}
+
+/**
+ * @brief Report the names the renaming makes more than one object define.
+ *
+ * @param proj The project, whose objects have all been renamed.
+ * @return The number of names reported.
+ */
+static size_t
+report_collisions(project_t *proj)
+{
+	size_t ndef = 0;
+	for (size_t j = 0; j < proj->njob; ++j)
+		ndef += proj->jobs[j].defs ? proj->jobs[j].defs->cnt / (2 * sizeof(size_t)) : 0;
+	def_t *defs = malloc(ndef * sizeof(def_t) + 1);
+	if (!defs)
+		error("Memory allocation failed.");
+	size_t n = 0;
+	for (size_t j = 0; j < proj->njob; ++j) {
+		const job_t *job = &proj->jobs[j];
+		const size_t *ids = job->defs ? job->defs->buf : NULL;
+		for (size_t k = 0; job->defs && k < job->defs->cnt / sizeof(size_t); k += 2)
+			defs[n++] = (def_t){ .oldid = ids[k], .newid = ids[k + 1], .job = job };
+	}
+	qsort(defs, ndef, sizeof(def_t), compare_defs);
+	// Within a run of the same new name, the original names are sorted, so
+	// that the first and last differ if any do.
+	size_t ncollision = 0;
+	for (size_t i = 0, end; i < ndef; i = end) {
+		for (end = i + 1; end < ndef && defs[end].newid == defs[i].newid; ++end)
+			;
+		if (defs[i].oldid == defs[end - 1].oldid)
+			continue;
+		size_t len, oldlen[2];
+		const char *name = intern_name(proj->names, defs[i].newid, &len);
+		const char *old[2] = {
+			intern_name(proj->names, defs[i].oldid, &oldlen[0]),
+			intern_name(proj->names, defs[end - 1].oldid, &oldlen[1]),
+		};
+		fprintf(stderr, "Duplicate definition of '%s': '%s' in '%s' and '%s' in '%s'.\n",
+		        name, old[0], defs[i].job->infile, old[1], defs[end - 1].job->infile);
+		++ncollision;
+	}
+	free(defs);
+	return ncollision;
+}
+
+/**
+ * @brief Remove the outputs of a project that were not put in place.
+ *
+ * @param proj The project.
+ */
+static void
+discard_outputs(project_t *proj)
+{
+	for (size_t j = 0; j < proj->njob; ++j) {
+		job_t *job = &proj->jobs[j];
+		if (job->staged) {
+			remove(job->staged);
+			free(job->staged);
+			job->staged = NULL;
+		}
+	}
+}
+
+/**
+ * @brief Rename the outputs of a project into place.
+ *
+ * @param proj The project, whose objects have all been renamed without
+ *             collisions.
+ */
+static void
+publish_outputs(project_t *proj)
+{
+	for (size_t j = 0; j < proj->njob; ++j) {
+		job_t *job = &proj->jobs[j];
+		if (job->staged && rename(job->staged, job->outfile) != 0)
+			error("Write file '%s' failed.", job->outfile);
+		free(job->staged);
+		job->staged = NULL;
+	}
+}
+
+/**
+ * @brief Delete a project along with what its objects left behind.
+ *
+ * @param proj The project.
+ */
+static void
+del_project(project_t *proj)
+{
+	discard_outputs(proj);
+	for (size_t j = 0; j < proj->njob; ++j) {
+		if (proj->jobs[j].defs)
+			del_buf(proj->jobs[j].defs);
+		if (proj->jobs[j].scratch)
+			del_buf(proj->jobs[j].scratch);
+	}
+	free(proj->jobs);
+	free(proj->list);
+	free(proj->hit);
+	if (proj->names)
+		del_intern(proj->names);
+	pthread_mutex_destroy(&proj->lock);
+	free(proj);
+}
+
+/**
+ * @brief Rename every object of a project: 'smc --project filelist [options]
+ *        [old new ...]'.
+ *
+ * @param argc Number of arguments, starting with '--project'.
+ * @param argv Arguments.
+ * @return Exit code.
+ */
+int
+project(int argc, char *argv[])
+{
+	project_t *volatile proj = NULL;
+	if (setjmp(_buf)) {
+		if (proj)
+			discard_outputs(proj);
+		fprintf(stderr, "%s\n", _errmsg);
+		return 1;
+	}
+	proj = calloc(1, sizeof(project_t));
+	if (!proj)
+		error("Memory allocation failed.");
+	pthread_mutex_init(&proj->lock, NULL);
+	rules_t *rules = new_rules(NULL);
+	compile_project_rules(rules, argc - 1, argv + 1);
+	proj->rules = rules;
+	proj->names = new_intern();
+	if (!(proj->hit = calloc(rules_count(rules) + 1, sizeof(bool))))
+		error("Memory allocation failed.");
+	read_jobs(proj, argv[1]);
+	pool_t *pool = new_pool(rules_jobs(rules));
+	for (size_t j = 0; j < proj->njob; ++j)
+		pool_submit(pool, rename_job, &proj->jobs[j]);
+	del_pool(pool);
+	if (proj->failed)
+		error("%s", proj->error);
+	check_hits(rules, proj->hit);
+	// Plans are printed in the order of the file list, whichever object was
+	// renamed first.
+	for (size_t j = 0; rules_dry_run(rules) && j < proj->njob; ++j)
+		print_plan(proj->jobs[j].infile, &proj->jobs[j].plan);
+	size_t ncollision = report_collisions(proj);
+	if (!ncollision)
+		publish_outputs(proj);
+	del_project(proj);
+	proj = NULL;
+	del_rules(rules);
+	if (ncollision)
+		error("%lu names are defined more than once after renaming.", (unsigned long)ncollision);
+	return 0;
+}
@@ -0,0 +1,647 @@
+/**
+ * @file serve.c
+ * @brief Rename daemon for Symbol Modifier for COFF (SMC).
+ *
+ * Note:
+ *     This file is part of the SMC tool and is intended to be used in
+ *     conjunction with the main application. It is not designed to be used
+ *     independently.
+ *
+ * License:
+ *     This program is free software; you can redistribute it and/or modify it
+ *     under the terms  of the GNU General Public License as published by the
+ *     Free Software Foundation; either version 2 of the License, or (at your
+ *     option) any later version.
+ */
+
+
+#include "smc.h"
+#include "smclib.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Build systems run smc once per object, and with large listfiles most of
+ * that time goes into compiling the same rules over and over. The daemon
+ * keeps compiled rules in memory, keyed by the working directory and the
+ * command line minus infile and outfile, and processes requests on a thread
+ * pool.
+ *
+ * A request is a header followed by the working directory of the client and
+ * its command line, each null-terminated. If the client passes the input and
+ * output files as descriptors, they come along with the header. The reply is
+ * the exit code followed by the error message, if any.
+ */
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define REQUEST_MAGIC   0x01434d53      ///< "SMC\1"
+#define REQUEST_MAX     (1 << 20)       ///< Largest request accepted.
+#define REQUEST_TIMEOUT 30              ///< Seconds a client may take to send a request.
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * @brief Header of a request.
+ */
+typedef struct {
+	uint32_t magic; ///< REQUEST_MAGIC.
+	uint32_t size;  ///< Size of the strings that follow.
+	uint32_t nfds;  ///< Number of descriptors passed: 0, or 2 for infile and outfile.
+} request_t;
+
+/**
+ * @brief Header of a reply.
+ */
+typedef struct {
+	int32_t  code;  ///< Exit code.
+	uint32_t size;  ///< Size of the error message that follows.
+} reply_t;
+
+/**
+ * @brief Compiled rules shared by the requests with the same command line.
+ */
+typedef struct {
+	rules_t *rules; ///< The compiled rules.
+	char    *text;  ///< Strings of the request the rules were compiled from.
+	char   **argv;  ///< Arguments pointing into `text`, which the rules borrow.
+	int      refs;  ///< Requests using the rules, plus one while cached.
+} ruleset_t;
+
+/**
+ * @brief State of the daemon.
+ */
+typedef struct {
+	pthread_mutex_t lock;   ///< Protects the cache.
+	dict_t         *sets;   ///< Map of rule keys to ruleset_t.
+	arena_t        *keys;   ///< Storage for the rule keys.
+	bool            reload; ///< Whether to recompile rules whose listfiles changed.
+} server_t;
+
+/**
+ * @brief A request being processed by a worker.
+ *
+ * Everything a request owns is reachable from here, so that it can be
+ * released after an error.
+ */
+typedef struct {
+	server_t  *srv;    ///< The daemon.
+	int        sock;   ///< Connection to the client.
+	char      *text;   ///< Strings of the request.
+	char     **argv;   ///< Arguments pointing into `text`.
+	int        fds[2]; ///< Passed infile and outfile descriptors, or -1.
+	FILE      *in;     ///< Stream over the passed infile, or NULL.
+	FILE      *out;    ///< Stream over the passed outfile, or NULL.
+	char      *paths[2]; ///< Resolved infile and outfile names.
+	ruleset_t *set;    ///< Rules in use.
+	buf_t     *key;    ///< Rule key of the request.
+} conn_t;
+
+static volatile sig_atomic_t stopping;
+
+/**
+ * @brief Send a whole buffer, retrying after interruptions.
+ *
+ * @param sock The socket.
+ * @param p    The data.
+ * @param size Size of the data.
+ * @return true on success.
+ */
+static bool
+send_all(int sock, const void *p, size_t size)
+{
+	while (size) {
+		ssize_t n = send(sock, p, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p = (const char*)p + n;
+		size -= n;
+	}
+	return true;
+}
+
+/**
+ * @brief Receive a whole buffer, retrying after interruptions.
+ *
+ * @param sock The socket.
+ * @param p    Receives the data.
+ * @param size Size of the data.
+ * @return true on success.
+ */
+static bool
+recv_all(int sock, void *p, size_t size)
+{
+	while (size) {
+		ssize_t n = recv(sock, p, size, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p = (char*)p + n;
+		size -= n;
+	}
+	return true;
+}
+
+/**
+ * @brief Fill in the address of a Unix domain socket.
+ *
+ * @param addr Receives the address.
+ * @param path Name of the socket.
+ */
+static void
+socket_address(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+		error("Socket name '%s' is too long.", path);
+	strcpy(addr->sun_path, path);
+}
+
+/**
+ * @brief Connect to a daemon.
+ *
+ * @param path Name of the socket.
+ * @return The connected socket, or -1 if no daemon is listening.
+ */
+static int
+connect_daemon(const char *path)
+{
+	struct sockaddr_un addr;
+	socket_address(&addr, path);
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+		return -1;
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * @brief Drop a reference to a set of rules, deleting it with the last one.
+ *
+ * @param srv The daemon.
+ * @param set The rules.
+ */
+static void
+release_rules(server_t *srv, ruleset_t *set)
+{
+	pthread_mutex_lock(&srv->lock);
+	bool last = --set->refs == 0;
+	pthread_mutex_unlock(&srv->lock);
+	if (!last)
+		return;
+	if (set->rules)
+		del_rules(set->rules);
+	free(set->text);
+	free(set->argv);
+	free(set);
+}
+
+/**
+ * @brief Get the compiled rules of a request, compiling them on a miss.
+ *
+ * On a miss the rules take over the strings of the request, as they borrow
+ * names from them. Rules compiled by two requests at once are both correct;
+ * the later one replaces the earlier one in the cache.
+ *
+ * @param conn The request, whose `set` receives the rules.
+ * @param argc Number of arguments of the request.
+ */
+static void
+acquire_rules(conn_t *conn, int argc)
+{
+	server_t *srv = conn->srv;
+	const char *key = conn->key->buf;
+	size_t keylen = conn->key->cnt;
+	pthread_mutex_lock(&srv->lock);
+	size_t e = dict_find(srv->sets, key, keylen);
+	if (e != DICT_NONE) {
+		conn->set = (ruleset_t*)srv->sets->entries[e].val;
+		conn->set->refs++;
+	}
+	pthread_mutex_unlock(&srv->lock);
+	if (conn->set && !(srv->reload && rules_stale(conn->set->rules)))
+		return;
+	if (conn->set) {
+		release_rules(srv, conn->set);
+		conn->set = NULL;
+	}
+	// Compile the rules from the strings of the request.
+	ruleset_t *set = calloc(1, sizeof(ruleset_t));
+	if (!set)
+		error("Memory allocation failed.");
+	set->refs  = 1;
+	set->text  = conn->text;
+	set->argv  = conn->argv;
+	conn->text = NULL;
+	conn->argv = NULL;
+	conn->set  = set;
+	set->rules = new_rules(set->text);
+	compile_rules(set->rules, argc, set->argv);
+	// Cache them, replacing stale ones.
+	pthread_mutex_lock(&srv->lock);
+	e = dict_find(srv->sets, key, keylen);
+	if (e == DICT_NONE)
+		e = dict_insert(srv->sets, arena_strndup(srv->keys, key, keylen), keylen);
+	ruleset_t *old = (ruleset_t*)srv->sets->entries[e].val;
+	srv->sets->entries[e].val = (dval_t)set;
+	set->refs++;
+	pthread_mutex_unlock(&srv->lock);
+	if (old)
+		release_rules(srv, old);
+}
+
+/**
+ * @brief Receive a request and split it into arguments.
+ *
+ * @param conn The request.
+ * @return Number of arguments, including the working directory in argv[0].
+ */
+static int
+receive_request(conn_t *conn)
+{
+	request_t req;
+	union {
+		struct cmsghdr hdr;
+		char           buf[CMSG_SPACE(2 * sizeof(int))];
+	} ctl;
+	struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+	struct msghdr msg = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf),
+	};
+	ssize_t n;
+	while ((n = recvmsg(conn->sock, &msg, 0)) < 0 && errno == EINTR)
+		;
+	// Take the descriptors first, so that they are closed whatever happens.
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); n > 0 && c; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+			continue;
+		size_t nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < nfds; ++i) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+			if (i < 2 && conn->fds[i] < 0)
+				conn->fds[i] = fd;
+			else
+				close(fd);
+		}
+	}
+	if (n < 0 || (n < (ssize_t)sizeof(req) && !recv_all(conn->sock, (char*)&req + n, sizeof(req) - n)))
+		error("Cannot receive request.");
+	if (req.magic != REQUEST_MAGIC || req.size == 0 || req.size > REQUEST_MAX
+	 || (req.nfds != 0 && req.nfds != 2) || (req.nfds == 2 && conn->fds[1] < 0))
+		error("Invalid request.");
+	// Receive the strings and split them.
+	if (!(conn->text = malloc(req.size + 1)))
+		error("Memory allocation failed.");
+	if (!recv_all(conn->sock, conn->text, req.size))
+		error("Cannot receive request.");
+	conn->text[req.size] = '\0';
+	int argc = 0;
+	for (size_t i = 0; i < req.size; ++i)
+		argc += conn->text[i] == '\0';
+	if (!(conn->argv = malloc((argc + 1) * sizeof(char*))))
+		error("Memory allocation failed.");
+	char *p = conn->text;
+	for (int i = 0; i < argc; ++i, p += strlen(p) + 1)
+		conn->argv[i] = p;
+	conn->argv[argc] = NULL;
+	if (argc < 2 || !is_absolute(conn->argv[0]) || (req.nfds == 2) != (conn->fds[0] >= 0))
+		error("Invalid request.");
+	return argc;
+}
+
+/**
+ * @brief Process a request.
+ *
+ * @param conn The request.
+ */
+static void
+process_request(conn_t *conn)
+{
+	int argc = receive_request(conn);
+	// argv[0] is the working directory of the client and stands in for the
+	// program name.
+	char **argv = conn->argv;
+	const char *cwd = argv[0];
+	int arg = skip_options(argc, argv);
+	if (argc - arg < 2)
+		error("Missing input or output file.");
+	const char *infile = argv[arg], *outfile = argv[arg + 1];
+	// The rule key is the command line minus infile and outfile.
+	conn->key = new_buf();
+	for (int i = 0; i < argc; ++i)
+		if (i != arg && i != arg + 1)
+			buf_ncat(conn->key, argv[i], strlen(argv[i]) + 1);
+	if (conn->fds[0] >= 0) {
+		if (!(conn->in = fdopen(conn->fds[0], "rb")))
+			error("Open file '%s' failed.", infile);
+		conn->fds[0] = -1;
+		if (!(conn->out = fdopen(conn->fds[1], "wb")))
+			error("Open file '%s' failed.", outfile);
+		conn->fds[1] = -1;
+	} else {
+		conn->paths[0] = join_path(cwd, infile);
+		conn->paths[1] = join_path(cwd, outfile);
+	}
+	acquire_rules(conn, argc);
+	if (rules_dry_run(conn->set->rules))
+		error("The daemon does not do dry runs.");
+	if (conn->out) {
+		// The client does not truncate outfile, which may also be infile.
+		rename_file(conn->set->rules, infile, conn->in, outfile, conn->out);
+		if (ftruncate(fileno(conn->out), ftell(conn->out)) != 0)
+			error("Write file '%s' failed.", outfile);
+	} else {
+		rename_file(conn->set->rules, conn->paths[0], NULL, conn->paths[1], NULL);
+	}
+}
+
+/**
+ * @brief Worker task serving one connection.
+ *
+ * @param arg The request, which is freed here.
+ */
+static void
+serve_request(void *arg)
+{
+	conn_t *conn = arg;
+	reply_t reply = { 0 };
+	if (setjmp(_buf)) {
+		reply.code = 1;
+		reply.size = strlen(_errmsg);
+	} else {
+		process_request(conn);
+	}
+	send_all(conn->sock, &reply, sizeof(reply));
+	if (reply.size)
+		send_all(conn->sock, _errmsg, reply.size);
+	// Release everything the request owns.
+	if (conn->set)
+		release_rules(conn->srv, conn->set);
+	if (conn->key)
+		del_buf(conn->key);
+	if (conn->in)
+		fclose(conn->in);
+	if (conn->out)
+		fclose(conn->out);
+	for (int i = 0; i < 2; ++i) {
+		if (conn->fds[i] >= 0)
+			close(conn->fds[i]);
+		free(conn->paths[i]);
+	}
+	free(conn->text);
+	free(conn->argv);
+	close(conn->sock);
+	free(conn);
+}
+
+/**
+ * @brief Signal handler asking the daemon to stop.
+ *
+ * @param sig The signal.
+ */
+static void
+stop_server(int sig)
+{
+	(void)sig;
+	stopping = 1;
+}
+
+/**
+ * @brief Run the daemon.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments, starting with '--serve'.
+ * @return Exit code.
+ */
+int
+serve(int argc, char *argv[])
+{
+	if (setjmp(_buf)) {
+		fprintf(stderr, "%s\n", _errmsg);
+		return 1;
+	}
+	const char *path = argv[1];
+	int jobs = 0;
+	server_t srv = { .lock = PTHREAD_MUTEX_INITIALIZER };
+	for (int i = 2; i < argc; ++i) {
+		const char *arg;
+		if ((arg = option_arg(argc, argv, &i, "jobs")))
+			jobs = parse_jobs(arg);
+		else if (strcmp(argv[i], "--reload") == 0)
+			srv.reload = true;
+		else
+			error("Unknown option '%s'.", argv[i]);
+	}
+	// Take over the socket unless another daemon is listening on it.
+	struct sockaddr_un addr;
+	socket_address(&addr, path);
+	int sock = connect_daemon(path);
+	if (sock >= 0) {
+		close(sock);
+		error("A daemon is already listening on '%s'.", path);
+	}
+	struct stat st;
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode))
+			error("'%s' exists and is not a socket.", path);
+		unlink(path);
+	}
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		error("Cannot create socket.");
+	fcntl(sock, F_SETFD, FD_CLOEXEC);
+	mode_t mask = umask(0077); // Only the owner may connect.
+	int ok = bind(sock, (struct sockaddr*)&addr, sizeof(addr));
+	umask(mask);
+	if (ok != 0 || listen(sock, SOMAXCONN) != 0) {
+		close(sock);
+		error("Cannot listen on '%s'.", path);
+	}
+	// Interrupt accept() on SIGINT and SIGTERM.
+	struct sigaction sa = { .sa_handler = stop_server };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	srv.sets = new_dict();
+	srv.keys = new_arena();
+	// Workers inherit a mask blocking the signals, so that they are
+	// delivered to this thread.
+	sigset_t block, old;
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	pool_t *pool = new_pool(jobs);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	struct timeval timeout = { .tv_sec = REQUEST_TIMEOUT };
+	while (!stopping) {
+		int fd = accept(sock, NULL, NULL);
+		if (fd < 0)
+			continue;
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		conn_t *conn = calloc(1, sizeof(conn_t));
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+		*conn = (conn_t){ .srv = &srv, .sock = fd, .fds = { -1, -1 } };
+		pool_submit(pool, serve_request, conn);
+	}
+	// Finish the requests accepted so far.
+	close(sock);
+	unlink(path);
+	del_pool(pool);
+	for (size_t e = 0; e < srv.sets->count; ++e)
+		release_rules(&srv, (ruleset_t*)srv.sets->entries[e].val);
+	del_dict(srv.sets);
+	del_arena(srv.keys);
+	return 0;
+}
+
+/**
+ * @brief Forward a command line to a daemon.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments, starting with '--client'.
+ * @return Exit code.
+ */
+int
+client(int argc, char *argv[])
+{
+	const char *path = argv[1];
+	int i = 2;
+	bool pass = i < argc && strcmp(argv[i], "--pass-fds") == 0;
+	i += pass;
+	// The command line as smc itself would have been given it.
+	int fargc = argc - i + 1;
+	char **fargv = argv + i - 1;
+	fargv[0] = argv[0];
+	int sock = connect_daemon(path);
+	if (sock < 0)
+		return run(fargc, fargv);
+
+	// An outfile this client created is removed again if the request fails.
+	const char *volatile created = NULL;
+	if (setjmp(_buf)) {
+		fprintf(stderr, "%s\n", _errmsg);
+		if (created)
+			unlink(created);
+		close(sock);
+		return 1;
+	}
+	int arg = skip_options(fargc, fargv);
+	if (fargc - arg < 2) {
+		close(sock);
+		return run(fargc, fargv); // Print the usage.
+	}
+	// The plan of a dry run goes to stdout, which the daemon cannot reach.
+	for (int j = 1; j < arg; ++j)
+		if (strcmp(fargv[j], "--dry-run") == 0) {
+			close(sock);
+			return run(fargc, fargv);
+		}
+	int fds[2] = { -1, -1 };
+	if (pass) {
+		if ((fds[0] = open(fargv[arg], O_RDONLY)) < 0)
+			error("Open file '%s' failed.", fargv[arg]);
+		fds[1] = open(fargv[arg + 1], O_WRONLY);
+		if (fds[1] < 0 && errno == ENOENT
+		 && (fds[1] = open(fargv[arg + 1], O_WRONLY | O_CREAT | O_EXCL, 0666)) >= 0)
+			created = fargv[arg + 1];
+		if (fds[1] < 0) {
+			close(fds[0]);
+			error("Open file '%s' failed.", fargv[arg + 1]);
+		}
+	}
+	// Send the working directory and the command line.
+	buf_t *text = new_buf();
+	char cwd[4096];
+	if (!getcwd(cwd, sizeof(cwd)))
+		error("Cannot get the working directory.");
+	buf_ncat(text, cwd, strlen(cwd) + 1);
+	for (int j = 1; j < fargc; ++j)
+		buf_ncat(text, fargv[j], strlen(fargv[j]) + 1);
+	request_t req = { REQUEST_MAGIC, text->cnt, pass ? 2 : 0 };
+	union {
+		struct cmsghdr hdr;
+		char           buf[CMSG_SPACE(2 * sizeof(int))];
+	} ctl;
+	struct iovec iov = { .iov_base = &req, .iov_len = sizeof(req) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+	if (pass) {
+		msg.msg_control    = ctl.buf;
+		msg.msg_controllen = sizeof(ctl.buf);
+		struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type  = SCM_RIGHTS;
+		c->cmsg_len   = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(c), fds, sizeof(fds));
+	}
+	ssize_t n;
+	while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+	if (pass) {
+		close(fds[0]);
+		close(fds[1]);
+	}
+	bool sent = n >= 0 && (n == sizeof(req) || send_all(sock, (char*)&req + n, sizeof(req) - n))
+	         && send_all(sock, text->buf, text->cnt);
+	del_buf(text);
+	// Wait for the reply.
+	reply_t reply;
+	if (!sent || !recv_all(sock, &reply, sizeof(reply)))
+		error("Lost connection to the daemon on '%s'.", path);
+	if (reply.size) {
+		char msg[ERROR_MAX];
+		size_t len = reply.size < sizeof(msg) ? reply.size : sizeof(msg) - 1;
+		if (!recv_all(sock, msg, len))
+			error("Lost connection to the daemon on '%s'.", path);
+		fprintf(stderr, "%.*s\n", (int)len, msg);
+	}
+	if (reply.code && created)
+		unlink(created);
+	close(sock);
+	return reply.code;
+}
+
+#else
+
+int
+serve(int argc, char *argv[])
+{
+	(void)argc, (void)argv;
+	fputs("The daemon is not supported on this platform.\n", stderr);
+	return 1;
+}
+
+int
+client(int argc, char *argv[])
+{
+	// Without a daemon the request is processed right away.
+	return argc > 2 && strcmp(argv[2], "--pass-fds") == 0
+	     ? run(argc - 2, argv + 2) : run(argc - 1, argv + 1);
+}
+
+#endif
@@ -1,133 +1,4452 @@
-/**
- * @file smc.c
- * @brief Main part for Symbol Modifier for COFF (SMC).
- *
- * @author Dangfer
- * @date 2024-01-07
- * @version 1.0.0
- * 
- * Note:
- *     This tool is distributed in the hope that it will be useful, but WITHOUT
- *     ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
- *     FITNESS FOR A PARTICULAR PURPOSE.
- * 
- * License:
- *     This program is free software; you can redistribute it and/or modify it
- *     under the terms of the GNU General Public License as published by the
- *     Free Software Foundation; either version 2 of the License, or (at your
- *     option) any later version.
- */
-
-
-#include <stdio.h>
-#include <windows.h>
-#include "smclib.h"
-
-static const char help[] =
-	"Symbol Modifier for COFF (SMC)\n"
-	"Usage: smc infile outfile old new [old new ...]\n"
-	"where:\n"
-	"  infile      is the name of the input COFF file.\n"
-	"  outfile     is the name for the output COFF file with modified symbols.\n"
-	"  old new     is a pair where 'old' is the original symbol name to be modified\n"
-	"              and 'new' is the new symbol name.\n"
-	"  @listfile   is an optional argument where 'listfile' is a file containing\n"
-	"              multiple 'old new' pairs.\n";
-
-/**
- * @brief Retrieve all symbol names from a COFF file symbol table and store
- *        them in a dictionary.
- *
- * This function allocates a dictionary object.
- * The caller is responsible for deleting the object.
- * 
- * @param symtab The symbol table of the COFF file.
- * @param nsym   Number of symbols in the symbol table.
- * @return Pointer to the dictionary containing the symbol names.
- */
-static dict_t *
-get_symbol_names(PIMAGE_SYMBOL symtab, size_t nsym)
-{
-	dict_t *dict = new_dict();
-	// String table immediately follows symbol table.
-	void *strtab = symtab + nsym;
-	// Traverse symbol table.
-	for (size_t i = 0; i < nsym; ++i) {
-		PIMAGE_SYMBOL sym = &symtab[i];
-		const char *s = sym->N.Name.Short ? sym->N.ShortName : strtab + sym->N.Name.Long;
-		dict_add(dict, s, NULL);
-		i += sym->NumberOfAuxSymbols;
-	}
-	return dict;
-}
-
-/**
- * @brief Modify a symbol name in the dictionary.
- *
- * @param dict Dictionary where the symbol names are stored.
- * @param old  Pointer to the string containing the old symbol name.
- * @param new  Pointer to the string containing the new symbol name.
- */
-static inline void
-change_symbol_name(dict_t *dict, const char *old, const char *new)
-{
-	if (!dict_add(dict, old, new))
-		error("Cannot find symbol '%s'.", old);
-}
-
-int
-main(int argc, char *argv[])
-{
-	if (argc < 3) {
-		fputs(help, stderr);
-		return 0;
-	}
-	// Set a Non-local jump.
-	int code;
-	if ((code = setjmp(_buf)))
-		return code;
-	// Read a COFF file and initialize essential information.
-	void *file;
-	read_file(argv[1], &file);
-	PIMAGE_FILE_HEADER head   = file;
-	PIMAGE_SYMBOL      symtab = file + head->PointerToSymbolTable;
-	DWORD              nsym   = head->NumberOfSymbols;
-	dict_t            *dict   = get_symbol_names(symtab, nsym);
-	// Traverse all 'old new' pairs.
-	for (int i = 3; i < argc;) {
-		if (argv[i][0] == '@') { // listfile
-			FILE *fp = fopen(argv[i] + 1, "r");
-			char old[256], new[256];
-			while (fscanf(fp, "%s%s", old, new) == 2)
-				change_symbol_name(dict, old, new);
-			fclose(fp);
-			++i;
-		} else {
-			change_symbol_name(dict, argv[i], argv[i + 1]);
-			i += 2;
-		}
-	}
-	// Save changes to file.
-	FILE *fp = fopen(argv[2], "wb");
-	fwrite(file, head->PointerToSymbolTable, 1, fp);
-	buf_t *buf = new_buf();
-	buf->cnt = 4; // Skip string table length.
-	PIMAGE_SYMBOL sym = symtab;
-	for (size_t e = 0; e < dict->count; ++e) {
-		entry_t *entry = dict->entries[e];
-		const char *s = entry->val ? : entry->key;
-		size_t len = strlen(s);
-		if (len <= 8) {
-			strncpy((char*)sym->N.ShortName, s, 8);
-		} else {
-			size_t offset = buf_cat(buf, s);
-			sym->N.Name.Short = 0;
-			sym->N.Name.Long  = offset;
-		}
-		sym += sym->NumberOfAuxSymbols + 1;
-	}
-	*(DWORD*)buf->buf = buf->cnt;
-	fwrite(symtab, IMAGE_SIZEOF_SYMBOL, nsym, fp);
-	fwrite(buf->buf, buf->cnt, 1, fp);
-	fclose(fp);
-}
\ No newline at end of file
+/**
+ * @file smc.c
+ * @brief Main part for Symbol Modifier for COFF (SMC).
+ *
+ * @author Dangfer
+ * @date 2024-01-07
+ * @version 1.0.0
+ * 
+ * Note:
+ *     This tool is distributed in the hope that it will be useful, but WITHOUT
+ *     ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *     FITNESS FOR A PARTICULAR PURPOSE.
+ * 
+ * License:
+ *     This program is free software; you can redistribute it and/or modify it
+ *     under the terms of the GNU General Public License as published by the
+ *     Free Software Foundation; either version 2 of the License, or (at your
+ *     option) any later version.
+ */
+
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#include "coff.h"
+#include "smc.h"
+#include "smclib.h"
+#include "demangle.h"
+
+static const char help[] =
+	"Symbol Modifier for COFF (SMC)\n"
+	"Usage: smc [options] infile outfile [old new ...]\n"
+	"       smc --serve socket [--jobs N] [--reload]\n"
+	"       smc --client socket [--pass-fds] [options] infile outfile [old new ...]\n"
+	"       smc --project filelist [options] [old new ...]\n"
+	"where:\n"
+	"  infile      is the name of the input COFF file, relocatable ELF file or\n"
+	"              archive.\n"
+	"  outfile     is the name for the output file with modified symbols.\n"
+	"  old new     is a pair where 'old' is the original symbol name to be modified\n"
+	"              and 'new' is the new symbol name.\n"
+	"  @listfile   is an optional argument where 'listfile' is a file containing\n"
+	"              multiple 'old new' pairs.\n"
+	"options:\n"
+	"  --prefix-defined prefix\n"
+	"              prepend 'prefix' to every external symbol defined in infile.\n"
+	"  --prefix-undefined prefix\n"
+	"              prepend 'prefix' to every external symbol referenced but not\n"
+	"              defined in infile.\n"
+	"  --transform kind[=N][,class...]\n"
+	"              apply an x86 decoration transform to every symbol of the given\n"
+	"              storage classes ('external', 'static' or 'weak'; all of them by\n"
+	"              default). 'kind' is one of:\n"
+	"                strip-underscore  _name     -> name\n"
+	"                add-underscore    name      -> _name\n"
+	"                stdcall[=N]       name      -> _name@N\n"
+	"                fastcall[=N]      name      -> @name@N\n"
+	"                undecorate        _name@N   -> name\n"
+	"              N defaults to the argument size the name is already decorated\n"
+	"              with. '@N' is only added to function symbols. The option may be\n"
+	"              repeated; transforms are applied in order.\n"
+	"  --demangle  also match 'old' against demangled C++ names, spelled like\n"
+	"              'ns::foo(char const*, int)' for both MSVC and Itanium names.\n"
+	"              The mangled name is replaced by 'new' as given.\n"
+	"  --codeview  also rename the procedures and data named in the CodeView debug\n"
+	"              information ('.debug$S') of COFF files.\n"
+	"  --weak-defaults\n"
+	"              rename the default of a renamed weak external along with it,\n"
+	"              e.g. '.weak.foo.default.main' with 'foo'.\n"
+	"  --strip-unreferenced\n"
+	"              drop the static symbols and labels of COFF files that no\n"
+	"              relocation refers to, such as '$LN' and '$SG' labels.\n"
+	"  --jobs N    rename the members of an archive on 'N' threads (one per CPU by\n"
+	"              default), or index and rebuild the symbol table of a large object\n"
+	"              on them.\n"
+	"  --redefine-sym old=new\n"
+	"              rename 'old' to 'new'. Unlike an 'old new' pair, 'old' need not\n"
+	"              match any symbol, as with objcopy.\n"
+	"  --redefine-syms file\n"
+	"              the same for each 'old new' line of 'file', where '#' starts a\n"
+	"              comment, as with 'objcopy --redefine-syms'. Both options may be\n"
+	"              repeated.\n"
+	"  --rename-section old=new\n"
+	"              rename the section 'old' to 'new', along with the COFF section\n"
+	"              symbols named after it. Sections that are not found are\n"
+	"              ignored. The option may be repeated.\n"
+	"  --localize-symbol name\n"
+	"              make the external symbol 'name' static where a COFF file defines\n"
+	"              it, and drop it from the symbol index of an archive.\n"
+	"  --localize-symbols file\n"
+	"              the same for each name on a line of 'file', where '#' starts a\n"
+	"              comment, as with 'objcopy --localize-symbols'. Both options may\n"
+	"              be repeated.\n"
+	"  --allow-collisions\n"
+	"              write files where renaming makes two defined external symbols\n"
+	"              share a name, which is an error otherwise.\n"
+	"  --follow-renames\n"
+	"              follow chains of 'old new' pairs, so that 'a b' and 'b c' rename\n"
+	"              'a' to 'c'; a cycle is an error. Otherwise every pair applies to\n"
+	"              the original names, so that 'a b' and 'b a' swap them.\n"
+	"  --dry-run   rename without writing outfile, and print a line for infile to\n"
+	"              stdout: its name, the numbers of names renamed, symbols made\n"
+	"              static and symbols stripped, and the sizes of the new string\n"
+	"              table and of the file that would be written, separated by tabs.\n"
+	"              Archives get a line per object member, then the totals.\n"
+	"  --cache dir keep outputs in the directory 'dir', keyed by the contents of\n"
+	"              infile and by the rules, and copy them from there when the same\n"
+	"              file is renamed with the same rules again.\n"
+	"  --cache-size size\n"
+	"              evict the least recently used outputs once the cache grows past\n"
+	"              'size' bytes, which may end in K, M or G (1G by default).\n"
+	"  --sidecar   keep the symbol index of infile in 'infile.smcidx' and read it\n"
+	"              from there while infile stays the same, instead of hashing\n"
+	"              every symbol name again.\n"
+	"  --stream    read only the headers and the symbol and string tables of a COFF\n"
+	"              infile, and copy the rest to outfile through a buffer, so that\n"
+	"              objects larger than memory can be renamed.\n"
+	"  --stream-buffer size\n"
+	"              copy streamed files through a buffer of 'size' bytes, which may\n"
+	"              end in K, M or G (1M by default).\n"
+	"  Symbols renamed by an 'old new' pair are neither transformed nor prefixed.\n"
+	"  Names in '/EXPORT:', '/INCLUDE:' and '/ALTERNATENAME:' directives of\n"
+	"  '.drectve' sections are renamed along with the symbols.\n"
+	"  In an archive, every COFF or ELF member is renamed and the symbol index is\n"
+	"  rebuilt; an 'old new' pair needs to match a symbol in one member only.\n"
+	"daemon:\n"
+	"  --serve     listen on the Unix domain socket 'socket' and process requests\n"
+	"              on 'N' worker threads (one per CPU by default). Compiled rules\n"
+	"              are kept in memory; with '--reload' they are recompiled when a\n"
+	"              listfile they were read from changes.\n"
+	"  --client    have the daemon listening on 'socket' process the request. With\n"
+	"              '--pass-fds' the files are opened by the client and passed to\n"
+	"              the daemon. Falls back to processing the request itself if no\n"
+	"              daemon is listening.\n"
+	"project:\n"
+	"  --project   rename every 'infile outfile' pair listed in 'filelist', on as\n"
+	"              many threads as '--jobs' tells, and report the names that the\n"
+	"              renaming makes more than one object define. Outfiles are only\n"
+	"              written if none is. An 'old new' pair needs to match a symbol\n"
+	"              in one object only. Archives cannot be part of a project.\n";
+
+/**
+ * @brief Kinds of x86 decoration transforms.
+ */
+enum {
+	XF_STRIP_UNDERSCORE, ///< _name -> name
+	XF_ADD_UNDERSCORE,   ///< name -> _name
+	XF_STDCALL,          ///< name -> _name@N
+	XF_FASTCALL,         ///< name -> @name@N
+	XF_UNDECORATE,       ///< _name@N, @name@N -> name
+};
+
+/**
+ * @brief A decoration transform.
+ */
+typedef struct {
+	int         kind;    ///< One of XF_*.
+	const char *num;     ///< Digits of the argument size 'N', or NULL.
+	size_t      numlen;  ///< Number of digits in `num`.
+	int         classes; ///< Storage classes the transform applies to.
+} xform_t;
+
+#define MAX_XFORMS 16
+
+/**
+ * @brief Part of every rule digest, to be changed whenever the same rules
+ *        rename the same file differently, so that the outputs cached by
+ *        older versions are not used.
+ */
+#define CACHE_VERSION "smc cache 2"
+
+/**
+ * @brief A listfile the rules were read from.
+ */
+typedef struct {
+	char  *path;  ///< Name of the listfile, resolved against the rules' directory.
+	char  *text;  ///< Contents of the listfile, which the rules borrow names from.
+	time_t mtime; ///< Modification time when the listfile was read.
+	off_t  size;  ///< Size when the listfile was read.
+} source_t;
+
+/**
+ * @brief Renaming rules collected from the command line.
+ *
+ * The rules borrow strings from the arguments they were compiled from, which
+ * must outlive them. They are not modified once compiled and may be shared by
+ * threads.
+ */
+struct rules_t {
+	dict_t     *renames;           ///< Map of old symbol names to new ones.
+	bool       *optional;          ///< Renamings that may match no symbol, by entry.
+	size_t      noptional;         ///< Capacity of `optional`.
+	dict_t     *sections;          ///< Map of old section names to new ones.
+	dict_t     *locals;            ///< Names of external symbols to make static.
+	const char *prefix_defined;    ///< Prefix for defined external symbols.
+	const char *prefix_undefined;  ///< Prefix for undefined external symbols.
+	xform_t     xforms[MAX_XFORMS];///< Decoration transforms in order.
+	int         nxform;            ///< Number of decoration transforms.
+	int         jobs;              ///< Number of threads renaming archive members.
+	bool        demangle;          ///< Whether '--demangle' was given.
+	bool        codeview;          ///< Whether '--codeview' was given.
+	bool        weak_defaults;     ///< Whether '--weak-defaults' was given.
+	bool        strip;             ///< Whether '--strip-unreferenced' was given.
+	bool        allow_collisions;  ///< Whether '--allow-collisions' was given.
+	bool        follow;            ///< Whether '--follow-renames' was given.
+	bool        dry_run;           ///< Whether '--dry-run' was given.
+	bool        sidecar;           ///< Whether '--sidecar' was given.
+	bool        stream;            ///< Whether '--stream' was given.
+	size_t      stream_buffer;     ///< Size of the buffer streamed files are copied through.
+	char       *cache;             ///< Directory of the output cache, or NULL.
+	size_t      cache_size;        ///< Size the output cache is kept under.
+	digest_t    digest;            ///< Digest of what changes the output, as digest_option() tells.
+	demangler_t *demangler;        ///< Cache for matching demangled names, or NULL.
+	const char *dir;               ///< Directory relative listfiles are resolved against, or NULL.
+	source_t   *sources;           ///< Listfiles read.
+	int         nsource;           ///< Number of listfiles read.
+};
+
+/**
+ * @brief New contents of a section of a renamed COFF file.
+ */
+typedef struct {
+	DWORD   off;   ///< Offset of the old contents.
+	DWORD   size;  ///< Size of the old contents.
+	size_t  sec;   ///< Index of the section these belong to.
+	bool    relocs;///< Whether these are the relocations rather than the raw data.
+	buf_t  *data;  ///< New contents.
+	int64_t shift; ///< How far the new contents up to these move what follows.
+} content_t;
+
+/**
+ * @brief Relationships between the symbols and sections of a COFF file, as
+ *        told by their aux records.
+ *
+ * Sections are indexed by their 1-based section number, as symbols refer to
+ * them.
+ */
+typedef struct {
+	size_t *weakdef; ///< Default symbol of each weak external, by symbol index, or SIZE_MAX.
+	size_t *secsym;  ///< Section definition symbol of each section, or SIZE_MAX.
+	size_t *comdat;  ///< COMDAT symbol of each COMDAT section, or SIZE_MAX.
+	DWORD  *assoc;   ///< Section an associative COMDAT section goes with, or 0.
+	BYTE   *select;  ///< COMDAT selection of each section, or 0.
+} graph_t;
+
+/**
+ * @brief A COFF file loaded into memory along with its symbol index.
+ *
+ * Relocatable ELF files are held the same way, with their layout left to
+ * elf.c: the symbol records are ELF symbols, whose names are all kept in the
+ * string table, and `attrs` stands for what the COFF fields tell.
+ *
+ * Big object files (/bigobj) start with ANON_OBJECT_HEADER_BIGOBJ and have
+ * IMAGE_SYMBOL_EX records, which only differ from IMAGE_SYMBOL from the
+ * section number on. Records are therefore reached through symbol_at() and
+ * their fields past the value through the symbol_*() accessors.
+ *
+ * Section names are indexed in the same dictionary, after the symbol names,
+ * so that renamed sections and symbols share one string table rebuild.
+ * Sections whose contents name symbols, such as '.drectve', are rewritten
+ * in the same pass, and whatever follows them in the file is moved along.
+ *
+ * The aux records of COFF files are read while indexing into `graph`, so
+ * that weak externals and COMDAT sections can be followed without going
+ * over the symbol table again.
+ *
+ * Stripped symbols are left out of the new symbol table, and `newindex`
+ * tells where the others went, for the relocations and aux records that
+ * refer to them.
+ */
+struct coff_t {
+	void              *file;     ///< Contents of the file.
+	size_t             size;     ///< Size of the file in bytes.
+	bool               bigobj;   ///< Whether the file is a big object file.
+	size_t             symsize;  ///< Size of a symbol record.
+	DWORD              symoff;   ///< Offset of the symbol table.
+	char              *symtab;   ///< Symbol table.
+	DWORD              nsym;     ///< Number of symbol records, including aux records.
+	const char        *strtab;   ///< String table, starting with its size.
+	size_t             strsize;  ///< Size of the string table in bytes.
+	size_t             secoff;   ///< Offset of the section headers.
+	size_t             nsec;     ///< Number of sections whose names are indexed.
+	bool               secshared;///< Whether section names are in the string table.
+	dict_t            *dict;     ///< Unique symbol names, then section names.
+	size_t             nsymname; ///< Number of dictionary entries that are symbol names.
+	size_t            *slots;    ///< Dictionary entry of each symbol record.
+	size_t            *secslots; ///< Dictionary entry of each section name.
+	graph_t            graph;    ///< Relationships read from the aux records of a COFF file.
+	arena_t           *arena;    ///< New names made up while renaming, or NULL.
+	uint8_t           *attrs;    ///< CLS_* and SYM_* bits of each symbol record.
+	elf_t             *elf;      ///< The ELF file, or NULL for COFF files.
+	struct name_t     *names;    ///< New name of each dictionary entry.
+	char              *newsym;   ///< New symbol table.
+	buf_t             *newstr;   ///< New string table.
+	char              *newhdr;   ///< New file and section headers of a COFF file.
+	DWORD              newsymoff;///< New offset of the symbol table of a COFF file.
+	content_t         *contents; ///< New section contents of a COFF file, by offset.
+	size_t             ncontent; ///< Number of new section contents.
+	bool               codeview; ///< Whether CodeView symbol records are renamed.
+	int                jobs;     ///< Threads processing a large file, or 0 for one per CPU.
+	dict_t            *cvdict;   ///< Changed symbol names as CodeView spells them.
+	size_t            *cvslots;  ///< Dictionary entry of each name in `cvdict`.
+	buf_t             *moves;    ///< Where a CodeView section being rewritten moved.
+	size_t            *secnames; ///< New section name offsets of an ELF file.
+	size_t            *newindex; ///< New index of each symbol record, or SIZE_MAX if stripped.
+	size_t             nstrip;   ///< Number of symbol records stripped.
+	size_t             nlocal;   ///< Number of external symbols made static.
+	dict_t            *targets;  ///< New names of the changed definitions, while checking them.
+	size_t             nchanged; ///< Number of names written out differently.
+	FILE              *in;       ///< A file streamed from, or NULL if `file` holds all of it.
+	const char        *path;     ///< Name of a streamed file, used in error messages.
+	char              *tables;   ///< Everything of a streamed file from its symbol table on.
+	buf_t             *part;     ///< Last section contents read from a streamed file.
+	char              *window;   ///< Buffer a streamed file is copied through.
+	size_t             nwindow;  ///< Size of `window`.
+};
+
+/**
+ * @brief Class ID of ANON_OBJECT_HEADER_BIGOBJ,
+ *        {D1BAA1C7-BAEE-4BA9-AF20-FAF66AA4DCB8}.
+ */
+static const BYTE bigobj_class[16] = {
+	0xc7, 0xa1, 0xba, 0xd1, 0xee, 0xba, 0xa9, 0x4b,
+	0xaf, 0x20, 0xfa, 0xf6, 0x6a, 0xa4, 0xdc, 0xb8,
+};
+
+/**
+ * @brief Get a section header.
+ *
+ * @param coff    The COFF file.
+ * @param headers The contents of the file or a copy of its headers.
+ * @param i       Index of the section.
+ * @return The section header.
+ */
+static inline PIMAGE_SECTION_HEADER
+section_at(const coff_t *coff, char *headers, size_t i)
+{
+	return (PIMAGE_SECTION_HEADER)(headers + coff->secoff + i * IMAGE_SIZEOF_SECTION_HEADER);
+}
+
+/**
+ * @brief Digits of string table offsets in '//' section names.
+ */
+static const char base64[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * @brief Get a symbol record of a symbol table.
+ *
+ * Only the name and value may be read through the result directly.
+ *
+ * @param coff  The COFF file.
+ * @param table The symbol table or a copy of it.
+ * @param i     Index of the record.
+ * @return The record.
+ */
+static inline PIMAGE_SYMBOL
+symbol_at(const coff_t *coff, char *table, size_t i)
+{
+	return (PIMAGE_SYMBOL)(table + i * coff->symsize);
+}
+
+/**
+ * @brief Get the section number of a symbol record.
+ *
+ * @param coff The COFF file.
+ * @param sym  The symbol record.
+ * @return The section number.
+ */
+static inline LONG
+symbol_section(const coff_t *coff, PIMAGE_SYMBOL sym)
+{
+	return coff->bigobj ? ((PIMAGE_SYMBOL_EX)sym)->SectionNumber : sym->SectionNumber;
+}
+
+/**
+ * @brief Get the type of a symbol record.
+ *
+ * @param coff The COFF file.
+ * @param sym  The symbol record.
+ * @return The type.
+ */
+static inline WORD
+symbol_type(const coff_t *coff, PIMAGE_SYMBOL sym)
+{
+	return coff->bigobj ? ((PIMAGE_SYMBOL_EX)sym)->Type : sym->Type;
+}
+
+/**
+ * @brief Get the storage class of a symbol record.
+ *
+ * @param coff The COFF file.
+ * @param sym  The symbol record.
+ * @return The storage class.
+ */
+static inline BYTE
+symbol_storage(const coff_t *coff, PIMAGE_SYMBOL sym)
+{
+	return coff->bigobj ? ((PIMAGE_SYMBOL_EX)sym)->StorageClass : sym->StorageClass;
+}
+
+/**
+ * @brief Set the storage class of a symbol record.
+ *
+ * @param coff The COFF file.
+ * @param sym  The symbol record.
+ * @param cls  The storage class.
+ */
+static inline void
+set_symbol_storage(const coff_t *coff, PIMAGE_SYMBOL sym, BYTE cls)
+{
+	if (coff->bigobj)
+		((PIMAGE_SYMBOL_EX)sym)->StorageClass = cls;
+	else
+		sym->StorageClass = cls;
+}
+
+/**
+ * @brief Get the number of aux records following a symbol record.
+ *
+ * @param coff The COFF file.
+ * @param sym  The symbol record.
+ * @return The number of aux records.
+ */
+static inline BYTE
+symbol_aux(const coff_t *coff, PIMAGE_SYMBOL sym)
+{
+	return coff->bigobj ? ((PIMAGE_SYMBOL_EX)sym)->NumberOfAuxSymbols : sym->NumberOfAuxSymbols;
+}
+
+/**
+ * @brief The name a unique symbol name is written out as.
+ *
+ * The name is kept as slices of the original bytes, so that decoration
+ * transforms need no intermediate strings. It is written out as
+ * `prefix` ["__imp_"] `lead` `name` ['@' `num`].
+ */
+typedef struct name_t {
+	const char *prefix;  ///< Prefix prepended to the name.
+	size_t      plen;    ///< Length of `prefix`.
+	const char *name;    ///< New name of the symbol, or the original one.
+	size_t      len;     ///< Length of `name`.
+	const char *num;     ///< Digits of the '@N' suffix, or NULL.
+	size_t      numlen;  ///< Number of digits in `num`.
+	char        lead[4]; ///< Decoration characters before the name.
+	uint8_t     nlead;   ///< Number of characters in `lead`.
+	bool        imp;     ///< Whether the name is an '__imp_' pointer.
+	bool        renamed; ///< Renamed explicitly by a rule.
+	bool        parsed;  ///< Decoration has been split off and transformed.
+	bool        changed; ///< Written out differently from the original name.
+	bool        stripped;///< Only names symbols that are stripped.
+	bool        local;   ///< Defined external symbols of this name are made static.
+	bool        madelocal;///< Some symbol record of this name was made static.
+	bool        defined; ///< Names a defined external symbol, once checked for collisions.
+	size_t      offset;  ///< Offset into the new string table; 0 for short names.
+} name_t;
+
+/**
+ * @brief Get the name of a symbol without copying it.
+ *
+ * @param coff The COFF file containing the symbol.
+ * @param sym  The symbol record.
+ * @param len  Receives the length of the name.
+ * @return Pointer to the name, which is not null-terminated if it is a short
+ *         name of exactly 8 characters.
+ */
+static const char *
+symbol_name(const coff_t *coff, PIMAGE_SYMBOL sym, size_t *len)
+{
+	if (sym->N.Name.Short) {
+		*len = strnlen((const char*)sym->N.ShortName, 8);
+		return (const char*)sym->N.ShortName;
+	}
+	if (sym->N.Name.Long < 4 || sym->N.Name.Long >= coff->strsize)
+		error("Invalid string table offset %lu.", (unsigned long)sym->N.Name.Long);
+	const char *s = coff->strtab + sym->N.Name.Long;
+	*len = strnlen(s, coff->strsize - sym->N.Name.Long);
+	return s;
+}
+
+/**
+ * @brief Get the name of a section without copying it.
+ *
+ * Names longer than 8 characters are kept in the string table, with the
+ * header holding '/' and the offset in decimal, or '//' and the offset in
+ * base64 if it does not fit 7 digits.
+ *
+ * @param coff The COFF file containing the section.
+ * @param sec  The section header.
+ * @param len  Receives the length of the name.
+ * @return Pointer to the name, which is not null-terminated if it is a short
+ *         name of exactly 8 characters.
+ */
+static const char *
+section_name(const coff_t *coff, const IMAGE_SECTION_HEADER *sec, size_t *len)
+{
+	const char *name = (const char*)sec->Name;
+	if (name[0] != '/') {
+		*len = strnlen(name, IMAGE_SIZEOF_SHORT_NAME);
+		return name;
+	}
+	bool b64 = name[1] == '/';
+	uint64_t off = 0;
+	size_t i = b64 ? 2 : 1, first = i;
+	for (; i < IMAGE_SIZEOF_SHORT_NAME && name[i]; ++i) {
+		const char *d = b64 ? memchr(base64, name[i], 64) : NULL;
+		if (!b64 && name[i] >= '0' && name[i] <= '9')
+			off = off * 10 + (name[i] - '0');
+		else if (d)
+			off = off * 64 + (d - base64);
+		else
+			break;
+	}
+	if (i == first || (i < IMAGE_SIZEOF_SHORT_NAME && name[i]))
+		error("Invalid section name '%.8s'.", name);
+	if (off < 4 || off >= coff->strsize)
+		error("Invalid string table offset %lu.", (unsigned long)off);
+	const char *s = coff->strtab + off;
+	*len = strnlen(s, coff->strsize - off);
+	return s;
+}
+
+/**
+ * @brief Get the attributes of a symbol that renaming rules key on.
+ *
+ * Section definitions, absolute and debug symbols (e.g. '@feat.00') are
+ * given none, so that they are never transformed or prefixed.
+ *
+ * @param coff The COFF file containing the symbol.
+ * @param sym  The symbol record.
+ * @return One of CLS_* along with SYM_* bits, or 0.
+ */
+static int
+symbol_attrs(const coff_t *coff, PIMAGE_SYMBOL sym)
+{
+	int attrs;
+	if (symbol_section(coff, sym) < IMAGE_SYM_UNDEFINED)
+		return 0;
+	switch (symbol_storage(coff, sym)) {
+	case IMAGE_SYM_CLASS_EXTERNAL:
+		attrs = CLS_EXTERNAL;
+		break;
+	case IMAGE_SYM_CLASS_STATIC:
+		if (symbol_aux(coff, sym))
+			return 0;
+		attrs = CLS_STATIC;
+		break;
+	case IMAGE_SYM_CLASS_WEAK_EXTERNAL:
+		attrs = CLS_WEAK;
+		break;
+	default:
+		return 0;
+	}
+	// Common symbols have no section but a nonzero size.
+	if (symbol_section(coff, sym) != IMAGE_SYM_UNDEFINED || sym->Value)
+		attrs |= SYM_DEFINED;
+	if (ISFCN(symbol_type(coff, sym)))
+		attrs |= SYM_FUNCTION;
+	return attrs;
+}
+
+/**
+ * @brief Note what the aux records of a symbol tell about its relationships.
+ *
+ * A weak external names its default symbol. A section definition gives the
+ * COMDAT selection of its section and, for an associative section, the
+ * section it goes with; the first symbol of a COMDAT section after that is
+ * its COMDAT symbol.
+ *
+ * @param coff The COFF file being indexed.
+ * @param i    Index of the symbol.
+ * @param sym  The symbol record.
+ */
+static void
+link_symbol(coff_t *coff, size_t i, PIMAGE_SYMBOL sym)
+{
+	graph_t *g = &coff->graph;
+	LONG sec = symbol_section(coff, sym);
+	bool aux = symbol_aux(coff, sym) && i + 1 < coff->nsym;
+	const BYTE *rec = aux ? (const BYTE*)symbol_at(coff, coff->symtab, i + 1) : NULL;
+	switch (symbol_storage(coff, sym)) {
+	case IMAGE_SYM_CLASS_WEAK_EXTERNAL:
+		if (aux) {
+			DWORD tag; // TagIndex
+			memcpy(&tag, rec, sizeof(tag));
+			if (tag >= coff->nsym)
+				error("Invalid weak external %lu.", (unsigned long)i);
+			g->weakdef[i] = tag;
+		}
+		return;
+	case IMAGE_SYM_CLASS_STATIC:
+		if (aux && sec > 0 && (DWORD)sec <= coff->nsec && g->secsym[sec] == SIZE_MAX) {
+			WORD num[2];  // Number, HighNumber
+			memcpy(&num[0], rec + 12, sizeof(WORD));
+			memcpy(&num[1], rec + 16, sizeof(WORD));
+			g->secsym[sec] = i;
+			g->select[sec] = rec[14];
+			if (rec[14] == IMAGE_COMDAT_SELECT_ASSOCIATIVE)
+				g->assoc[sec] = num[0] | (coff->bigobj ? (DWORD)num[1] << 16 : 0);
+			return;
+		}
+		break;
+	}
+	if (sec > 0 && (DWORD)sec <= coff->nsec && g->select[sec]
+	 && g->select[sec] != IMAGE_COMDAT_SELECT_ASSOCIATIVE && g->comdat[sec] == SIZE_MAX)
+		g->comdat[sec] = i;
+}
+
+/**
+ * @brief Allocate the relationships of a COFF file, all unknown.
+ *
+ * @param coff The COFF file being indexed.
+ */
+static void
+new_graph(coff_t *coff)
+{
+	graph_t *g = &coff->graph;
+	size_t nsec = coff->nsec + 1;
+	g->weakdef = malloc(coff->nsym * sizeof(size_t) + 1);
+	g->secsym  = malloc(nsec * sizeof(size_t));
+	g->comdat  = malloc(nsec * sizeof(size_t));
+	g->assoc   = calloc(nsec, sizeof(DWORD));
+	g->select  = calloc(nsec, 1);
+	if (!g->weakdef || !g->secsym || !g->comdat || !g->assoc || !g->select)
+		error("Memory allocation failed.");
+	memset(g->weakdef, -1, coff->nsym * sizeof(size_t));
+	memset(g->secsym, -1, nsec * sizeof(size_t));
+	memset(g->comdat, -1, nsec * sizeof(size_t));
+}
+
+/**
+ * The symbol table of a large file is indexed on several threads. A serial
+ * pre-scan only reads the aux counts, to split the table into chunks that
+ * start at a symbol record, and notes the relationships told by the aux
+ * records, which depend on their order. The chunks are then hashed in
+ * parallel, each name going to one of SCAN_PARTS partitions by its hash, and
+ * each partition is deduplicated into a table of its own by one thread. The
+ * entries of the partitions are finally numbered in the order their names
+ * first appear in the symbol table, so that the merged dictionary is the
+ * one get_symbol_names() builds serially.
+ *
+ * The new string table is built by chunks too, by build_tables(): the names
+ * of each chunk of dictionary entries are measured, the chunks are given
+ * their offsets by a prefix sum, and each chunk writes its names there, so
+ * that the symbol records can then be pointed at them independently.
+ * Smaller files are built by the same steps, run one after the other.
+ */
+
+#define SCAN_CHUNK     ((size_t)1 << 16) ///< Symbol records per chunk.
+#define SCAN_PART_BITS 4                 ///< Base-2 logarithm of the number of partitions.
+#define SCAN_PARTS     (1 << SCAN_PART_BITS)
+#define SCAN_MIN       (4 * SCAN_CHUNK)  ///< Symbol records of the smallest table scanned in parallel.
+
+typedef struct scan_t scan_t;
+
+/**
+ * @brief A task of a parallel scan, on a chunk or a partition.
+ */
+typedef struct {
+	scan_t *scan;                      ///< The scan.
+	size_t  i;                         ///< Index of the chunk or partition.
+	void  (*fn)(scan_t *scan, size_t i); ///< What to do with it.
+} scan_task_t;
+
+/**
+ * @brief A symbol table being indexed in parallel.
+ */
+struct scan_t {
+	coff_t         *coff;      ///< The COFF file being indexed.
+	pool_t         *pool;      ///< Threads running the tasks.
+	scan_task_t    *tasks;     ///< Tasks of the current phase.
+	size_t         *starts;    ///< First record of each chunk, then the number of records.
+	size_t          nchunk;    ///< Number of chunks.
+	entry_t        *names;     ///< Name of each record; aux records have none.
+	size_t         *counts;    ///< Names of each chunk in each partition, then where they go in `order`.
+	DWORD          *order;     ///< Records by partition, then in table order.
+	size_t          ends[SCAN_PARTS]; ///< End of each partition in `order`.
+	uint8_t        *first;     ///< Whether a record is the first with its name.
+	size_t         *bases;     ///< Distinct names or string bytes of each chunk, then before it.
+	size_t          count;     ///< Number of dictionary entries whose names are written out.
+	size_t          maxshort;  ///< Longest name kept out of the new string table.
+	dict_t         *parts[SCAN_PARTS]; ///< Distinct names of each partition.
+	size_t         *maps[SCAN_PARTS];  ///< Entry of each name of a partition in the merged dictionary.
+	pthread_mutex_t lock;      ///< Protects the error below.
+	bool            failed;    ///< Whether a task failed.
+	char            error[ERROR_MAX]; ///< Message of the first failure.
+};
+
+/**
+ * @brief Get the partition of a name.
+ *
+ * The hash of a short name leaves the high bits clear, so it is mixed first.
+ *
+ * @param hash Hash value of the name.
+ * @return The partition.
+ */
+static inline size_t
+part_of(hash_t hash)
+{
+	return (uint64_t)hash * 0x9e3779b97f4a7c15u >> (64 - SCAN_PART_BITS);
+}
+
+/**
+ * @brief Hash the names of a chunk and count them by partition.
+ *
+ * @param scan The scan.
+ * @param c    The chunk.
+ */
+static void
+hash_chunk(scan_t *scan, size_t c)
+{
+	coff_t *coff = scan->coff;
+	size_t *counts = scan->counts + c * SCAN_PARTS;
+	for (size_t i = scan->starts[c]; i < scan->starts[c + 1]; ++i) {
+		entry_t *n = &scan->names[i];
+		size_t aux = 0;
+		if (coff->elf) {
+			int a;
+			n->key = elf_symbol(coff->elf, i, &n->len, &a);
+			coff->attrs[i] = a;
+		} else {
+			PIMAGE_SYMBOL sym = symbol_at(coff, coff->symtab, i);
+			n->key = symbol_name(coff, sym, &n->len);
+			coff->attrs[i] = symbol_attrs(coff, sym);
+			aux = symbol_aux(coff, sym);
+		}
+		n->hash = dict_hash(n->key, n->len);
+		counts[part_of(n->hash)]++;
+		i += aux;
+	}
+}
+
+/**
+ * @brief Place the records of a chunk in their partitions.
+ *
+ * @param scan The scan.
+ * @param c    The chunk.
+ */
+static void
+scatter_chunk(scan_t *scan, size_t c)
+{
+	size_t *next = scan->counts + c * SCAN_PARTS;
+	for (size_t i = scan->starts[c]; i < scan->starts[c + 1]; ++i) {
+		if (scan->names[i].key)
+			scan->order[next[part_of(scan->names[i].hash)]++] = i;
+	}
+}
+
+/**
+ * @brief Deduplicate the names of a partition, and mark the records that
+ *        are the first with their names.
+ *
+ * The slot of each record is its entry in the partition for now.
+ *
+ * @param scan The scan.
+ * @param p    The partition.
+ */
+static void
+index_part(scan_t *scan, size_t p)
+{
+	dict_t *dict = scan->parts[p] = new_dict();
+	for (size_t k = p ? scan->ends[p - 1] : 0; k < scan->ends[p]; ++k) {
+		size_t i = scan->order[k], count = dict->count;
+		const entry_t *n = &scan->names[i];
+		scan->coff->slots[i] = dict_insert_hashed(dict, n->key, n->len, n->hash);
+		scan->first[i] = dict->count > count;
+	}
+}
+
+/**
+ * @brief Count the distinct names that first appear in a chunk.
+ *
+ * @param scan The scan.
+ * @param c    The chunk.
+ */
+static void
+count_chunk(scan_t *scan, size_t c)
+{
+	size_t n = 0;
+	for (size_t i = scan->starts[c]; i < scan->starts[c + 1]; ++i)
+		n += scan->first[i];
+	scan->bases[c] = n;
+}
+
+/**
+ * @brief Number the distinct names that first appear in a chunk, in the
+ *        order of the symbol table.
+ *
+ * @param scan The scan.
+ * @param c    The chunk.
+ */
+static void
+number_chunk(scan_t *scan, size_t c)
+{
+	size_t e = scan->bases[c];
+	for (size_t i = scan->starts[c]; i < scan->starts[c + 1]; ++i) {
+		if (scan->first[i])
+			scan->coff->slots[i] = e++;
+	}
+}
+
+/**
+ * @brief Move the names of a partition to the merged dictionary, and point
+ *        the records that are not the first with their names at them.
+ *
+ * @param scan The scan.
+ * @param p    The partition.
+ */
+static void
+merge_part(scan_t *scan, size_t p)
+{
+	const dict_t *part = scan->parts[p];
+	dict_t *dict = scan->coff->dict;
+	size_t *slots = scan->coff->slots, n = 0;
+	size_t *map = scan->maps[p] = malloc(part->count * sizeof(size_t) + 1);
+	if (!map)
+		error("Memory allocation failed.");
+	// The first record with a name comes before the others in a partition.
+	for (size_t k = p ? scan->ends[p - 1] : 0; k < scan->ends[p]; ++k) {
+		size_t i = scan->order[k];
+		if (!scan->first[i]) {
+			slots[i] = map[slots[i]];
+			continue;
+		}
+		const entry_t *e = &part->entries[n];
+		map[n++] = slots[i];
+		dict->entries[slots[i]] = (entry_t){ .hash = e->hash, .key = e->key, .len = e->len };
+	}
+}
+
+/**
+ * @brief Run a task of a parallel scan.
+ *
+ * @param arg The task.
+ */
+static void
+scan_task(void *arg)
+{
+	scan_task_t *t = arg;
+	scan_t *scan = t->scan;
+	if (setjmp(_buf)) {
+		pthread_mutex_lock(&scan->lock);
+		if (!scan->failed) {
+			__atomic_store_n(&scan->failed, true, __ATOMIC_RELAXED);
+			memcpy(scan->error, _errmsg, ERROR_MAX);
+		}
+		pthread_mutex_unlock(&scan->lock);
+		return;
+	}
+	if (__atomic_load_n(&scan->failed, __ATOMIC_RELAXED))
+		return;
+	t->fn(scan, t->i);
+}
+
+/**
+ * @brief Run a phase of a parallel scan, one task per chunk or partition.
+ *
+ * Without a pool, the tasks are run in order on this thread.
+ *
+ * @param scan The scan.
+ * @param n    Number of tasks.
+ * @param fn   What each task does.
+ */
+static void
+scan_phase(scan_t *scan, size_t n, void (*fn)(scan_t *scan, size_t i))
+{
+	if (!scan->pool) {
+		for (size_t i = 0; i < n; ++i)
+			fn(scan, i);
+		return;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		scan->tasks[i] = (scan_task_t){ scan, i, fn };
+		pool_submit(scan->pool, scan_task, &scan->tasks[i]);
+	}
+	pool_wait(scan->pool);
+	if (scan->failed)
+		error("%s", scan->error);
+}
+
+/**
+ * @brief Delete a parallel scan.
+ *
+ * @param scan The scan.
+ */
+static void
+del_scan(scan_t *scan)
+{
+	if (scan->pool)
+		del_pool(scan->pool);
+	for (int p = 0; p < SCAN_PARTS; ++p) {
+		if (scan->parts[p])
+			del_dict(scan->parts[p]);
+		free(scan->maps[p]);
+	}
+	free(scan->tasks);
+	free(scan->starts);
+	free(scan->names);
+	free(scan->counts);
+	free(scan->order);
+	free(scan->first);
+	free(scan->bases);
+	pthread_mutex_destroy(&scan->lock);
+	free(scan);
+}
+
+/**
+ * @brief Start a parallel scan of a file.
+ *
+ * @param coff   The COFF file.
+ * @param ntasks Largest number of tasks of a phase.
+ * @return The scan, without a pool.
+ */
+static scan_t *
+new_scan(coff_t *coff, size_t ntasks)
+{
+	scan_t *scan = calloc(1, sizeof(scan_t));
+	if (!scan)
+		error("Memory allocation failed.");
+	pthread_mutex_init(&scan->lock, NULL);
+	scan->coff  = coff;
+	scan->tasks = malloc(ntasks * sizeof(scan_task_t));
+	scan->bases = malloc(ntasks * sizeof(size_t));
+	if (!scan->tasks || !scan->bases) {
+		del_scan(scan);
+		error("Memory allocation failed.");
+	}
+	return scan;
+}
+
+/**
+ * @brief Index the symbol names of a large file on several threads, as
+ *        get_symbol_names() does.
+ *
+ * @param coff The COFF file, whose slots, attributes and relationships are
+ *             allocated.
+ */
+static void
+scan_symbols(coff_t *coff)
+{
+	size_t nsym = coff->nsym, nmax = nsym / SCAN_CHUNK + 2;
+	scan_t *scan = new_scan(coff, nmax + SCAN_PARTS);
+	// Release the scan before passing an error on.
+	jmp_buf outer;
+	memcpy(outer, _buf, sizeof(jmp_buf));
+	if (setjmp(_buf)) {
+		del_scan(scan);
+		memcpy(_buf, outer, sizeof(jmp_buf));
+		longjmp(_buf, 1);
+	}
+	scan->starts = malloc(nmax * sizeof(size_t));
+	scan->names  = calloc(nsym, sizeof(entry_t));
+	scan->counts = calloc(nmax * SCAN_PARTS, sizeof(size_t));
+	scan->order  = malloc(nsym * sizeof(DWORD));
+	scan->first  = calloc(nsym, 1);
+	if (!scan->starts || !scan->names || !scan->counts || !scan->order || !scan->first)
+		error("Memory allocation failed.");
+	// Split the table between symbol records, following the aux records
+	// along.
+	for (size_t i = 0, next = 0; i < nsym; ++i) {
+		if (i >= next) {
+			scan->starts[scan->nchunk++] = i;
+			next = i + SCAN_CHUNK;
+		}
+		if (coff->elf) {
+			i = next - 1;
+			continue;
+		}
+		PIMAGE_SYMBOL sym = symbol_at(coff, coff->symtab, i);
+		link_symbol(coff, i, sym);
+		i += symbol_aux(coff, sym);
+	}
+	scan->starts[scan->nchunk] = nsym;
+	scan->pool = new_pool(coff->jobs);
+	scan_phase(scan, scan->nchunk, hash_chunk);
+	size_t off = 0;
+	for (int p = 0; p < SCAN_PARTS; ++p) {
+		for (size_t c = 0; c < scan->nchunk; ++c) {
+			size_t n = scan->counts[c * SCAN_PARTS + p];
+			scan->counts[c * SCAN_PARTS + p] = off;
+			off += n;
+		}
+		scan->ends[p] = off;
+	}
+	scan_phase(scan, scan->nchunk, scatter_chunk);
+	scan_phase(scan, SCAN_PARTS, index_part);
+	scan_phase(scan, scan->nchunk, count_chunk);
+	size_t count = 0;
+	for (size_t c = 0; c < scan->nchunk; ++c) {
+		size_t n = scan->bases[c];
+		scan->bases[c] = count;
+		count += n;
+	}
+	scan_phase(scan, scan->nchunk, number_chunk);
+	coff->dict = new_dict_for(count);
+	coff->dict->count = count;
+	scan_phase(scan, SCAN_PARTS, merge_part);
+	dict_reindex(coff->dict);
+	memcpy(_buf, outer, sizeof(jmp_buf));
+	del_scan(scan);
+}
+
+/**
+ * @brief Retrieve all symbol names from a COFF file symbol table and store
+ *        them in a dictionary.
+ *
+ * Each distinct name is stored once, and `coff->slots` maps every symbol
+ * record to the entry of its name, so that duplicated names (e.g. section
+ * symbols of COMDAT sections) are rewritten consistently. Aux records map to
+ * DICT_NONE. The attributes the renaming rules key on are noted along, and
+ * so are the relationships told by the aux records of COFF files. Section
+ * names are added after all symbol names, and `coff->secslots` maps
+ * every section to the entry of its name.
+ *
+ * Symbol tables of at least SCAN_MIN records are indexed by scan_symbols()
+ * on `coff->jobs` threads, unless that is 1.
+ *
+ * This function allocates a dictionary object, the slots, the attributes and
+ * the relationships. The caller is responsible for deleting them.
+ * 
+ * @param coff The COFF file whose symbol table is to be indexed.
+ * @return Pointer to the dictionary containing the symbol names.
+ */
+static dict_t *
+get_symbol_names(coff_t *coff)
+{
+	dict_t *dict;
+	size_t *slots = coff->slots = malloc(coff->nsym * sizeof(size_t) + 1);
+	uint8_t *attrs = coff->attrs = calloc(coff->nsym + 1, 1);
+	if (!slots || !attrs)
+		error("Memory allocation failed.");
+	memset(slots, -1, coff->nsym * sizeof(size_t));
+	if (!coff->elf)
+		new_graph(coff);
+	if (coff->jobs != 1 && coff->nsym >= SCAN_MIN) {
+		scan_symbols(coff);
+		dict = coff->dict;
+	} else {
+		dict = coff->dict = new_dict();
+		// Traverse symbol table.
+		for (size_t i = 0; i < coff->nsym; ++i) {
+			size_t len;
+			const char *s;
+			if (coff->elf) {
+				int a;
+				s = elf_symbol(coff->elf, i, &len, &a);
+				attrs[i] = a;
+				slots[i] = dict_insert(dict, s, len);
+				continue;
+			}
+			PIMAGE_SYMBOL sym = symbol_at(coff, coff->symtab, i);
+			s = symbol_name(coff, sym, &len);
+			attrs[i] = symbol_attrs(coff, sym);
+			slots[i] = dict_insert(dict, s, len);
+			link_symbol(coff, i, sym);
+			i += symbol_aux(coff, sym);
+		}
+	}
+	coff->nsymname = dict->count;
+	// Traverse section headers.
+	size_t *secslots = coff->secslots = malloc(coff->nsec * sizeof(size_t) + 1);
+	if (!secslots)
+		error("Memory allocation failed.");
+	for (size_t i = 0; i < coff->nsec; ++i) {
+		size_t len;
+		const char *s;
+		if (coff->elf)
+			s = elf_section(coff->elf, i, &len);
+		else
+			s = section_name(coff, section_at(coff, coff->file, i), &len);
+		secslots[i] = dict_insert(dict, s, len);
+	}
+	return dict;
+}
+
+/**
+ * The index get_symbol_names() builds only depends on the file, so that it
+ * can be kept next to the file, in a sidecar named after it with '.smcidx'
+ * appended, and read back by later runs with other rules instead of hashing
+ * every name again. Keys are kept as offsets into the file, so the sidecar is
+ * only used if its size, modification time and digest are those recorded. The
+ * digest only covers what the index is read from: the headers and the symbol
+ * and string tables, not section contents, so that checking it costs far less
+ * than indexing. The sidecar is written by the same build of SMC that reads
+ * it, so the arrays are kept as they are in memory, and `word` tells sidecars
+ * written with another size_t or byte order apart.
+ *
+ * Sidecars only speed things up: one that cannot be written is not an
+ * error, and one that does not fit the file is rebuilt.
+ */
+
+#define SIDECAR_MAGIC "SMCIDX2" ///< Magic of a sidecar, with its null terminator.
+#define SIDECAR_PARTS 9         ///< Largest number of arrays following the entries.
+
+/**
+ * @brief Header of a symbol index sidecar.
+ */
+typedef struct {
+	char     magic[8];  ///< SIDECAR_MAGIC.
+	uint32_t word;      ///< sizeof(size_t) of the writer, as it stores it.
+	uint32_t elf;       ///< Whether the file is an ELF file.
+	uint64_t size;      ///< Size of the file.
+	int64_t  mtime;     ///< Modification time of the file.
+	digest_t file;      ///< Digest of the headers and tables of the file.
+	digest_t body;      ///< Digest of the entries and arrays that follow.
+	uint64_t nsym;      ///< Number of symbol records.
+	uint64_t nsec;      ///< Number of sections whose names are indexed.
+	uint64_t count;     ///< Number of dictionary entries.
+	uint64_t nsymname;  ///< Number of dictionary entries that are symbol names.
+	uint64_t size_bits; ///< The base-2 logarithm of the size of the dictionary.
+} sidecar_t;
+
+/**
+ * @brief An array of the index, as kept in a sidecar after the entries.
+ */
+typedef struct {
+	void  *p;     ///< The array.
+	size_t size;  ///< Size of the array in bytes.
+	size_t bound; ///< Bound of the size_t elements, or 0 for other arrays.
+	bool   none;  ///< Whether SIZE_MAX is an allowed element too.
+} part_t;
+
+/**
+ * @brief What a sidecar is written from, for save_atomic().
+ */
+typedef struct {
+	const sidecar_t *head;    ///< The header.
+	const size_t    *entries; ///< Hash, key offset and length of each entry.
+	const part_t    *parts;   ///< The arrays.
+	int              nparts;  ///< Number of arrays.
+} sidecar_src_t;
+
+/**
+ * @brief List the arrays of the index of a file, as allocated.
+ *
+ * @param coff  The COFF file.
+ * @param parts Receives the arrays.
+ * @return Number of arrays.
+ */
+static int
+index_parts(const coff_t *coff, part_t parts[SIDECAR_PARTS])
+{
+	const dict_t *dict = coff->dict;
+	const graph_t *g = &coff->graph;
+	size_t nsym = coff->nsym, nsec = coff->nsec + 1, w = sizeof(size_t);
+	int n = 0;
+	parts[n++] = (part_t){ dict->indices, ((size_t)1 << dict->size_bits) * w, dict->count, true };
+	parts[n++] = (part_t){ coff->slots, nsym * w, dict->count, true };
+	parts[n++] = (part_t){ coff->secslots, coff->nsec * w, dict->count, false };
+	parts[n++] = (part_t){ coff->attrs, nsym, 0, false };
+	if (coff->elf)
+		return n;
+	parts[n++] = (part_t){ g->weakdef, nsym * w, nsym, true };
+	parts[n++] = (part_t){ g->secsym, nsec * w, nsym, true };
+	parts[n++] = (part_t){ g->comdat, nsec * w, nsym, true };
+	parts[n++] = (part_t){ g->assoc, nsec * sizeof(DWORD), 0, false };
+	parts[n++] = (part_t){ g->select, nsec, 0, false };
+	return n;
+}
+
+/**
+ * @brief Free the index of a file, so that it can be built again.
+ *
+ * @param coff The COFF file.
+ */
+static void
+drop_index(coff_t *coff)
+{
+	graph_t *g = &coff->graph;
+	if (coff->dict)
+		del_dict(coff->dict);
+	free(coff->slots);
+	free(coff->secslots);
+	free(coff->attrs);
+	free(g->weakdef);
+	free(g->secsym);
+	free(g->comdat);
+	free(g->assoc);
+	free(g->select);
+	coff->dict  = NULL;
+	coff->slots = coff->secslots = NULL;
+	coff->attrs = NULL;
+	*g = (graph_t){ 0 };
+}
+
+/**
+ * @brief Digest the parts of a file that its index depends on.
+ *
+ * @param coff The COFF file, whose layout is validated.
+ * @param d    Receives the digest.
+ */
+static void
+digest_index(const coff_t *coff, digest_t *d)
+{
+	digest_init(d);
+	if (coff->elf) {
+		elf_digest(coff->elf, d);
+		return;
+	}
+	digest_update(d, coff->file, coff->secoff + coff->nsec * IMAGE_SIZEOF_SECTION_HEADER);
+	digest_update(d, coff->symtab, (size_t)coff->nsym * coff->symsize);
+	digest_update(d, coff->strtab, coff->strsize);
+}
+
+/**
+ * @brief Map a sidecar into memory.
+ *
+ * Where mmap() is not available, the sidecar is read instead.
+ *
+ * @param path Name of the sidecar.
+ * @param size Receives the size of the sidecar.
+ * @return The contents, or NULL if the sidecar cannot be read.
+ */
+static char *
+map_sidecar(const char *path, size_t *size)
+{
+#ifdef _WIN32
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+	char *buf;
+	*size = read_stream(fp, path, (void**)&buf);
+	fclose(fp);
+	return buf;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	void *p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		*size = st.st_size;
+		p = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	return p == MAP_FAILED ? NULL : p;
+#endif
+}
+
+/**
+ * @brief Release a sidecar from map_sidecar().
+ *
+ * @param p    The contents.
+ * @param size Size of the sidecar.
+ */
+static void
+unmap_sidecar(char *p, size_t size)
+{
+#ifdef _WIN32
+	(void)size;
+	free(p);
+#else
+	munmap(p, size);
+#endif
+}
+
+/**
+ * @brief Read the index of a file from its sidecar, if it has one that fits.
+ *
+ * @param coff The COFF file, whose layout is validated.
+ * @param name Name of the file.
+ * @param path Name of the sidecar.
+ * @return true if the index was read.
+ */
+static bool
+load_sidecar(coff_t *coff, const char *name, const char *path)
+{
+	struct stat st;
+	if (stat(name, &st) != 0 || (uint64_t)st.st_size != coff->size)
+		return false;
+	size_t size;
+	char *buf = map_sidecar(path, &size);
+	if (!buf)
+		return false;
+	sidecar_t head;
+	if (size < sizeof(head)) {
+		unmap_sidecar(buf, size);
+		return false;
+	}
+	memcpy(&head, buf, sizeof(head));
+	size_t w = sizeof(size_t), body = size - sizeof(head);
+	// The dictionary keeps a third of its slots empty, which lookups stop at.
+	if (memcmp(head.magic, SIDECAR_MAGIC, sizeof(head.magic)) != 0
+	 || head.word != w || head.elf != (coff->elf != NULL)
+	 || head.size != coff->size || head.mtime != (int64_t)st.st_mtime
+	 || head.nsym != coff->nsym || head.nsec != coff->nsec
+	 || head.size_bits >= 8 * w - 8 || ((size_t)1 << head.size_bits) > body / w
+	 || head.count > ((size_t)1 << head.size_bits) * 2 / 3 || head.nsymname > head.count) {
+		unmap_sidecar(buf, size);
+		return false;
+	}
+	// Allocate the index as get_symbol_names() does, then fill it in.
+	dict_t *dict = coff->dict = new_dict_sized(head.size_bits);
+	coff->slots    = malloc(coff->nsym * w + 1);
+	coff->attrs    = malloc(coff->nsym + 1);
+	coff->secslots = malloc(coff->nsec * w + 1);
+	if (!coff->slots || !coff->attrs || !coff->secslots) {
+		unmap_sidecar(buf, size);
+		error("Memory allocation failed.");
+	}
+	if (!coff->elf)
+		new_graph(coff);
+	dict->count    = head.count;
+	coff->nsymname = head.nsymname;
+	part_t parts[SIDECAR_PARTS];
+	int n = index_parts(coff, parts);
+	const char *p = buf + sizeof(head);
+	size_t need = dict->count * 3 * w;
+	for (int i = 0; i < n; ++i)
+		need += parts[i].size;
+	bool fits = need == body;
+	// Digest the entries and each array apart, as save_sidecar() does.
+	digest_t d;
+	digest_init(&d);
+	if (fits) {
+		size_t off = dict->count * 3 * w;
+		digest_update(&d, p, off);
+		for (int i = 0; i < n; off += parts[i++].size)
+			digest_update(&d, p + off, parts[i].size);
+		fits = memcmp(&d, &head.body, sizeof(d)) == 0;
+	}
+	if (fits) {
+		digest_index(coff, &d);
+		fits = memcmp(&d, &head.file, sizeof(d)) == 0;
+	}
+	const size_t *e = (const size_t*)p;
+	for (size_t i = 0; fits && i < dict->count; ++i, e += 3) {
+		fits = e[1] <= coff->size && e[2] <= coff->size - e[1];
+		dict->entries[i] = (entry_t){ .hash = e[0], .key = (const char*)coff->file + e[1], .len = e[2] };
+	}
+	p = (const char*)e;
+	for (int i = 0; fits && i < n; p += parts[i++].size) {
+		memcpy(parts[i].p, p, parts[i].size);
+		const size_t *v = parts[i].p;
+		for (size_t j = 0; parts[i].bound && j < parts[i].size / w; ++j)
+			fits &= v[j] < parts[i].bound || (parts[i].none && v[j] == SIZE_MAX);
+	}
+	unmap_sidecar(buf, size);
+	if (!fits)
+		drop_index(coff);
+	return fits;
+}
+
+/**
+ * @brief Write a sidecar for save_atomic().
+ *
+ * @param src The sidecar.
+ * @param out The output.
+ */
+static void
+emit_sidecar(const void *src, out_t *out)
+{
+	const sidecar_src_t *s = src;
+	out_write(out, s->head, sizeof(sidecar_t));
+	out_write(out, s->entries, s->head->count * 3 * sizeof(size_t));
+	for (int i = 0; i < s->nparts; ++i)
+		out_write(out, s->parts[i].p, s->parts[i].size);
+}
+
+/**
+ * @brief Keep the index of a file in its sidecar.
+ *
+ * @param coff The indexed COFF file.
+ * @param name Name of the file.
+ * @param path Name of the sidecar.
+ */
+static void
+save_sidecar(const coff_t *coff, const char *name, const char *path)
+{
+	struct stat st;
+	if (stat(name, &st) != 0 || (uint64_t)st.st_size != coff->size)
+		return;
+	const dict_t *dict = coff->dict;
+	sidecar_t head = {
+		.magic = SIDECAR_MAGIC, .word = sizeof(size_t), .elf = coff->elf != NULL,
+		.size = coff->size, .mtime = st.st_mtime, .nsym = coff->nsym, .nsec = coff->nsec,
+		.count = dict->count, .nsymname = coff->nsymname, .size_bits = dict->size_bits,
+	};
+	size_t *entries = malloc(dict->count * 3 * sizeof(size_t) + 1);
+	if (!entries)
+		error("Memory allocation failed.");
+	for (size_t i = 0; i < dict->count; ++i) {
+		const entry_t *e = &dict->entries[i];
+		entries[3 * i]     = e->hash;
+		entries[3 * i + 1] = e->key - (const char*)coff->file;
+		entries[3 * i + 2] = e->len;
+	}
+	part_t parts[SIDECAR_PARTS];
+	int n = index_parts(coff, parts);
+	digest_index(coff, &head.file);
+	digest_init(&head.body);
+	digest_update(&head.body, entries, dict->count * 3 * sizeof(size_t));
+	for (int i = 0; i < n; ++i)
+		digest_update(&head.body, parts[i].p, parts[i].size);
+	sidecar_src_t src = { &head, entries, parts, n };
+	save_atomic(path, emit_sidecar, &src);
+	free(entries);
+}
+
+/**
+ * @brief Index the symbol names of a file, through its sidecar if asked to.
+ *
+ * @param coff    The COFF file, whose layout is validated.
+ * @param name    Name of the file.
+ * @param sidecar Whether to read the index from the sidecar of the file, or
+ *                to write it there.
+ */
+static void
+index_symbols(coff_t *coff, const char *name, bool sidecar)
+{
+	char path[4096];
+	if (!sidecar || snprintf(path, sizeof(path), "%s.smcidx", name) >= (int)sizeof(path)) {
+		get_symbol_names(coff);
+		return;
+	}
+	if (!load_sidecar(coff, name, path)) {
+		get_symbol_names(coff);
+		save_sidecar(coff, name, path);
+	}
+}
+
+/**
+ * @brief Record a renaming rule.
+ *
+ * A later renaming of the same symbol replaces the earlier one.
+ *
+ * @param rules    Rules where the renaming is recorded.
+ * @param old      Pointer to the old symbol name, which need not be
+ *                 null-terminated.
+ * @param len      Length of the old symbol name.
+ * @param new      Pointer to the string containing the new symbol name.
+ * @param optional Whether the renaming may match no symbol, as with objcopy.
+ */
+static void
+change_symbol_name(rules_t *rules, const char *old, size_t len, const char *new, bool optional)
+{
+	size_t e = dict_insert(rules->renames, old, len);
+	rules->renames->entries[e].val = new;
+	if (e >= rules->noptional) {
+		size_t cap = rules->noptional ? rules->noptional * 2 : 64;
+		bool *p = realloc(rules->optional, cap * sizeof(bool));
+		if (!p)
+			error("Memory allocation failed.");
+		memset(p + rules->noptional, 0, (cap - rules->noptional) * sizeof(bool));
+		rules->optional  = p;
+		rules->noptional = cap;
+	}
+	rules->optional[e] = optional;
+}
+
+/**
+ * @brief Syntaxes of listfiles.
+ */
+enum {
+	LIST_PAIRS,    ///< 'old new' pairs separated by white space.
+	LIST_REDEFINE, ///< An 'old new' pair per line, as with 'objcopy --redefine-syms'.
+	LIST_LOCALIZE, ///< A name per line, as with 'objcopy --localize-symbols'.
+};
+
+/**
+ * @brief Read a file in the syntax of 'objcopy --redefine-syms' or
+ *        'objcopy --localize-symbols'.
+ *
+ * Each line holds one pair or name, and '#' starts a comment. The text is
+ * tokenized in place.
+ *
+ * @param rules    Rules where the renamings or names are recorded.
+ * @param text     Contents of the file.
+ * @param filename Name of the file, used in error messages.
+ * @param syntax   LIST_REDEFINE or LIST_LOCALIZE.
+ */
+static void
+read_objcopy_list(rules_t *rules, char *text, const char *filename, int syntax)
+{
+	int line = 1, maxtok = syntax == LIST_LOCALIZE ? 1 : 2;
+	for (char *p = text; *p; ++line) {
+		size_t n = strcspn(p, "\n#");
+		char *next = p + n;
+		if (*next == '#')
+			next += strcspn(next, "\n");
+		if (*next)
+			*next++ = '\0';
+		p[n] = '\0';
+		const char *tok[2];
+		size_t len[2];
+		int ntok = 0;
+		for (p += strspn(p, " \t\r"); *p; p += strspn(p, " \t\r")) {
+			if (ntok == maxtok)
+				error("Garbage at the end of line %d of '%s'.", line, filename);
+			tok[ntok] = p;
+			len[ntok] = strcspn(p, " \t\r");
+			p += len[ntok];
+			if (*p)
+				*p++ = '\0';
+			++ntok;
+		}
+		if (ntok == 1 && syntax == LIST_LOCALIZE)
+			dict_insert(rules->locals, tok[0], len[0]);
+		else if (ntok == 1)
+			error("Missing new name for symbol '%s' on line %d of '%s'.", tok[0], line, filename);
+		if (ntok == 2)
+			change_symbol_name(rules, tok[0], len[0], tok[1], true);
+		p = next;
+	}
+}
+
+/**
+ * @brief Read 'old new' pairs or names from a listfile.
+ *
+ * The listfile is tokenized in place and kept in memory, as the rules borrow
+ * their names from it. It is recorded along with its modification time, so
+ * that the daemon can tell when the rules are stale.
+ *
+ * @param rules    Rules where the renamings or names are recorded.
+ * @param filename Name of the listfile.
+ * @param syntax   One of LIST_*.
+ */
+static void
+read_listfile(rules_t *rules, const char *filename, int syntax)
+{
+	source_t *src = realloc(rules->sources, (rules->nsource + 1) * sizeof(source_t));
+	if (!src)
+		error("Memory allocation failed.");
+	rules->sources = src;
+	src = &src[rules->nsource++];
+	*src = (source_t){ .path = join_path(rules->dir, filename) };
+	struct stat st;
+	if (stat(src->path, &st) == 0) {
+		src->mtime = st.st_mtime;
+		src->size  = st.st_size;
+	}
+	char *text;
+	size_t size = read_file(src->path, (void**)&text);
+	// The contents stand for the name of the listfile in the digest, and
+	// their size tells where they end.
+	uint64_t nbytes = size;
+	digest_update(&rules->digest, &nbytes, sizeof(nbytes));
+	digest_update(&rules->digest, text, size);
+	src->text = text;
+	filename  = src->path;
+	if (syntax != LIST_PAIRS) {
+		read_objcopy_list(rules, text, filename, syntax);
+		return;
+	}
+	const char *tok[2];
+	size_t len[2];
+	int n = 0;
+	for (char *p = text; *p;) {
+		while (*p && strchr(" \t\r\n", *p))
+			*p++ = '\0';
+		if (!*p)
+			break;
+		tok[n] = p;
+		len[n] = strcspn(p, " \t\r\n");
+		p += len[n++];
+		if (n == 2) {
+			change_symbol_name(rules, tok[0], len[0], tok[1], false);
+			n = 0;
+		}
+	}
+	if (n)
+		error("Missing new name for symbol '%s' in '%s'.", tok[0], filename);
+}
+
+/**
+ * @brief Parse a '--transform' argument of the form kind[=N][,class...].
+ *
+ * @param rules Rules the transform is appended to.
+ * @param spec  The option argument, which must outlive the rules.
+ */
+static void
+add_transform(rules_t *rules, const char *spec)
+{
+	static const char *const kinds[] = {
+		[XF_STRIP_UNDERSCORE] = "strip-underscore",
+		[XF_ADD_UNDERSCORE]   = "add-underscore",
+		[XF_STDCALL]          = "stdcall",
+		[XF_FASTCALL]         = "fastcall",
+		[XF_UNDECORATE]       = "undecorate",
+	};
+	if (rules->nxform == MAX_XFORMS)
+		error("Too many transforms.");
+	xform_t *xf = &rules->xforms[rules->nxform++];
+	*xf = (xform_t){ .kind = -1 };
+	size_t len = strcspn(spec, "=,");
+	for (size_t k = 0; k < sizeof(kinds) / sizeof(*kinds); ++k)
+		if (strlen(kinds[k]) == len && strncmp(spec, kinds[k], len) == 0)
+			xf->kind = k;
+	if (xf->kind < 0)
+		error("Unknown transform '%.*s'.", (int)len, spec);
+	const char *p = spec + len;
+	if (*p == '=') {
+		xf->num    = ++p;
+		xf->numlen = strspn(p, "0123456789");
+		p += xf->numlen;
+		if (!xf->numlen || (*p && *p != ',')
+		 || (xf->kind != XF_STDCALL && xf->kind != XF_FASTCALL))
+			error("Invalid transform '%s'.", spec);
+	}
+	while (*p == ',') {
+		len = strcspn(++p, ",");
+		if (len == 8 && strncmp(p, "external", len) == 0)
+			xf->classes |= CLS_EXTERNAL;
+		else if (len == 6 && strncmp(p, "static", len) == 0)
+			xf->classes |= CLS_STATIC;
+		else if (len == 4 && strncmp(p, "weak", len) == 0)
+			xf->classes |= CLS_WEAK;
+		else
+			error("Unknown storage class '%.*s'.", (int)len, p);
+		p += len;
+	}
+	if (!xf->classes)
+		xf->classes = CLS_ALL;
+}
+
+/**
+ * @brief Match a long option taking an argument.
+ *
+ * Both '--name arg' and '--name=arg' are accepted.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments.
+ * @param i    Index of the current argument, advanced past a separate
+ *             option argument.
+ * @param name Name of the option without the leading '--'.
+ * @return The option argument, or NULL if argv[*i] is another option.
+ */
+const char *
+option_arg(int argc, char *argv[], int *i, const char *name)
+{
+	const char *arg = argv[*i] + 2;
+	size_t len = strlen(name);
+	if (strncmp(arg, name, len) != 0)
+		return NULL;
+	if (arg[len] == '=')
+		return arg + len + 1;
+	if (arg[len] != '\0')
+		return NULL;
+	if (++*i >= argc)
+		error("Option '--%s' requires an argument.", name);
+	return argv[*i];
+}
+
+/**
+ * @brief Parse a number of threads.
+ *
+ * @param arg The option argument.
+ * @return The number of threads, at least 1.
+ */
+int
+parse_jobs(const char *arg)
+{
+	char *end;
+	long jobs = strtol(arg, &end, 10);
+	if (*end || end == arg || jobs < 1 || jobs > 1024)
+		error("Invalid number of jobs '%s'.", arg);
+	return jobs;
+}
+
+/**
+ * @brief Parse a size in bytes.
+ *
+ * @param arg The option argument, a number that may end in K, M or G.
+ * @return The size.
+ */
+static size_t
+parse_size(const char *arg)
+{
+	static const char units[] = "KMG";
+	char *end;
+	unsigned long long size = strtoull(arg, &end, 10);
+	const char *unit = *end && !end[1] ? strchr(units, *end) : NULL;
+	int shift = unit ? 10 * (unit - units + 1) : 0;
+	end += unit != NULL;
+	if (*end || !isdigit((unsigned char)*arg) || size > (SIZE_MAX >> shift))
+		error("Invalid size '%s'.", arg);
+	return (size_t)size << shift;
+}
+
+/**
+ * @brief Record the renaming of a '--redefine-sym old=new' option.
+ *
+ * The old name is borrowed from the argument up to the '='.
+ *
+ * @param rules Rules where the renaming is recorded, or scratch rules.
+ * @param arg   The option argument.
+ */
+static void
+redefine_sym(rules_t *rules, const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+	if (!eq || eq == arg || !eq[1])
+		error("Invalid argument '%s' of '--redefine-sym'; expected 'old=new'.", arg);
+	if (rules->renames)
+		change_symbol_name(rules, arg, eq - arg, eq + 1, true);
+}
+
+/**
+ * @brief Record the renaming of a '--rename-section old=new' option.
+ *
+ * @param rules Rules where the renaming is recorded, or scratch rules.
+ * @param arg   The option argument.
+ */
+static void
+rename_section(rules_t *rules, const char *arg)
+{
+	const char *eq = strchr(arg, '=');
+	if (!eq || eq == arg || !eq[1])
+		error("Invalid argument '%s' of '--rename-section'; expected 'old=new'.", arg);
+	if (strchr(eq, ','))
+		error("Section flags of '--rename-section' are not supported.");
+	if (rules->sections)
+		rules->sections->entries[dict_insert(rules->sections, arg, eq - arg)].val = eq + 1;
+}
+
+/**
+ * @brief Options the rule digest leaves the arguments of out: those that
+ *        do not change what renaming writes, which are left out altogether,
+ *        and those naming a listfile, whose contents are digested instead
+ *        when it is read.
+ */
+static const struct {
+	const char *name; ///< The option, without '--'.
+	bool        list; ///< Whether its argument names a listfile.
+} undigested[] = {
+	{ "jobs", false },
+	{ "cache", false },
+	{ "cache-size", false },
+	{ "sidecar", false },
+	{ "stream", false },
+	{ "stream-buffer", false },
+	{ "dry-run", false },
+	{ "redefine-syms", true },
+	{ "localize-symbols", true },
+};
+
+/**
+ * @brief Digest an option along with its argument, if it changes what
+ *        renaming writes.
+ *
+ * @param rules Rules configured by the options.
+ * @param argv  Arguments.
+ * @param first Index of the option.
+ * @param last  Index of its argument, or of the option if it has none
+ *              or it is given as '--option=arg'.
+ */
+static void
+digest_option(rules_t *rules, char *argv[], int first, int last)
+{
+	const char *opt = argv[first] + 2;
+	for (size_t k = 0; k < sizeof(undigested) / sizeof(*undigested); ++k) {
+		size_t len = strlen(undigested[k].name);
+		if (strncmp(opt, undigested[k].name, len) != 0 || (opt[len] != '\0' && opt[len] != '='))
+			continue;
+		if (undigested[k].list) {
+			digest_update(&rules->digest, opt, len);
+			digest_update(&rules->digest, "", 1);
+		}
+		return;
+	}
+	for (int i = first; i <= last; ++i)
+		digest_update(&rules->digest, argv[i], strlen(argv[i]) + 1);
+}
+
+/**
+ * @brief Parse the options preceding infile.
+ *
+ * Options only record settings in the rules, and renamings only in rules
+ * that have a map of renamings. They may therefore be parsed into scratch
+ * rules to find where infile is.
+ *
+ * @param argc  Number of arguments.
+ * @param argv  Arguments.
+ * @param rules Rules configured by the options.
+ * @return Index of the first argument that is not an option.
+ */
+static int
+parse_options(int argc, char *argv[], rules_t *rules)
+{
+	int i;
+	for (i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; ++i) {
+		const char *arg;
+		int first = i;
+		if (argv[i][2] == '\0')
+			return i + 1;
+		else if ((arg = option_arg(argc, argv, &i, "prefix-defined")))
+			rules->prefix_defined = arg;
+		else if ((arg = option_arg(argc, argv, &i, "prefix-undefined")))
+			rules->prefix_undefined = arg;
+		else if ((arg = option_arg(argc, argv, &i, "transform")))
+			add_transform(rules, arg);
+		else if ((arg = option_arg(argc, argv, &i, "jobs")))
+			rules->jobs = parse_jobs(arg);
+		else if ((arg = option_arg(argc, argv, &i, "redefine-sym")))
+			redefine_sym(rules, arg);
+		else if ((arg = option_arg(argc, argv, &i, "rename-section")))
+			rename_section(rules, arg);
+		else if ((arg = option_arg(argc, argv, &i, "redefine-syms"))) {
+			if (rules->renames)
+				read_listfile(rules, arg, LIST_REDEFINE);
+		}
+		else if ((arg = option_arg(argc, argv, &i, "localize-symbols"))) {
+			if (rules->locals)
+				read_listfile(rules, arg, LIST_LOCALIZE);
+		}
+		else if ((arg = option_arg(argc, argv, &i, "localize-symbol"))) {
+			if (rules->locals)
+				dict_insert(rules->locals, arg, strlen(arg));
+		}
+		else if ((arg = option_arg(argc, argv, &i, "cache-size")))
+			rules->cache_size = parse_size(arg);
+		else if ((arg = option_arg(argc, argv, &i, "cache"))) {
+			if (rules->renames) {
+				free(rules->cache);
+				rules->cache = join_path(rules->dir, arg);
+			}
+		}
+		else if (strcmp(argv[i], "--demangle") == 0)
+			rules->demangle = true;
+		else if (strcmp(argv[i], "--codeview") == 0)
+			rules->codeview = true;
+		else if (strcmp(argv[i], "--weak-defaults") == 0)
+			rules->weak_defaults = true;
+		else if (strcmp(argv[i], "--strip-unreferenced") == 0)
+			rules->strip = true;
+		else if (strcmp(argv[i], "--allow-collisions") == 0)
+			rules->allow_collisions = true;
+		else if (strcmp(argv[i], "--follow-renames") == 0)
+			rules->follow = true;
+		else if (strcmp(argv[i], "--dry-run") == 0)
+			rules->dry_run = true;
+		else if (strcmp(argv[i], "--sidecar") == 0)
+			rules->sidecar = true;
+		else if ((arg = option_arg(argc, argv, &i, "stream-buffer"))) {
+			if (!(rules->stream_buffer = parse_size(arg)))
+				error("Invalid size '%s'.", arg);
+		}
+		else if (strcmp(argv[i], "--stream") == 0)
+			rules->stream = true;
+		else
+			error("Unknown option '%s'.", argv[i]);
+		digest_option(rules, argv, first, i);
+	}
+	return i;
+}
+
+/**
+ * @brief Find infile without compiling any rules.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments.
+ * @return Index of the first argument that is not an option.
+ */
+int
+skip_options(int argc, char *argv[])
+{
+	rules_t scratch = { 0 };
+	return parse_options(argc, argv, &scratch);
+}
+
+/**
+ * @brief Tell whether a file name is absolute.
+ *
+ * @param path The file name.
+ * @return true if the name does not depend on the working directory.
+ */
+bool
+is_absolute(const char *path)
+{
+#ifdef _WIN32
+	if (path[0] && path[1] == ':')
+		path += 2;
+	return path[0] == '/' || path[0] == '\\';
+#else
+	return path[0] == '/';
+#endif
+}
+
+/**
+ * @brief Resolve a file name against a directory.
+ *
+ * @param dir  The directory, or NULL for the working directory.
+ * @param path The file name.
+ * @return A newly allocated copy of the resolved name, which the caller is
+ *         responsible for freeing.
+ */
+char *
+join_path(const char *dir, const char *path)
+{
+	size_t dlen = dir && !is_absolute(path) ? strlen(dir) : 0;
+	size_t plen = strlen(path);
+	char *p = malloc(dlen + plen + 2);
+	if (!p)
+		error("Memory allocation failed.");
+	if (dlen) {
+		memcpy(p, dir, dlen);
+		p[dlen++] = '/';
+	}
+	memcpy(p + dlen, path, plen + 1);
+	return p;
+}
+
+/**
+ * @brief Create empty renaming rules.
+ *
+ * @param dir Directory relative listfiles are resolved against, or NULL for
+ *            the working directory. It must outlive the rules.
+ * @return A pointer to the newly created rules.
+ */
+rules_t *
+new_rules(const char *dir)
+{
+	rules_t *rules = malloc(sizeof(rules_t));
+	if (!rules)
+		error("Memory allocation failed.");
+	*rules = (rules_t){ .dir = dir, .cache_size = (size_t)1 << 30, .stream_buffer = (size_t)1 << 20 };
+	digest_init(&rules->digest);
+	digest_update(&rules->digest, CACHE_VERSION, sizeof(CACHE_VERSION));
+	rules->renames  = new_dict();
+	rules->sections = new_dict();
+	rules->locals   = new_dict();
+	return rules;
+}
+
+/**
+ * @brief Delete renaming rules along with the listfiles they were read from.
+ *
+ * This may be called on rules whose compilation failed.
+ *
+ * @param rules The rules to delete.
+ */
+void
+del_rules(rules_t *rules)
+{
+	del_dict(rules->renames);
+	del_dict(rules->sections);
+	del_dict(rules->locals);
+	free(rules->optional);
+	if (rules->demangler)
+		del_demangler(rules->demangler);
+	for (int i = 0; i < rules->nsource; ++i) {
+		free(rules->sources[i].path);
+		free(rules->sources[i].text);
+	}
+	free(rules->sources);
+	free(rules->cache);
+	free(rules);
+}
+
+/**
+ * @brief Resolve chains of renamings, so that 'a b' and 'b c' rename 'a' to
+ *        'c'.
+ *
+ * Each chain is walked once: the renamings along a walk are pointed to its
+ * end, and later walks stop at the first renaming already resolved.
+ *
+ * @param rules Rules with all their renamings recorded.
+ */
+static void
+follow_renames(rules_t *rules)
+{
+	dict_t *renames = rules->renames;
+	// 0: not visited yet, 1: on the current walk, 2: resolved.
+	uint8_t *state = calloc(renames->count + 1, 1);
+	size_t *walk = malloc(renames->count * sizeof(size_t) + 1);
+	if (!state || !walk) {
+		free(state);
+		free(walk);
+		error("Memory allocation failed.");
+	}
+	for (size_t r = 0; r < renames->count; ++r) {
+		if (state[r])
+			continue;
+		size_t n = 0, next = r;
+		const char *end;
+		for (;;) {
+			state[next] = 1;
+			walk[n++] = next;
+			end = renames->entries[next].val;
+			next = dict_find(renames, end, strlen(end));
+			if (next == DICT_NONE || next == walk[n - 1])
+				break; // End of the chain, or renamed to itself.
+			if (state[next] == 2) {
+				end = renames->entries[next].val;
+				break;
+			}
+			if (state[next] == 1) {
+				const entry_t *e = &renames->entries[next];
+				free(state);
+				free(walk);
+				error("Renaming cycle through symbol '%.*s'.", (int)e->len, e->key);
+			}
+		}
+		while (n) {
+			state[walk[--n]] = 2;
+			renames->entries[walk[n]].val = end;
+		}
+	}
+	free(state);
+	free(walk);
+}
+
+/**
+ * @brief Compile the 'old new' pairs and listfiles ending a command line.
+ *
+ * @param rules Rules the options have been parsed into.
+ * @param argc  Number of arguments.
+ * @param argv  Arguments, which must outlive the rules.
+ * @param first Index of the first pair or listfile.
+ */
+static void
+compile_pairs(rules_t *rules, int argc, char *argv[], int first)
+{
+	if (rules->demangle)
+		rules->demangler = new_demangler();
+	for (int i = first; i < argc;) {
+		if (argv[i][0] == '@') { // listfile
+			read_listfile(rules, argv[i] + 1, LIST_PAIRS);
+			digest_update(&rules->digest, "@", 2);
+			++i;
+		} else {
+			if (i + 1 == argc)
+				error("Missing new name for symbol '%s'.", argv[i]);
+			change_symbol_name(rules, argv[i], strlen(argv[i]), argv[i + 1], false);
+			digest_update(&rules->digest, argv[i], strlen(argv[i]) + 1);
+			digest_update(&rules->digest, argv[i + 1], strlen(argv[i + 1]) + 1);
+			i += 2;
+		}
+	}
+	if (rules->follow)
+		follow_renames(rules);
+}
+
+/**
+ * @brief Compile the options and all 'old new' pairs of a command line.
+ *
+ * @param rules Empty rules the command line is compiled into.
+ * @param argc  Number of arguments.
+ * @param argv  Arguments, which must outlive the rules.
+ * @return Index of infile; outfile follows it.
+ */
+int
+compile_rules(rules_t *rules, int argc, char *argv[])
+{
+	int arg = parse_options(argc, argv, rules);
+	if (argc - arg < 2)
+		error("Missing input or output file.");
+	compile_pairs(rules, argc, argv, arg + 2);
+	return arg;
+}
+
+/**
+ * @brief Compile the options and all 'old new' pairs of a command line
+ *        that names no files, as the files of a project are listed apart.
+ *
+ * @param rules Empty rules the command line is compiled into.
+ * @param argc  Number of arguments.
+ * @param argv  Arguments, which must outlive the rules.
+ */
+void
+compile_project_rules(rules_t *rules, int argc, char *argv[])
+{
+	compile_pairs(rules, argc, argv, parse_options(argc, argv, rules));
+}
+
+/**
+ * @brief Get the number of threads renaming archive members.
+ *
+ * @param rules The compiled rules.
+ * @return The number given by '--jobs', or 0 for one per CPU.
+ */
+int
+rules_jobs(const rules_t *rules)
+{
+	return rules->jobs;
+}
+
+/**
+ * @brief Get the number of renaming rules, which marks of hits are kept for.
+ *
+ * @param rules The compiled rules.
+ * @return The number of 'old new' pairs.
+ */
+size_t
+rules_count(const rules_t *rules)
+{
+	return rules->renames->count;
+}
+
+/**
+ * @brief Tell whether files are renamed without being written.
+ *
+ * @param rules The compiled rules.
+ * @return true if '--dry-run' was given.
+ */
+bool
+rules_dry_run(const rules_t *rules)
+{
+	return rules->dry_run;
+}
+
+/**
+ * @brief Tell whether symbol indexes are kept in sidecars.
+ *
+ * @param rules The compiled rules.
+ * @return true if '--sidecar' was given.
+ */
+bool
+rules_sidecar(const rules_t *rules)
+{
+	return rules->sidecar;
+}
+
+/**
+ * @brief Get the output cache of the rules.
+ *
+ * @param rules The compiled rules.
+ * @param size  Receives the size the cache is kept under.
+ * @return The directory of the cache, or NULL if '--cache' was not given.
+ */
+const char *
+rules_cache(const rules_t *rules, size_t *size)
+{
+	*size = rules->cache_size;
+	return rules->cache;
+}
+
+/**
+ * @brief Get the digest of the rules.
+ *
+ * @param rules The compiled rules.
+ * @return The digest, which tells apart rules that rename the same file
+ *         differently.
+ */
+const digest_t *
+rules_digest(const rules_t *rules)
+{
+	return &rules->digest;
+}
+
+/**
+ * @brief Report the first renaming rule that matched no symbol.
+ *
+ * Renamings given by '--redefine-sym' and '--redefine-syms' may match none.
+ *
+ * @param rules The compiled rules.
+ * @param hit   Marks of the rules that matched a symbol.
+ */
+void
+check_hits(const rules_t *rules, const bool *hit)
+{
+	for (size_t r = 0; r < rules->renames->count; ++r)
+		if (!hit[r] && !rules->optional[r])
+			error("Cannot find symbol '%.*s'.", (int)rules->renames->entries[r].len,
+			      rules->renames->entries[r].key);
+}
+
+/**
+ * @brief Tell whether any listfile has changed since the rules were compiled.
+ *
+ * @param rules The compiled rules.
+ * @return true if the rules must be compiled again.
+ */
+bool
+rules_stale(const rules_t *rules)
+{
+	for (int i = 0; i < rules->nsource; ++i) {
+		const source_t *src = &rules->sources[i];
+		struct stat st;
+		if (stat(src->path, &st) != 0
+		 || st.st_mtime != src->mtime || st.st_size != src->size)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Split the '__imp_' prefix and the '@N' suffix off a name.
+ *
+ * @param n The name, which must not have been transformed yet.
+ * @return false if the name is not a C identifier and must be left alone,
+ *         e.g. MSVC C++ names or labels.
+ */
+static bool
+split_decoration(name_t *n)
+{
+	if (n->len > 6 && memcmp(n->name, "__imp_", 6) == 0) {
+		n->imp   = true;
+		n->name += 6;
+		n->len  -= 6;
+	}
+	if (!n->len || !strchr("_@ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz", n->name[0]))
+		return false;
+	size_t d = n->len;
+	while (d > 0 && n->name[d - 1] >= '0' && n->name[d - 1] <= '9')
+		--d;
+	if (d > 1 && d < n->len && n->name[d - 1] == '@') {
+		n->num    = n->name + d;
+		n->numlen = n->len - d;
+		n->len    = d - 1;
+	}
+	return true;
+}
+
+/**
+ * @brief Apply a decoration transform to a name in place.
+ *
+ * @param n    The name, already split by split_decoration().
+ * @param xf   The transform.
+ * @param func Whether the symbol is a function, which alone gets '@N'.
+ * @param key  The original name, for error messages.
+ */
+static void
+apply_transform(name_t *n, const xform_t *xf, bool func, const entry_t *key)
+{
+	switch (xf->kind) {
+	case XF_STRIP_UNDERSCORE:
+		if (n->nlead && n->lead[0] == '_')
+			memmove(n->lead, n->lead + 1, --n->nlead);
+		else if (!n->nlead && n->len > 1 && n->name[0] == '_')
+			++n->name, --n->len;
+		break;
+	case XF_ADD_UNDERSCORE:
+		if (n->nlead == sizeof(n->lead))
+			error("Too many underscores added to '%.*s'.", (int)key->len, key->key);
+		memmove(n->lead + 1, n->lead, n->nlead++);
+		n->lead[0] = '_';
+		break;
+	default: // XF_STDCALL, XF_FASTCALL, XF_UNDECORATE
+		// Drop the leading decoration character, if any.
+		if (n->nlead)
+			n->nlead = 0;
+		else if (n->len > 1 && (n->name[0] == '_' || (n->name[0] == '@' && n->num)))
+			++n->name, --n->len;
+		if (xf->kind == XF_UNDECORATE || !func) {
+			n->num = NULL;
+			if (xf->kind != XF_UNDECORATE) // Data is decorated as cdecl.
+				n->lead[n->nlead++] = '_';
+			break;
+		}
+		n->lead[n->nlead++] = xf->kind == XF_STDCALL ? '_' : '@';
+		if (xf->num) {
+			n->num    = xf->num;
+			n->numlen = xf->numlen;
+		} else if (!n->num) {
+			error("Cannot decorate '%.*s' without an argument size.",
+			      (int)key->len, key->key);
+		}
+		break;
+	}
+}
+
+/**
+ * @brief Get the length of a name as it is written out.
+ *
+ * @param n The name.
+ * @return Length of the name, excluding the null terminator.
+ */
+static inline size_t
+name_length(const name_t *n)
+{
+	return n->plen + (n->imp ? 6 : 0) + n->nlead + n->len + (n->num ? n->numlen + 1 : 0);
+}
+
+/**
+ * @brief Write out a name, straight from the slices it is made of.
+ *
+ * @param dst Destination with room for name_length() bytes.
+ * @param n   The name.
+ */
+static void
+emit_name(char *dst, const name_t *n)
+{
+	memcpy(dst, n->prefix, n->plen);
+	dst += n->plen;
+	if (n->imp) {
+		memcpy(dst, "__imp_", 6);
+		dst += 6;
+	}
+	memcpy(dst, n->lead, n->nlead);
+	dst += n->nlead;
+	memcpy(dst, n->name, n->len);
+	dst += n->len;
+	if (n->num) {
+		*dst++ = '@';
+		memcpy(dst, n->num, n->numlen);
+	}
+}
+
+/**
+ * @brief Tell whether a name is written out as given, without writing it out.
+ *
+ * @param n   The name.
+ * @param s   The string to compare with, which need not be null-terminated.
+ * @param len Length of the string.
+ * @return true if the name is written out as the string.
+ */
+static bool
+name_equals(const name_t *n, const char *s, size_t len)
+{
+	if (name_length(n) != len)
+		return false;
+	const char *slices[] = { n->prefix, n->imp ? "__imp_" : "", n->lead, n->name, n->num ? "@" : "", n->num };
+	size_t lengths[] = { n->plen, n->imp ? 6 : 0, n->nlead, n->len, n->num ? 1 : 0, n->num ? n->numlen : 0 };
+	for (size_t i = 0; i < sizeof(slices) / sizeof(*slices); ++i) {
+		if (lengths[i] && memcmp(s, slices[i], lengths[i]))
+			return false;
+		s += lengths[i];
+	}
+	return true;
+}
+
+/**
+ * @brief Give a name the new name of an explicit renaming.
+ *
+ * @param n   The name.
+ * @param new The new name from the rule.
+ */
+static inline void
+rename_entry(name_t *n, const char *new)
+{
+	n->name    = new;
+	n->len     = strlen(new);
+	n->renamed = true;
+}
+
+/**
+ * @brief Mark a renaming rule as matched.
+ *
+ * Members of an archive are renamed concurrently and share the array.
+ *
+ * @param hit Matched rules.
+ * @param r   Index of the rule.
+ */
+static inline void
+mark_hit(bool *hit, size_t r)
+{
+	__atomic_store_n(&hit[r], true, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Carry the renaming of a weak external over to its default.
+ *
+ * GNU tools name the default of a weak external 'foo' '.weak.foo.default.*';
+ * the 'foo' in there is replaced by the new name. A default renamed by a rule
+ * of its own, or named otherwise, is left alone.
+ *
+ * @param coff  The indexed COFF file.
+ * @param names New names of the dictionary entries.
+ * @param weak  Index of the weak external.
+ * @param def   Index of its default.
+ */
+static void
+rename_default(const coff_t *coff, name_t *names, size_t weak, size_t def)
+{
+	const entry_t *wkey = &coff->dict->entries[coff->slots[weak]];
+	const entry_t *dkey = &coff->dict->entries[coff->slots[def]];
+	name_t *w = &names[coff->slots[weak]], *d = &names[coff->slots[def]];
+	if (d->renamed || w == d || name_equals(w, wkey->key, wkey->len)
+	 || dkey->len <= 7 + wkey->len || memcmp(dkey->key, ".weak.", 6) != 0
+	 || memcmp(dkey->key + 6, wkey->key, wkey->len) != 0 || dkey->key[6 + wkey->len] != '.')
+		return;
+	size_t wlen = name_length(w), len = dkey->len - wkey->len + wlen;
+	char *s = arena_alloc(coff->arena, len + 1);
+	memcpy(s, ".weak.", 6);
+	emit_name(s + 6, w);
+	memcpy(s + 6 + wlen, dkey->key + 6 + wkey->len, dkey->len - 6 - wkey->len);
+	s[len] = '\0';
+	*d = (name_t){ .prefix = "", .name = s, .len = len, .renamed = true };
+}
+
+/**
+ * @brief Tell whether a symbol of a COFF file is made static.
+ *
+ * Only external symbols defined in the file are, as a static symbol cannot
+ * be undefined or common.
+ *
+ * @param coff  The indexed COFF file.
+ * @param names The new name of each dictionary entry.
+ * @param i     Index of a symbol record other than an aux record.
+ * @return true if the symbol is named by a '--localize-symbol' rule.
+ */
+static bool
+is_localized(const coff_t *coff, const name_t *names, size_t i)
+{
+	PIMAGE_SYMBOL sym = symbol_at(coff, coff->symtab, i);
+	return !coff->elf && names[coff->slots[i]].local
+	    && symbol_storage(coff, sym) == IMAGE_SYM_CLASS_EXTERNAL && symbol_section(coff, sym) != 0;
+}
+
+/**
+ * @brief Decide the new name of every unique symbol name in one pass over
+ *        the symbol table.
+ *
+ * An explicit renaming takes precedence over transforms and prefixes.
+ * Decoration transforms are applied before the prefix, which is not given
+ * to symbols made static. Section renamings apply to section names, and so
+ * to COFF section symbols. With '--weak-defaults', the defaults of weak
+ * externals follow them last.
+ *
+ * @param coff  The indexed COFF file.
+ * @param rules Renaming rules to apply.
+ * @param names Receives the new name of each dictionary entry.
+ * @param hit   Marks the renaming rules that match a symbol.
+ */
+static void
+rename_symbols(const coff_t *coff, const rules_t *rules, name_t *names, bool *hit)
+{
+	dict_t *dict = coff->dict;
+	for (size_t e = 0; e < dict->count; ++e) {
+		entry_t *entry = &dict->entries[e];
+		names[e] = (name_t){ .prefix = "", .name = entry->key, .len = entry->len };
+	}
+	// Apply explicit renamings, matching raw names first.
+	dict_t *renames = rules->renames;
+	for (size_t r = 0; r < renames->count; ++r) {
+		entry_t *rule = &renames->entries[r];
+		size_t e = dict_find(dict, rule->key, rule->len);
+		if (e < coff->nsymname) {
+			rename_entry(&names[e], rule->val);
+			mark_hit(hit, r);
+		}
+	}
+	if (rules->demangler && renames->count) {
+		// Each distinct name is demangled at most once per run.
+		for (size_t e = 0; e < coff->nsymname; ++e) {
+			if (names[e].renamed)
+				continue;
+			size_t dlen;
+			const char *dem = demangle_cached(rules->demangler, dict->entries[e].key,
+			                                  dict->entries[e].len, &dlen);
+			size_t r = dem ? dict_find(renames, dem, dlen) : DICT_NONE;
+			if (r != DICT_NONE) {
+				rename_entry(&names[e], renames->entries[r].val);
+				mark_hit(hit, r);
+			}
+		}
+	}
+	// Rename sections, along with the symbols of the same name.
+	dict_t *sections = rules->sections;
+	for (size_t s = 0; s < coff->nsec && sections->count; ++s) {
+		size_t e = coff->secslots[s];
+		size_t r = dict_find(sections, dict->entries[e].key, dict->entries[e].len);
+		if (r != DICT_NONE)
+			rename_entry(&names[e], sections->entries[r].val);
+	}
+	// Mark the names of symbols to make static, by their original names.
+	dict_t *locals = rules->locals;
+	for (size_t r = 0; r < locals->count; ++r) {
+		size_t e = dict_find(dict, locals->entries[r].key, locals->entries[r].len);
+		if (e < coff->nsymname)
+			names[e].local = true;
+	}
+	// Transform and prefix symbols, keyed on their attributes.
+	if (rules->nxform || rules->prefix_defined || rules->prefix_undefined) {
+		for (size_t i = 0; i < coff->nsym; ++i) {
+			int attrs = coff->attrs[i], cls = attrs & CLS_ALL;
+			if (!cls)
+				continue;
+			size_t e = coff->slots[i];
+			name_t *n = &names[e];
+			if (n->renamed)
+				continue;
+			if (rules->nxform && !n->parsed) {
+				n->parsed = true;
+				if (split_decoration(n))
+					for (int x = 0; x < rules->nxform; ++x)
+						if (rules->xforms[x].classes & cls)
+							apply_transform(n, &rules->xforms[x], attrs & SYM_FUNCTION,
+							                &dict->entries[e]);
+			}
+			if (cls != CLS_EXTERNAL || is_localized(coff, names, i))
+				continue;
+			const char *prefix = attrs & SYM_DEFINED ? rules->prefix_defined : rules->prefix_undefined;
+			if (prefix) {
+				n->prefix = prefix;
+				n->plen   = strlen(prefix);
+			}
+		}
+	}
+	if (rules->weak_defaults && coff->graph.weakdef)
+		for (size_t i = 0; i < coff->nsym; ++i)
+			if (coff->graph.weakdef[i] != SIZE_MAX)
+				rename_default(coff, names, i, coff->graph.weakdef[i]);
+}
+
+/**
+ * @brief Point a section header to the new name of its section.
+ *
+ * @param sec The section header.
+ * @param n   The name, with its offset into the new string table.
+ */
+static void
+set_section_name(PIMAGE_SECTION_HEADER sec, const name_t *n)
+{
+	char *dst = (char*)sec->Name;
+	memset(dst, 0, IMAGE_SIZEOF_SHORT_NAME);
+	if (!n->offset) {
+		emit_name(dst, n);
+	} else if (n->offset <= 9999999) {
+		char num[IMAGE_SIZEOF_SHORT_NAME + 1];
+		memcpy(dst, num, sprintf(num, "/%lu", (unsigned long)n->offset));
+	} else {
+		uint64_t off = n->offset;
+		dst[0] = dst[1] = '/';
+		for (int i = IMAGE_SIZEOF_SHORT_NAME - 1; i >= 2; --i, off /= 64)
+			dst[i] = base64[off % 64];
+		if (off)
+			error("String table too large for section names.");
+	}
+}
+
+/**
+ * @brief Linker directives that name symbols, in lower case.
+ *
+ * '/EXPORT:name[=internal][,...]' and '/ALTERNATENAME:name=default' name
+ * two symbols, '/INCLUDE:name' one.
+ */
+static const char *const directives[] = { "export:", "alternatename:", "include:" };
+
+/**
+ * @brief Append a symbol name of a linker directive, renamed if its symbol
+ *        is.
+ *
+ * @param out    The new directives.
+ * @param coff   The renamed COFF file.
+ * @param s      The name as written in the directive, without quotes.
+ * @param len    Length of the name.
+ * @param quoted Whether the name is within quotes.
+ */
+static void
+rename_directive_name(buf_t *out, const coff_t *coff, const char *s, size_t len, bool quoted)
+{
+	size_t e = dict_find(coff->dict, s, len);
+	if (e >= coff->nsymname || !coff->names[e].changed) {
+		buf_ncat(out, s, len);
+		return;
+	}
+	size_t nlen = name_length(&coff->names[e]);
+	buf_reserve(out, (out->cnt + nlen + 2) * 2);
+	char *dst = (char*)out->buf + out->cnt;
+	emit_name(dst + 1, &coff->names[e]);
+	// Quote a new name that would otherwise end early.
+	bool bare = true;
+	for (size_t i = 1; i <= nlen && bare; ++i)
+		bare = !strchr(" \t\r\n,=", dst[i]);
+	if (!quoted && !bare) {
+		dst[0] = dst[nlen + 1] = '"';
+		out->cnt += nlen + 2;
+	} else {
+		memmove(dst, dst + 1, nlen);
+		out->cnt += nlen;
+	}
+}
+
+/**
+ * @brief Rewrite the linker directives of a section with the new symbol
+ *        names.
+ *
+ * Directives are separated by white space and may be quoted as a whole or
+ * in part, e.g. '/EXPORT:foo,DATA' or '-export:"foo"'. Only the symbol names
+ * are rewritten; everything else is copied as it is.
+ *
+ * @param coff The renamed COFF file.
+ * @param text The directives.
+ * @param size Size of the directives.
+ * @param out  Receives the new directives.
+ */
+static void
+rename_directives(const coff_t *coff, const char *text, size_t size, buf_t *out)
+{
+	const char *p = text, *end = text + size;
+	if (size >= 3 && memcmp(p, "\xef\xbb\xbf", 3) == 0) // UTF-8 BOM
+		p += 3;
+	buf_ncat(out, text, p - text);
+	while (p < end) {
+		// Copy the white space between directives, including null bytes.
+		const char *q = p;
+		while (q < end && strchr(" \t\r\n", *q))
+			++q;
+		buf_ncat(out, p, q - p);
+		if ((p = q) == end)
+			break;
+		bool quoted = *p == '"';
+		q = p + quoted;
+		size_t d, nname = 0;
+		if (q < end && (*q == '/' || *q == '-'))
+			for (d = 0, ++q; d < sizeof(directives) / sizeof(*directives); ++d) {
+				size_t len = strlen(directives[d]), k = 0;
+				while (k < len && q + k < end && tolower((unsigned char)q[k]) == directives[d][k])
+					++k;
+				if (k == len) {
+					nname = d < 2 ? 2 : 1;
+					q += len;
+					break;
+				}
+			}
+		if (!nname) {
+			q = p;
+			quoted = false;
+		}
+		buf_ncat(out, p, q - p);
+		// Rewrite the names, separated by '='.
+		for (size_t i = 0; i < nname && q < end; ++i) {
+			if (i) {
+				if (*q != '=')
+					break;
+				buf_ncat(out, q++, 1);
+			}
+			bool inner = *q == '"';
+			if (inner) {
+				buf_ncat(out, q++, 1);
+				quoted = !quoted;
+			}
+			const char *name = q;
+			while (q < end && *q && !strchr(quoted ? ",=\"" : " \t\r\n,=\"", *q))
+				++q;
+			rename_directive_name(out, coff, name, q - name, quoted);
+			if (inner && q < end && *q == '"') {
+				buf_ncat(out, q++, 1);
+				quoted = !quoted;
+			}
+		}
+		// Copy the rest of the directive.
+		for (p = q; q < end && *q && (quoted || !strchr(" \t\r\n", *q)); ++q)
+			if (*q == '"')
+				quoted = !quoted;
+		buf_ncat(out, p, q - p);
+		p = q;
+	}
+}
+
+/**
+ * @brief Add new contents to a renamed COFF file.
+ *
+ * @param coff   The renamed COFF file.
+ * @param off    Offset of the old contents.
+ * @param size   Size of the old contents.
+ * @param sec    Index of the section the contents belong to.
+ * @param relocs Whether the contents are the relocations of the section.
+ * @return The new contents, empty and owned by the file.
+ */
+static content_t *
+new_content(coff_t *coff, DWORD off, DWORD size, size_t sec, bool relocs)
+{
+	if (off > coff->size || size > coff->size - off)
+		error("Invalid section contents.");
+	content_t *c = realloc(coff->contents, (coff->ncontent + 1) * sizeof(content_t));
+	if (!c)
+		error("Memory allocation failed.");
+	coff->contents = c;
+	c += coff->ncontent;
+	*c = (content_t){ .off = off, .size = size, .sec = sec, .relocs = relocs, .data = new_buf() };
+	++coff->ncontent;
+	return c;
+}
+
+/**
+ * @brief Read part of a streamed file.
+ *
+ * @param coff The streamed COFF file.
+ * @param dst  Receives the bytes.
+ * @param off  Offset of the bytes in the file.
+ * @param size Number of bytes to read.
+ */
+static void
+read_at(const coff_t *coff, void *dst, uint64_t off, size_t size)
+{
+	if (fseeko(coff->in, off, SEEK_SET) != 0 || fread(dst, 1, size, coff->in) != size)
+		error("Read file '%s' failed.", coff->path);
+}
+
+/**
+ * @brief Get the original contents of part of a COFF file.
+ *
+ * Parts of a streamed file before its symbol table are read on demand, into
+ * a buffer that the next call reuses.
+ *
+ * @param coff The COFF file.
+ * @param off  Offset of the contents.
+ * @param size Size of the contents.
+ * @return The contents.
+ */
+static const char *
+file_part(coff_t *coff, DWORD off, size_t size)
+{
+	if (off > coff->size || size > coff->size - off)
+		error("Invalid section contents.");
+	if (!coff->in)
+		return (const char*)coff->file + off;
+	if (off >= coff->symoff)
+		return coff->tables + (off - coff->symoff);
+	if (!coff->part)
+		coff->part = new_buf();
+	buf_reserve(coff->part, size);
+	read_at(coff, coff->part->buf, off, size);
+	return coff->part->buf;
+}
+
+/**
+ * @brief Drop the contents last added to a renamed COFF file.
+ *
+ * @param coff The renamed COFF file.
+ */
+static void
+drop_content(coff_t *coff)
+{
+	del_buf(coff->contents[--coff->ncontent].data);
+}
+
+/**
+ * @brief Rewrite the '.drectve' sections of a renamed COFF file.
+ *
+ * A section that shrinks is padded with spaces to its old size; one that
+ * grows is padded to a multiple of 4 bytes more, so that what follows stays
+ * aligned.
+ * layout_coff() makes the section definition record tell the new size.
+ *
+ * @param coff The renamed COFF file.
+ */
+static void
+build_directives(coff_t *coff)
+{
+	for (size_t s = 0; s < coff->nsec; ++s) {
+		PIMAGE_SECTION_HEADER sec = section_at(coff, coff->file, s);
+		const entry_t *name = &coff->dict->entries[coff->secslots[s]];
+		if (!(sec->Characteristics & IMAGE_SCN_LNK_INFO) || !sec->SizeOfRawData
+		 || name->len != 8 || memcmp(name->key, ".drectve", 8) != 0)
+			continue;
+		buf_t *out = new_content(coff, sec->PointerToRawData, sec->SizeOfRawData, s, false)->data;
+		const char *text = file_part(coff, sec->PointerToRawData, sec->SizeOfRawData);
+		rename_directives(coff, text, sec->SizeOfRawData, out);
+		if (out->cnt == sec->SizeOfRawData && memcmp(out->buf, text, out->cnt) == 0) {
+			drop_content(coff);
+			continue;
+		}
+		size_t size = sec->SizeOfRawData;
+		if (out->cnt > size)
+			size += (out->cnt - size + 3) & ~(size_t)3;
+		while (out->cnt < size)
+			buf_ncat(out, " ", 1);
+	}
+}
+
+/**
+ * @brief CodeView constants.
+ */
+enum {
+	CV_SIGNATURE_C13 = 4,          ///< Signature of '.debug$S' sections.
+	DEBUG_S_SYMBOLS  = 0xf1,       ///< Subsection of symbol records.
+	S_LDATA32        = 0x110c,
+	S_GDATA32        = 0x110d,
+	S_PUB32          = 0x110e,
+	S_LPROC32        = 0x110f,
+	S_GPROC32        = 0x1110,
+	S_LTHREAD32      = 0x1112,
+	S_GTHREAD32      = 0x1113,
+	S_LPROC32_ID     = 0x1146,
+	S_GPROC32_ID     = 0x1147,
+};
+
+/**
+ * @brief A place where a CodeView section being rewritten moved.
+ */
+typedef struct {
+	DWORD   pos;   ///< Offset in the old section of the name that changed.
+	int64_t shift; ///< How far everything after it moved.
+} move_t;
+
+/**
+ * @brief Get the offset of the name of a CodeView symbol record.
+ *
+ * @param type Type of the record.
+ * @return Offset of the name from the start of the record, including its
+ *         length, or 0 if the record has no name renamed along with symbols.
+ */
+static size_t
+codeview_name_offset(WORD type)
+{
+	switch (type) {
+	case S_LDATA32: case S_GDATA32: case S_PUB32: case S_LTHREAD32: case S_GTHREAD32:
+		return 14; // Type index or flags, offset, segment.
+	case S_LPROC32: case S_GPROC32: case S_LPROC32_ID: case S_GPROC32_ID:
+		return 39; // Parent, end, next, length, debug start and end, type
+		           // index, offset, segment, flags.
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief Get the name CodeView gives a symbol.
+ *
+ * On x86 C names are recorded without their decoration, e.g. 'foo' for
+ * '_foo', '_foo@8' or '@foo@8'.
+ *
+ * @param s    The symbol name.
+ * @param len  Length of the symbol name.
+ * @param x86  Whether the file is for x86.
+ * @param skip Receives the number of leading characters to skip.
+ * @return Length of the name after the skipped characters.
+ */
+static size_t
+codeview_name(const char *s, size_t len, bool x86, size_t *skip)
+{
+	*skip = 0;
+	if (!x86 || len < 2 || (s[0] != '_' && s[0] != '@'))
+		return len;
+	size_t d = len;
+	while (d > 1 && s[d - 1] >= '0' && s[d - 1] <= '9')
+		--d;
+	bool num = d > 2 && d < len && s[d - 1] == '@';
+	if (s[0] == '@' && !num)
+		return len;
+	*skip = 1;
+	return (num ? d - 1 : len) - 1;
+}
+
+/**
+ * @brief Rewrite the names of the symbol records of a '.debug$S' section.
+ *
+ * Records are copied as they are, save for the name and length of those
+ * that name a renamed symbol. A record keeps its size modulo 4, padded with
+ * zero bytes after the name, so that the alignment of what follows is kept.
+ * Where the section moved is noted in `coff->moves`.
+ *
+ * @param coff The renamed COFF file.
+ * @param x86  Whether the file is for x86.
+ * @param data The section contents.
+ * @param size Size of the section contents.
+ * @param out  Receives the new contents.
+ */
+static void
+rename_codeview(coff_t *coff, bool x86, const char *data, size_t size, buf_t *out)
+{
+	DWORD sig = 0;
+	if (size >= 4)
+		memcpy(&sig, data, 4);
+	if (sig != CV_SIGNATURE_C13) {
+		buf_ncat(out, data, size);
+		return;
+	}
+	int64_t shift = 0;
+	size_t pos = 4;
+	buf_ncat(out, data, pos);
+	while (pos < size) {
+		DWORD head[2]; // Type and length.
+		if (size - pos < sizeof(head))
+			error("Invalid CodeView debug information.");
+		memcpy(head, data + pos, sizeof(head));
+		size_t start = pos + sizeof(head), end = start + head[1];
+		if (head[1] > size - start)
+			error("Invalid CodeView debug information.");
+		size_t sub = buf_ncat(out, data + pos, sizeof(head));
+		if (head[0] != DEBUG_S_SYMBOLS) {
+			buf_ncat(out, data + start, head[1]);
+		} else {
+			for (size_t r = start; r < end;) {
+				WORD rec[2]; // Length and type.
+				if (end - r < sizeof(rec))
+					error("Invalid CodeView debug information.");
+				memcpy(rec, data + r, sizeof(rec));
+				size_t rend = r + 2 + rec[0], noff = codeview_name_offset(rec[1]);
+				if (rec[0] < 2 || rend > end)
+					error("Invalid CodeView debug information.");
+				const char *name = data + r + noff;
+				size_t nlen = noff && noff < rend - r ? strnlen(name, rend - r - noff) : 0;
+				size_t c = nlen ? dict_find(coff->cvdict, name, nlen) : DICT_NONE;
+				if (c == DICT_NONE) {
+					buf_ncat(out, data + r, rend - r);
+					r = rend;
+					continue;
+				}
+				// Write the record with the new name.
+				size_t rec0 = buf_ncat(out, data + r, noff);
+				const name_t *n = &coff->names[coff->cvslots[c]];
+				size_t len = name_length(n), skip;
+				buf_reserve(out, (out->cnt + len + 8) * 2);
+				char *dst = (char*)out->buf + out->cnt;
+				emit_name(dst, n);
+				len = codeview_name(dst, len, x86, &skip);
+				memmove(dst, dst + skip, len);
+				dst[len] = '\0';
+				out->cnt += len + 1;
+				const char *tail = name + nlen + (nlen < rend - r - noff);
+				buf_ncat(out, tail, data + rend - tail);
+				while ((out->cnt - rec0) % 4 != (rend - r) % 4)
+					buf_ncat(out, "", 1);
+				size_t reclen = out->cnt - rec0 - 2;
+				if (reclen > 0xffff)
+					error("CodeView record for '%.*s' too long.", (int)nlen, name);
+				WORD w = reclen;
+				memcpy((char*)out->buf + rec0, &w, sizeof(w));
+				shift += (int64_t)(out->cnt - rec0) - (int64_t)(rend - r);
+				move_t m = { r + noff, shift };
+				buf_ncat(coff->moves, (const char*)&m, sizeof(m));
+				r = rend;
+			}
+			DWORD len = out->cnt - sub - sizeof(head);
+			memcpy((char*)out->buf + sub + 4, &len, sizeof(len));
+		}
+		// Subsections are aligned to 4 bytes.
+		pos = end + 3 < size ? (end + 3) & ~(size_t)3 : size;
+		buf_ncat(out, data + end, pos - end);
+	}
+}
+
+/**
+ * @brief Move an offset into a '.debug$S' section along with the names that
+ *        changed before it.
+ *
+ * @param coff The renamed COFF file.
+ * @param off  Offset in the old section.
+ * @return Offset in the new section.
+ */
+static DWORD
+move_offset(const coff_t *coff, DWORD off)
+{
+	const move_t *moves = coff->moves->buf;
+	size_t lo = 0, hi = coff->moves->cnt / sizeof(move_t);
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (moves[mid].pos < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? off + moves[lo - 1].shift : off;
+}
+
+/**
+ * @brief Get the relocations of a section.
+ *
+ * The first relocation holds their number if it does not fit the header.
+ *
+ * @param coff  The COFF file.
+ * @param sec   The section header.
+ * @param nrel  Receives the number of relocations, including the first.
+ * @param first Receives the index of the first actual relocation.
+ * @return The relocations.
+ */
+static const char *
+section_relocations(coff_t *coff, PIMAGE_SECTION_HEADER sec, size_t *nrel, size_t *first)
+{
+	*nrel  = sec->NumberOfRelocations;
+	*first = 0;
+	if ((sec->Characteristics & IMAGE_SCN_LNK_NRELOC_OVFL) && *nrel == 0xffff) {
+		DWORD n;
+		memcpy(&n, file_part(coff, sec->PointerToRelocations, IMAGE_SIZEOF_RELOCATION), sizeof(n));
+		*nrel  = n;
+		*first = 1;
+	}
+	if (*nrel && (sec->PointerToRelocations > coff->size
+	 || *nrel > (coff->size - sec->PointerToRelocations) / IMAGE_SIZEOF_RELOCATION))
+		error("Invalid section contents.");
+	return *nrel ? file_part(coff, sec->PointerToRelocations, *nrel * IMAGE_SIZEOF_RELOCATION) : NULL;
+}
+
+/**
+ * @brief Point records that refer to symbols by index to their new indices.
+ *
+ * @param coff  The renamed COFF file with stripped symbols.
+ * @param table The records.
+ * @param first Index of the first record to renumber.
+ * @param count Number of records.
+ * @param size  Size of a record.
+ * @param pos   Offset of the symbol index within a record.
+ */
+static void
+renumber_symbols(const coff_t *coff, char *table, size_t first, size_t count, size_t size, size_t pos)
+{
+	for (size_t i = first; i < count; ++i) {
+		DWORD n;
+		char *p = table + i * size + pos;
+		memcpy(&n, p, sizeof(n));
+		n = coff->newindex[n];
+		memcpy(p, &n, sizeof(n));
+	}
+}
+
+/**
+ * @brief Rewrite the CodeView symbol records of a renamed COFF file that
+ *        name renamed symbols, along with the relocations of their sections.
+ *
+ * Procedures, data and thread storage are renamed. The other records of an
+ * object file do not refer to one another by offset, so that only the
+ * relocations need moving. A '.debug$S' section that grows or shrinks has
+ * its section definition record updated by layout_coff(), as '.drectve'
+ * sections do.
+ *
+ * @param coff The renamed COFF file.
+ */
+static void
+build_codeview(coff_t *coff)
+{
+	const IMAGE_FILE_HEADER *head = coff->file;
+	const ANON_OBJECT_HEADER_BIGOBJ *big = coff->file;
+	bool x86 = (coff->bigobj ? big->Machine : head->Machine) == 0x014c;
+	// Index the changed symbol names as CodeView spells them.
+	coff->cvdict  = new_dict();
+	coff->cvslots = malloc(coff->nsymname * sizeof(size_t) + 1);
+	coff->moves   = new_buf();
+	if (!coff->cvslots)
+		error("Memory allocation failed.");
+	for (size_t e = 0; e < coff->nsymname; ++e) {
+		if (!coff->names[e].changed)
+			continue;
+		const entry_t *entry = &coff->dict->entries[e];
+		size_t skip, len = codeview_name(entry->key, entry->len, x86, &skip);
+		coff->cvslots[dict_insert(coff->cvdict, entry->key + skip, len)] = e;
+	}
+	for (size_t s = 0; s < coff->nsec; ++s) {
+		PIMAGE_SECTION_HEADER sec = section_at(coff, coff->file, s);
+		const entry_t *name = &coff->dict->entries[coff->secslots[s]];
+		if (!sec->SizeOfRawData || name->len != 8 || memcmp(name->key, ".debug$S", 8) != 0)
+			continue;
+		buf_t *out = new_content(coff, sec->PointerToRawData, sec->SizeOfRawData, s, false)->data;
+		coff->moves->cnt = 0;
+		rename_codeview(coff, x86, file_part(coff, sec->PointerToRawData, sec->SizeOfRawData),
+		                sec->SizeOfRawData, out);
+		if (!coff->moves->cnt) {
+			drop_content(coff);
+			continue;
+		}
+		// Move the relocations.
+		size_t nrel, first;
+		const char *rel = section_relocations(coff, sec, &nrel, &first);
+		if (!nrel)
+			continue;
+		out = new_content(coff, sec->PointerToRelocations, nrel * IMAGE_SIZEOF_RELOCATION, s, true)->data;
+		buf_ncat(out, rel, nrel * IMAGE_SIZEOF_RELOCATION);
+		for (size_t i = first; i < nrel; ++i) {
+			DWORD va;
+			char *p = (char*)out->buf + i * IMAGE_SIZEOF_RELOCATION;
+			memcpy(&va, p, sizeof(va));
+			va = move_offset(coff, va);
+			memcpy(p, &va, sizeof(va));
+		}
+		if (coff->newindex)
+			renumber_symbols(coff, (char*)out->buf, first, nrel, IMAGE_SIZEOF_RELOCATION, 4);
+	}
+}
+
+/**
+ * @brief Sections whose raw data list symbols by index: SafeSEH handlers
+ *        and Control Flow Guard tables, possibly with a '$' suffix.
+ */
+static const char *const index_sections[] = { ".sxdata", ".gfids", ".giats", ".gljmp", ".gehcont" };
+
+/**
+ * @brief Tell whether the raw data of a section list symbols by index.
+ *
+ * @param coff The COFF file.
+ * @param s    Index of the section.
+ * @return true if the section is one of `index_sections`.
+ */
+static bool
+is_index_section(const coff_t *coff, size_t s)
+{
+	const entry_t *name = &coff->dict->entries[coff->secslots[s]];
+	for (size_t i = 0; i < sizeof(index_sections) / sizeof(*index_sections); ++i) {
+		size_t len = strlen(index_sections[i]);
+		if (name->len >= len && memcmp(name->key, index_sections[i], len) == 0
+		 && (name->len == len || name->key[len] == '$'))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Choose the symbols of a COFF file to strip: static symbols and
+ *        labels defined in a section that nothing refers to.
+ *
+ * Symbols are referred to by relocations, weak externals and the sections in
+ * `index_sections`; external symbols made static may be stripped too. Records
+ * with aux records, such as section definitions, and COMDAT symbols are kept,
+ * and so are absolute symbols like '@feat.00'. Nothing is stripped from files
+ * with COFF line numbers, which refer to functions by index too.
+ *
+ * @param coff The renamed COFF file.
+ */
+static void
+strip_symbols(coff_t *coff)
+{
+	for (size_t s = 0; s < coff->nsec; ++s)
+		if (section_at(coff, coff->file, s)->NumberOfLinenumbers)
+			return;
+	size_t *index = coff->newindex = calloc(coff->nsym + 1, sizeof(size_t));
+	if (!index)
+		error("Memory allocation failed.");
+	// Mark the symbols referred to.
+	for (size_t s = 0; s < coff->nsec; ++s) {
+		PIMAGE_SECTION_HEADER sec = section_at(coff, coff->file, s);
+		size_t nrel, first;
+		const char *rel = section_relocations(coff, sec, &nrel, &first);
+		for (size_t i = first; i < nrel; ++i) {
+			DWORD n; // SymbolTableIndex
+			memcpy(&n, rel + i * IMAGE_SIZEOF_RELOCATION + 4, sizeof(n));
+			if (n >= coff->nsym)
+				error("Invalid section contents.");
+			index[n] = 1;
+		}
+		if (!sec->PointerToRawData || !is_index_section(coff, s))
+			continue;
+		const char *data = file_part(coff, sec->PointerToRawData, sec->SizeOfRawData);
+		for (size_t i = 0; i + sizeof(DWORD) <= sec->SizeOfRawData; i += sizeof(DWORD)) {
+			DWORD n;
+			memcpy(&n, data + i, sizeof(n));
+			if (n >= coff->nsym)
+				error("Invalid section contents.");
+			index[n] = 1;
+		}
+	}
+	for (size_t i = 0; i < coff->nsym; ++i)
+		if (coff->graph.weakdef[i] != SIZE_MAX)
+			index[coff->graph.weakdef[i]] = 1;
+	for (size_t s = 1; s <= coff->nsec; ++s)
+		if (coff->graph.comdat[s] != SIZE_MAX)
+			index[coff->graph.comdat[s]] = 1;
+	// Number the records kept, along with their aux records.
+	size_t n = 0;
+	for (size_t i = 0; i < coff->nsym; ) {
+		PIMAGE_SYMBOL sym = symbol_at(coff, coff->symtab, i);
+		BYTE naux = symbol_aux(coff, sym), cls = symbol_storage(coff, sym);
+		if (is_localized(coff, coff->names, i))
+			cls = IMAGE_SYM_CLASS_STATIC;
+		if (!index[i] && !naux && symbol_section(coff, sym) > 0
+		 && (cls == IMAGE_SYM_CLASS_STATIC || cls == IMAGE_SYM_CLASS_LABEL)) {
+			index[i++] = SIZE_MAX;
+			++coff->nstrip;
+			continue;
+		}
+		for (size_t k = 0; k <= naux && i < coff->nsym; ++k)
+			index[i++] = n++;
+	}
+	if (!coff->nstrip) {
+		free(coff->newindex);
+		coff->newindex = NULL;
+		return;
+	}
+	// Leave out the names only stripped symbols have.
+	for (size_t e = 0; e < coff->nsymname; ++e)
+		coff->names[e].stripped = true;
+	for (size_t i = 0; i < coff->nsym; ++i)
+		if (index[i] != SIZE_MAX && coff->slots[i] != DICT_NONE)
+			coff->names[coff->slots[i]].stripped = false;
+	for (size_t s = 0; s < coff->nsec; ++s)
+		coff->names[coff->secslots[s]].stripped = false;
+}
+
+/**
+ * @brief Point the relocations of a COFF file with stripped symbols, and
+ *        the sections in `index_sections`, to the new symbol indices.
+ *
+ * @param coff The renamed COFF file.
+ */
+static void
+build_relocations(coff_t *coff)
+{
+	// build_codeview() added the relocations it moved, already renumbered,
+	// in section order.
+	size_t k = 0, ncontent = coff->ncontent;
+	for (size_t s = 0; s < coff->nsec; ++s) {
+		PIMAGE_SECTION_HEADER sec = section_at(coff, coff->file, s);
+		if (sec->PointerToRawData && is_index_section(coff, s)) {
+			buf_t *out = new_content(coff, sec->PointerToRawData, sec->SizeOfRawData, s, false)->data;
+			buf_ncat(out, file_part(coff, sec->PointerToRawData, sec->SizeOfRawData), sec->SizeOfRawData);
+			renumber_symbols(coff, (char*)out->buf, 0, out->cnt / sizeof(DWORD), sizeof(DWORD), 0);
+		}
+		while (k < ncontent && (!coff->contents[k].relocs || coff->contents[k].sec < s))
+			++k;
+		if (k < ncontent && coff->contents[k].sec == s)
+			continue;
+		size_t nrel, first;
+		const char *rel = section_relocations(coff, sec, &nrel, &first);
+		if (nrel <= first)
+			continue;
+		buf_t *out = new_content(coff, sec->PointerToRelocations, nrel * IMAGE_SIZEOF_RELOCATION, s, true)->data;
+		buf_ncat(out, rel, nrel * IMAGE_SIZEOF_RELOCATION);
+		renumber_symbols(coff, (char*)out->buf, first, nrel, IMAGE_SIZEOF_RELOCATION, 4);
+	}
+}
+
+/**
+ * @brief Compare new section contents by offset.
+ */
+static int
+compare_contents(const void *a, const void *b)
+{
+	DWORD x = ((const content_t*)a)->off, y = ((const content_t*)b)->off;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Move a file offset along with the new section contents before it.
+ *
+ * @param coff The renamed COFF file, with its new contents sorted.
+ * @param off  Offset in the original file.
+ * @return Offset in the new file.
+ */
+static DWORD
+shift_offset(const coff_t *coff, DWORD off)
+{
+	// The contents are sorted and do not overlap, so that their ends are
+	// sorted too.
+	size_t lo = 0, hi = coff->ncontent;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		const content_t *c = &coff->contents[mid];
+		if (c->off + c->size <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	int64_t moved = off + (lo ? coff->contents[lo - 1].shift : 0);
+	if (moved > UINT32_MAX)
+		error("File too large.");
+	return moved;
+}
+
+/**
+ * @brief Make the section definition record of a section with new raw data
+ *        tell its new size.
+ *
+ * The checksum of the old contents is cleared rather than computed again,
+ * as linkers take 0 for no checksum.
+ *
+ * @param coff The renamed COFF file, with its new symbol table filled.
+ * @param s    Index of the section.
+ * @param size New size of the raw data.
+ */
+static void
+resize_section_symbol(coff_t *coff, size_t s, DWORD size)
+{
+	size_t i = coff->graph.secsym[s + 1];
+	if (i != SIZE_MAX && coff->newindex)
+		i = coff->newindex[i];
+	if (i == SIZE_MAX)
+		return;
+	char *aux = (char*)symbol_at(coff, coff->newsym, i + 1);
+	DWORD checksum = 0;
+	memcpy(aux, &size, sizeof(size));              // Length
+	memcpy(aux + 8, &checksum, sizeof(checksum));  // CheckSum
+}
+
+/**
+ * @brief Lay out a renamed COFF file: copy its headers with the new section
+ *        names and move the offsets that follow new section contents.
+ *
+ * @param coff The renamed COFF file.
+ */
+static void
+layout_coff(coff_t *coff)
+{
+	size_t secend = coff->secoff + coff->nsec * IMAGE_SIZEOF_SECTION_HEADER;
+	if (!(coff->newhdr = malloc(secend)))
+		error("Memory allocation failed.");
+	memcpy(coff->newhdr, coff->file, secend);
+	if (coff->ncontent)
+		qsort(coff->contents, coff->ncontent, sizeof(content_t), compare_contents);
+	for (size_t i = 0; i < coff->ncontent; ++i) {
+		content_t *c = &coff->contents[i];
+		if (c->off < secend || c->off + c->size > coff->symoff
+		 || (i && c->off < coff->contents[i - 1].off + coff->contents[i - 1].size))
+			error("Invalid section contents.");
+		c->shift = (i ? c[-1].shift : 0) + (int64_t)c->data->cnt - c->size;
+	}
+	for (size_t s = 0; s < coff->nsec; ++s) {
+		PIMAGE_SECTION_HEADER sec = section_at(coff, coff->newhdr, s);
+		set_section_name(sec, &coff->names[coff->secslots[s]]);
+		if (!coff->ncontent)
+			continue;
+		sec->PointerToRawData     = shift_offset(coff, sec->PointerToRawData);
+		sec->PointerToRelocations = shift_offset(coff, sec->PointerToRelocations);
+		sec->PointerToLinenumbers = shift_offset(coff, sec->PointerToLinenumbers);
+	}
+	for (size_t i = 0; i < coff->ncontent; ++i) {
+		const content_t *c = &coff->contents[i];
+		if (c->relocs)
+			continue;
+		section_at(coff, coff->newhdr, c->sec)->SizeOfRawData = c->data->cnt;
+		resize_section_symbol(coff, c->sec, c->data->cnt);
+	}
+	coff->newsymoff = shift_offset(coff, coff->symoff);
+	if (coff->bigobj) {
+		((ANON_OBJECT_HEADER_BIGOBJ*)coff->newhdr)->PointerToSymbolTable = coff->newsymoff;
+		((ANON_OBJECT_HEADER_BIGOBJ*)coff->newhdr)->NumberOfSymbols = coff->nsym - coff->nstrip;
+	} else {
+		((PIMAGE_FILE_HEADER)coff->newhdr)->PointerToSymbolTable = coff->newsymoff;
+		((PIMAGE_FILE_HEADER)coff->newhdr)->NumberOfSymbols = coff->nsym - coff->nstrip;
+	}
+}
+
+/**
+ * @brief Get the end of a chunk of a table.
+ *
+ * @param c The chunk.
+ * @param n Number of elements of the table.
+ * @return Index of the element after the chunk.
+ */
+static inline size_t
+chunk_end(size_t c, size_t n)
+{
+	return n - c * SCAN_CHUNK > SCAN_CHUNK ? (c + 1) * SCAN_CHUNK : n;
+}
+
+/**
+ * @brief Measure the names of a chunk of dictionary entries that go to the
+ *        new string table, keeping the size of each in its offset for now.
+ *
+ * @param scan The build.
+ * @param c    The chunk.
+ */
+static void
+measure_chunk(scan_t *scan, size_t c)
+{
+	name_t *names = scan->coff->names;
+	size_t size = 0;
+	for (size_t e = c * SCAN_CHUNK; e < chunk_end(c, scan->count); ++e) {
+		size_t len = name_length(&names[e]);
+		names[e].offset = 0;
+		if (len > scan->maxshort && !names[e].stripped) {
+			names[e].offset = len + 1;
+			size += len + 1;
+		}
+	}
+	scan->bases[c] = size;
+}
+
+/**
+ * @brief Write the names of a chunk of dictionary entries to the new string
+ *        table, from the offset of the chunk on.
+ *
+ * @param scan The build.
+ * @param c    The chunk.
+ */
+static void
+emit_chunk(scan_t *scan, size_t c)
+{
+	name_t *names = scan->coff->names;
+	char *strtab = scan->coff->newstr->buf;
+	size_t off = scan->bases[c];
+	for (size_t e = c * SCAN_CHUNK; e < chunk_end(c, scan->count); ++e) {
+		size_t size = names[e].offset;
+		if (!size)
+			continue;
+		emit_name(strtab + off, &names[e]);
+		strtab[off + size - 1] = '\0';
+		names[e].offset = off;
+		off += size;
+	}
+}
+
+/**
+ * @brief Copy a chunk of symbol records to the new symbol table, leaving out
+ *        those stripped.
+ *
+ * @param scan The build.
+ * @param c    The chunk.
+ */
+static void
+copy_chunk(scan_t *scan, size_t c)
+{
+	const coff_t *coff = scan->coff;
+	const size_t *newindex = coff->newindex;
+	size_t begin = c * SCAN_CHUNK, end = chunk_end(c, coff->nsym);
+	if (!newindex) {
+		memcpy(symbol_at(coff, coff->newsym, begin), symbol_at(coff, coff->symtab, begin),
+		       (end - begin) * coff->symsize);
+		return;
+	}
+	for (size_t i = begin; i < end; ++i)
+		if (newindex[i] != SIZE_MAX)
+			memcpy(symbol_at(coff, coff->newsym, newindex[i]), symbol_at(coff, coff->symtab, i), coff->symsize);
+}
+
+/**
+ * @brief Point a chunk of copied symbol records to their new names, and weak
+ *        externals to the new indices of their defaults.
+ *
+ * @param scan The build.
+ * @param c    The chunk.
+ */
+static void
+patch_chunk(scan_t *scan, size_t c)
+{
+	const coff_t *coff = scan->coff;
+	const name_t *names = coff->names;
+	const size_t *newindex = coff->newindex;
+	char *symtab = coff->newsym;
+	for (size_t i = c * SCAN_CHUNK; i < chunk_end(c, coff->nsym); ++i) {
+		if (coff->slots[i] == DICT_NONE)
+			continue; // Aux record.
+		if (newindex && newindex[i] == SIZE_MAX)
+			continue;
+		PIMAGE_SYMBOL sym = symbol_at(coff, symtab, newindex ? newindex[i] : i);
+		const name_t *n = &names[coff->slots[i]];
+		if (n->local && is_localized(coff, names, i))
+			set_symbol_storage(coff, sym, IMAGE_SYM_CLASS_STATIC);
+		if (coff->elf) {
+			DWORD offset = n->offset;
+			memcpy(sym, &offset, sizeof(DWORD));
+		} else if (n->offset) {
+			sym->N.Name.Short = 0;
+			sym->N.Name.Long  = n->offset;
+		} else {
+			memset(sym->N.ShortName, 0, 8);
+			emit_name((char*)sym->N.ShortName, n);
+		}
+		if (newindex && coff->graph.weakdef[i] != SIZE_MAX) {
+			DWORD tag = newindex[coff->graph.weakdef[i]]; // TagIndex
+			memcpy(symbol_at(coff, symtab, newindex[i] + 1), &tag, sizeof(tag));
+		}
+	}
+}
+
+/**
+ * @brief Fill the new symbol and string tables of a renamed COFF file, by
+ *        chunks of names and of symbol records.
+ *
+ * @param coff     The renamed COFF file.
+ * @param count    Number of dictionary entries whose names are written out.
+ * @param maxshort Longest name kept out of the string table.
+ * @param start    Size of what the string table starts with.
+ */
+static void
+fill_tables(coff_t *coff, size_t count, size_t maxshort, size_t start)
+{
+	size_t symsize = (size_t)(coff->nsym - coff->nstrip) * coff->symsize;
+	if (!(coff->newsym = malloc(symsize ? symsize : 1)))
+		error("Memory allocation failed.");
+	size_t nname = (count + SCAN_CHUNK - 1) / SCAN_CHUNK;
+	size_t nrec  = (coff->nsym + SCAN_CHUNK - 1) / SCAN_CHUNK;
+	scan_t *scan = new_scan(coff, (nname > nrec ? nname : nrec) + 1);
+	scan->count    = count;
+	scan->maxshort = maxshort;
+	// Release the build before passing an error on.
+	jmp_buf outer;
+	memcpy(outer, _buf, sizeof(jmp_buf));
+	if (setjmp(_buf)) {
+		del_scan(scan);
+		memcpy(_buf, outer, sizeof(jmp_buf));
+		longjmp(_buf, 1);
+	}
+	if (coff->jobs != 1 && (count >= SCAN_MIN || coff->nsym >= SCAN_MIN))
+		scan->pool = new_pool(coff->jobs);
+	// Size the string table up front, giving each chunk of names its offset.
+	scan_phase(scan, nname, measure_chunk);
+	size_t strsize = start;
+	for (size_t i = 0; i < nname; ++i) {
+		size_t size = scan->bases[i];
+		scan->bases[i] = strsize;
+		strsize += size;
+	}
+	// Build the string table.
+	buf_t *buf = coff->newstr = new_buf();
+	buf_reserve(buf, strsize);
+	memset(buf->buf, 0, start); // String table length or empty string.
+	buf->cnt = strsize;
+	scan_phase(scan, nname, emit_chunk);
+	if (!coff->elf)
+		*(DWORD*)buf->buf = buf->cnt;
+	// Point symbols to their new names, leaving out those stripped, once
+	// they are all copied, as weak externals point to the aux records that
+	// follow them.
+	scan_phase(scan, nrec, copy_chunk);
+	scan_phase(scan, nrec, patch_chunk);
+	memcpy(_buf, outer, sizeof(jmp_buf));
+	del_scan(scan);
+}
+
+/**
+ * @brief Build the new symbol and string tables of a renamed COFF file.
+ *
+ * The symbol table is rewritten into a copy, as the dictionary keys still
+ * point into the original one. COFF names of up to 8 characters are kept in
+ * their symbol records and section headers; ELF names all go to the string
+ * table, after its leading empty string.
+ *
+ * Section names of COFF files are kept in the string table along with the
+ * symbol names, and so are those of ELF files if they were already or a
+ * section is renamed; otherwise they are left where they are.
+ *
+ * @param coff The renamed COFF file.
+ */
+static void
+build_tables(coff_t *coff)
+{
+	name_t *names = coff->names;
+	size_t start = coff->elf ? 1 : sizeof(DWORD), maxshort = coff->elf ? 0 : 8;
+	bool sections = coff->secshared;
+	for (size_t s = 0; s < coff->nsec && !sections; ++s)
+		sections = names[coff->secslots[s]].changed;
+	size_t count = sections ? coff->dict->count : coff->nsymname;
+	fill_tables(coff, count, maxshort, start);
+	buf_t *buf = coff->newstr;
+	// Point sections to their new names.
+	if (coff->elf) {
+		if (sections) {
+			if (!(coff->secnames = malloc(coff->nsec * sizeof(size_t) + 1)))
+				error("Memory allocation failed.");
+			for (size_t s = 0; s < coff->nsec; ++s)
+				coff->secnames[s] = names[coff->secslots[s]].offset;
+		}
+		build_elf(coff->elf, coff->newsym, buf->buf, buf->cnt, coff->secnames);
+	} else {
+		build_directives(coff);
+		if (coff->codeview)
+			build_codeview(coff);
+		if (coff->newindex)
+			build_relocations(coff);
+		layout_coff(coff);
+	}
+}
+
+/**
+ * @brief Tell whether a buffer holds a COFF object file.
+ *
+ * Import objects and anonymous objects start with IMAGE_FILE_MACHINE_UNKNOWN
+ * and are not taken for COFF objects, except for big object files.
+ *
+ * @param data The contents.
+ * @param size Size of the contents.
+ * @return true if the contents look like a COFF object.
+ */
+bool
+is_coff(const void *data, size_t size)
+{
+	static const WORD machines[] = {
+		0x014c, // I386
+		0x8664, // AMD64
+		0x01c0, // ARM
+		0x01c4, // ARMNT
+		0xaa64, // ARM64
+		0xa641, // ARM64EC
+		0x0200, // IA64
+	};
+	if (size < sizeof(IMAGE_FILE_HEADER))
+		return false;
+	const IMAGE_FILE_HEADER *head = data;
+	const ANON_OBJECT_HEADER_BIGOBJ *big = data;
+	WORD machine = head->Machine;
+	if (machine == 0) {
+		if (size < sizeof(ANON_OBJECT_HEADER_BIGOBJ) || big->Sig2 != 0xffff
+		 || big->Version < 2 || memcmp(&big->ClassID, bigobj_class, 16) != 0)
+			return false;
+		machine = big->Machine;
+	} else if (head->SizeOfOptionalHeader != 0) {
+		return false;
+	}
+	for (size_t i = 0; i < sizeof(machines) / sizeof(*machines); ++i)
+		if (machine == machines[i])
+			return true;
+	return false;
+}
+
+/**
+ * @brief Tell whether a buffer holds an object file that can be renamed.
+ *
+ * @param data The contents.
+ * @param size Size of the contents.
+ * @return true if the contents look like a COFF object or a relocatable ELF
+ *         object.
+ */
+bool
+is_object(const void *data, size_t size)
+{
+	return is_coff(data, size) || is_elf(data, size);
+}
+
+/**
+ * @brief Create a COFF file over contents in memory.
+ *
+ * @param data The contents, which must outlive the COFF file.
+ * @param size Size of the contents.
+ * @return A pointer to the newly created COFF file.
+ */
+coff_t *
+new_coff(void *data, size_t size)
+{
+	coff_t *coff = calloc(1, sizeof(coff_t));
+	if (!coff)
+		error("Memory allocation failed.");
+	coff->file = data;
+	coff->size = size;
+	return coff;
+}
+
+/**
+ * @brief Free a COFF file along with its index and new tables, but not its
+ *        contents unless stream_coff() read them. A streamed file is left
+ *        open.
+ *
+ * @param coff The COFF file, which may be partially processed.
+ */
+void
+del_coff(coff_t *coff)
+{
+	free(coff->names);
+	free(coff->slots);
+	free(coff->secslots);
+	free(coff->attrs);
+	free(coff->graph.weakdef);
+	free(coff->graph.secsym);
+	free(coff->graph.comdat);
+	free(coff->graph.assoc);
+	free(coff->graph.select);
+	if (coff->arena)
+		del_arena(coff->arena);
+	if (coff->elf)
+		del_elf(coff->elf);
+	if (coff->dict)
+		del_dict(coff->dict);
+	free(coff->newsym);
+	free(coff->newhdr);
+	for (size_t i = 0; i < coff->ncontent; ++i)
+		del_buf(coff->contents[i].data);
+	free(coff->contents);
+	if (coff->cvdict)
+		del_dict(coff->cvdict);
+	free(coff->cvslots);
+	if (coff->moves)
+		del_buf(coff->moves);
+	free(coff->secnames);
+	free(coff->newindex);
+	if (coff->targets)
+		del_dict(coff->targets);
+	if (coff->newstr)
+		del_buf(coff->newstr);
+	if (coff->in)
+		free(coff->file);
+	free(coff->tables);
+	if (coff->part)
+		del_buf(coff->part);
+	free(coff->window);
+	free(coff);
+}
+
+/**
+ * @brief Read the file header of a COFF file: where its section headers and
+ *        symbol table are, and how many there are.
+ *
+ * @param coff The COFF file, whose contents hold at least its file header.
+ * @param name Name of the file, used in error messages.
+ */
+static void
+read_header(coff_t *coff, const char *name)
+{
+	if (coff->size < sizeof(IMAGE_FILE_HEADER))
+		error("Invalid COFF file '%s'.", name);
+	const IMAGE_FILE_HEADER *head = coff->file;
+	const ANON_OBJECT_HEADER_BIGOBJ *big = coff->file;
+	coff->bigobj = head->Machine == 0 && is_coff(coff->file, coff->size);
+	if (coff->bigobj) {
+		coff->symsize = IMAGE_SIZEOF_SYMBOL_EX;
+		coff->symoff  = big->PointerToSymbolTable;
+		coff->nsym    = big->NumberOfSymbols;
+		coff->secoff  = sizeof(ANON_OBJECT_HEADER_BIGOBJ);
+		coff->nsec    = big->NumberOfSections;
+	} else {
+		coff->symsize = IMAGE_SIZEOF_SYMBOL;
+		coff->symoff  = head->PointerToSymbolTable;
+		coff->nsym    = head->NumberOfSymbols;
+		coff->secoff  = sizeof(IMAGE_FILE_HEADER) + head->SizeOfOptionalHeader;
+		coff->nsec    = head->NumberOfSections;
+	}
+	coff->secshared = true;
+	// Section headers precede the symbol table, which is rewritten.
+	if (coff->nsec && (coff->secoff > coff->symoff
+	 || coff->nsec > (coff->symoff - coff->secoff) / IMAGE_SIZEOF_SECTION_HEADER))
+		error("Invalid COFF file '%s'.", name);
+}
+
+/**
+ * @brief Read what renaming needs of a COFF file on disk: its headers, and
+ *        its symbol and string tables, which end the file.
+ *
+ * Section contents are read when they are rewritten, and the rest of the
+ * file is copied by write_coff() through a window of the given size, so that
+ * memory stays bounded by the tables whatever the size of the file.
+ *
+ * @param coff   A COFF file created over no contents.
+ * @param fp     The file, open for reading, which must outlive the COFF file.
+ * @param name   Name of the file, used in error messages.
+ * @param window Size of the window.
+ * @return false if the file is not a regular COFF file, which is left to be
+ *         read whole.
+ */
+static bool
+stream_coff(coff_t *coff, FILE *fp, const char *name, size_t window)
+{
+	struct stat st;
+	char head[sizeof(ANON_OBJECT_HEADER_BIGOBJ)] = { 0 };
+	if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode) || !is_coff(head, fread(head, 1, sizeof(head), fp)))
+		return false;
+	coff->in   = fp;
+	coff->path = name;
+	coff->size = st.st_size;
+	if (!(coff->file = malloc(sizeof(head))))
+		error("Memory allocation failed.");
+	memcpy(coff->file, head, sizeof(head));
+	read_header(coff, name);
+	size_t secend = coff->secoff + coff->nsec * IMAGE_SIZEOF_SECTION_HEADER;
+	if (coff->symoff > coff->size || secend > coff->size)
+		error("Invalid COFF file '%s'.", name);
+	if (secend > sizeof(head)) {
+		void *file = realloc(coff->file, secend);
+		if (!file)
+			error("Memory allocation failed.");
+		coff->file = file;
+		read_at(coff, file, 0, secend);
+	}
+	coff->nwindow = window < coff->size ? window : coff->size;
+	if (!(coff->tables = malloc(coff->size - coff->symoff + 1)) || !(coff->window = malloc(coff->nwindow + 1)))
+		error("Memory allocation failed.");
+	read_at(coff, coff->tables, coff->symoff, coff->size - coff->symoff);
+	return true;
+}
+
+/**
+ * @brief Validate the layout of a COFF or ELF file and index its symbol
+ *        names.
+ *
+ * @param coff    The COFF file.
+ * @param name    Name of the file, used in error messages.
+ * @param sidecar Whether to keep the index in a sidecar next to the file.
+ * @param jobs    Number of threads processing a large file, or 0 for one per
+ *                CPU.
+ */
+void
+index_coff(coff_t *coff, const char *name, bool sidecar, int jobs)
+{
+	coff->jobs = jobs;
+	if (!coff->in && is_elf(coff->file, coff->size)) {
+		size_t nsym;
+		coff->elf    = new_elf(coff->file, coff->size, name);
+		coff->symtab = elf_symtab(coff->elf, &nsym, &coff->symsize);
+		coff->nsym   = nsym;
+		coff->nsec   = elf_sections(coff->elf, &coff->secshared);
+		index_symbols(coff, name, sidecar);
+		return;
+	}
+	read_header(coff, name);
+	// A streamed file holds its tables apart from its headers.
+	char *tables = coff->in ? coff->tables : (char*)coff->file + coff->symoff;
+	coff->symtab = tables;
+	// String table immediately follows symbol table.
+	size_t strpos = coff->symoff + (size_t)coff->nsym * coff->symsize;
+	if (strpos > coff->size)
+		error("Invalid COFF file '%s'.", name);
+	coff->strtab = tables + (strpos - coff->symoff);
+	if (coff->size - strpos >= sizeof(DWORD))
+		coff->strsize = *(DWORD*)coff->strtab;
+	if (coff->strsize > coff->size - strpos)
+		error("Invalid COFF file '%s'.", name);
+	index_symbols(coff, name, sidecar);
+}
+
+/**
+ * @brief Make sure that renaming does not leave two defined external symbols
+ *        of a file with the same name.
+ *
+ * The new name of each changed definition is looked up among the original
+ * names, which the ones that did not change keep, and among the new names
+ * of the definitions checked before it, so that each costs two lookups.
+ *
+ * @param coff The renamed COFF file.
+ */
+static void
+check_collisions(coff_t *coff)
+{
+	name_t *names = coff->names;
+	for (size_t i = 0; i < coff->nsym; ++i)
+		if ((coff->attrs[i] & (CLS_EXTERNAL | SYM_DEFINED)) == (CLS_EXTERNAL | SYM_DEFINED)
+		 && coff->slots[i] != DICT_NONE && !(coff->nlocal && is_localized(coff, names, i)))
+			names[coff->slots[i]].defined = true;
+	if (!coff->arena)
+		coff->arena = new_arena();
+	dict_t *targets = coff->targets = new_dict();
+	for (size_t e = 0; e < coff->nsymname; ++e) {
+		const name_t *n = &names[e];
+		if (!n->changed || !n->defined)
+			continue;
+		size_t len = name_length(n);
+		char *name = arena_alloc(coff->arena, len + 1);
+		emit_name(name, n);
+		name[len] = '\0';
+		size_t f = dict_find(coff->dict, name, len), count = targets->count;
+		dict_insert(targets, name, len);
+		bool kept = f < coff->nsymname && names[f].defined && !names[f].changed;
+		if (kept || targets->count == count) {
+			const entry_t *old = &coff->dict->entries[e];
+			error("Renaming '%.*s' to '%s' would define '%s' twice.", (int)old->len, old->key, name, name);
+		}
+	}
+	del_dict(targets);
+	coff->targets = NULL;
+}
+
+/**
+ * @brief Rename the symbols of an indexed COFF file, make static and strip
+ *        those the rules ask for, and build its new tables if anything
+ *        changed.
+ *
+ * @param coff  The indexed COFF file.
+ * @param rules Renaming rules to apply.
+ * @param hit   Marks the renaming rules that match a symbol.
+ */
+void
+rename_coff(coff_t *coff, const rules_t *rules, bool *hit)
+{
+	coff->names = malloc(coff->dict->count * sizeof(name_t));
+	if (!coff->names)
+		error("Memory allocation failed.");
+	if (rules->weak_defaults && !coff->arena)
+		coff->arena = new_arena();
+	rename_symbols(coff, rules, coff->names, hit);
+	coff->codeview = rules->codeview;
+	// Note the names that changed, so that indices over the file need only
+	// look at those; with none, the file is copied through as it is.
+	coff->nchanged = 0;
+	for (size_t e = 0; e < coff->dict->count; ++e) {
+		name_t *n = &coff->names[e];
+		const entry_t *entry = &coff->dict->entries[e];
+		n->changed  = !name_equals(n, entry->key, entry->len);
+		n->stripped = false;
+		coff->nchanged += n->changed;
+	}
+	coff->nlocal = 0;
+	for (size_t i = 0; rules->locals->count && i < coff->nsym; ++i) {
+		if (coff->slots[i] != DICT_NONE && is_localized(coff, coff->names, i)) {
+			coff->names[coff->slots[i]].madelocal = true;
+			++coff->nlocal;
+		}
+	}
+	if (coff->nchanged && !rules->allow_collisions)
+		check_collisions(coff);
+	if (rules->strip && !coff->elf)
+		strip_symbols(coff);
+	if (coff_changed(coff))
+		build_tables(coff);
+}
+
+/**
+ * @brief Tell whether renaming changed any symbol name of a COFF file,
+ *        stripped any symbol or made any static.
+ *
+ * @param coff The renamed COFF file.
+ * @return true if the file is written out differently from its contents.
+ */
+bool
+coff_changed(const coff_t *coff)
+{
+	return coff->nchanged || coff->nstrip || coff->nlocal;
+}
+
+/**
+ * @brief Get the size of a renamed COFF file.
+ *
+ * @param coff The renamed COFF file.
+ * @return Size of the file as write_coff() writes it.
+ */
+size_t
+coff_size(const coff_t *coff)
+{
+	if (!coff_changed(coff))
+		return coff->size;
+	if (coff->elf)
+		return elf_size(coff->elf);
+	return coff->newsymoff + (size_t)(coff->nsym - coff->nstrip) * coff->symsize + coff->newstr->cnt;
+}
+
+/**
+ * @brief Copy part of the original contents of a COFF file to the output.
+ *
+ * A streamed file is copied through its window.
+ *
+ * @param coff The COFF file.
+ * @param out  The output.
+ * @param off  Offset of the part.
+ * @param size Size of the part.
+ */
+static void
+write_part(const coff_t *coff, out_t *out, size_t off, size_t size)
+{
+	if (!coff->in) {
+		out_write(out, (const char*)coff->file + off, size);
+		return;
+	}
+	for (size_t n; size; off += n, size -= n) {
+		n = size < coff->nwindow ? size : coff->nwindow;
+		read_at(coff, coff->window, off, n);
+		out_write(out, coff->window, n);
+	}
+}
+
+/**
+ * @brief Write a renamed COFF file.
+ *
+ * Everything before the symbol table but the headers and the rewritten
+ * section contents is copied from the original contents, and so is
+ * everything else if coff_changed() tells nothing changed.
+ *
+ * @param coff The renamed COFF file.
+ * @param out  The output.
+ */
+void
+write_coff(const coff_t *coff, out_t *out)
+{
+	if (!coff_changed(coff)) {
+		write_part(coff, out, 0, coff->size);
+		return;
+	}
+	if (coff->elf) {
+		write_elf(coff->elf, out);
+		return;
+	}
+	size_t pos = coff->secoff + coff->nsec * IMAGE_SIZEOF_SECTION_HEADER;
+	out_write(out, coff->newhdr, pos);
+	for (size_t i = 0; i < coff->ncontent; ++i) {
+		const content_t *c = &coff->contents[i];
+		write_part(coff, out, pos, c->off - pos);
+		out_write(out, c->data->buf, c->data->cnt);
+		pos = c->off + c->size;
+	}
+	write_part(coff, out, pos, coff->symoff - pos);
+	out_write(out, coff->newsym, (size_t)(coff->nsym - coff->nstrip) * coff->symsize);
+	out_write(out, coff->newstr->buf, coff->newstr->cnt);
+}
+
+/**
+ * @brief Write a renamed COFF file for save_output().
+ *
+ * @param coff The renamed COFF file.
+ * @param out  The output.
+ */
+static void
+emit_coff(const void *coff, out_t *out)
+{
+	write_coff(coff, out);
+}
+
+/**
+ * @brief Write a renamed COFF file under a temporary name next to outfile,
+ *        as stage_output() does.
+ *
+ * @param coff    The renamed COFF file.
+ * @param outfile Name of the output file.
+ * @return The temporary name, or NULL if outfile holds the file already.
+ */
+char *
+stage_coff(const coff_t *coff, const char *outfile)
+{
+	return stage_output(outfile, coff_size(coff), emit_coff, coff);
+}
+
+/**
+ * @brief Look up a symbol name of a renamed COFF file that changed.
+ *
+ * @param coff The renamed COFF file.
+ * @param name The original name, which need not be null-terminated.
+ * @param len  Length of the original name.
+ * @return Index of the name, or DICT_NONE if no symbol has that name or the
+ *         name did not change.
+ */
+size_t
+coff_renamed(const coff_t *coff, const char *name, size_t len)
+{
+	if (!coff->nchanged)
+		return DICT_NONE;
+	size_t e = dict_find(coff->dict, name, len);
+	return e < coff->nsymname && coff->names[e].changed ? e : DICT_NONE;
+}
+
+/**
+ * @brief Find the next external symbol a renamed COFF file defines.
+ *
+ * Symbols made static are not external any longer and are skipped.
+ *
+ * @param coff The renamed COFF file.
+ * @param i    Index of the symbol record to start from, advanced past the
+ *             symbol found.
+ * @param len  Receives the length of the original name.
+ * @param e    Receives the index of the name, for coff_name_length() and
+ *             coff_emit_name().
+ * @return The original name, which need not be null-terminated, or NULL if
+ *         there are no more.
+ */
+const char *
+coff_next_defined(const coff_t *coff, size_t *i, size_t *len, size_t *e)
+{
+	for (; *i < coff->nsym; ++*i) {
+		if ((coff->attrs[*i] & (CLS_EXTERNAL | SYM_DEFINED)) != (CLS_EXTERNAL | SYM_DEFINED)
+		 || coff->slots[*i] == DICT_NONE || (coff->nlocal && is_localized(coff, coff->names, *i)))
+			continue;
+		*e = coff->slots[(*i)++];
+		*len = coff->dict->entries[*e].len;
+		return coff->dict->entries[*e].key;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Tell whether the external symbols of a name were made static in a
+ *        renamed COFF file.
+ *
+ * Only a name carried by a record that is made static counts, as
+ * is_localized() tells: a common or undefined symbol named by a
+ * '--localize-symbol' rule stays external, and so in the symbol index.
+ *
+ * @param coff The renamed COFF file.
+ * @param name The original name, which need not be null-terminated.
+ * @param len  Length of the original name.
+ * @return true if the symbol index of an archive should no longer list the
+ *         name for the file.
+ */
+bool
+coff_localized(const coff_t *coff, const char *name, size_t len)
+{
+	if (!coff->nlocal)
+		return false;
+	size_t e = dict_find(coff->dict, name, len);
+	return e < coff->nsymname && coff->names[e].madelocal;
+}
+
+/**
+ * @brief Get the length of the new name of a symbol name.
+ *
+ * @param coff The renamed COFF file.
+ * @param e    Index of the name from coff_renamed().
+ * @return Length of the new name, excluding the null terminator.
+ */
+size_t
+coff_name_length(const coff_t *coff, size_t e)
+{
+	return name_length(&coff->names[e]);
+}
+
+/**
+ * @brief Write out the new name of a symbol name.
+ *
+ * @param coff The renamed COFF file.
+ * @param e    Index of the name from coff_renamed().
+ * @param dst  Destination with room for coff_name_length() bytes.
+ */
+void
+coff_emit_name(const coff_t *coff, size_t e, char *dst)
+{
+	emit_name(dst, &coff->names[e]);
+}
+
+/**
+ * @brief Tell what writing a renamed COFF file would change.
+ *
+ * @param coff The renamed COFF file.
+ * @param plan Receives the counts and sizes.
+ */
+void
+coff_plan(const coff_t *coff, plan_t *plan)
+{
+	plan->renamed   = coff->nchanged;
+	plan->localized = coff->nlocal;
+	plan->stripped  = coff->nstrip;
+	if (coff_changed(coff))
+		plan->strsize = coff->newstr->cnt;
+	else
+		plan->strsize = coff->elf ? elf_strsize(coff->elf) : coff->strsize;
+	plan->size = coff_size(coff);
+}
+
+/**
+ * @brief Print the plan of a file as a line of tab-separated fields.
+ *
+ * @param name Name of the file, or 'archive(member)' for archive members.
+ * @param plan The counts and sizes.
+ */
+void
+print_plan(const char *name, const plan_t *plan)
+{
+	printf("%s\t%lu\t%lu\t%lu\t%lu\t%llu\n", name, (unsigned long)plan->renamed,
+	       (unsigned long)plan->localized, (unsigned long)plan->stripped,
+	       (unsigned long)plan->strsize, (unsigned long long)plan->size);
+}
+
+/**
+ * @brief Write to an output, or compare with what the output stream holds.
+ *
+ * Once the contents differ, nothing more is read.
+ *
+ * @param out  The output.
+ * @param p    The data.
+ * @param size Size of the data.
+ */
+void
+out_write(out_t *out, const void *p, size_t size)
+{
+	if (!out->compare) {
+		fwrite(p, size, 1, out->fp);
+		return;
+	}
+	char chunk[1 << 14];
+	for (size_t n; out->same && size; p = (const char*)p + n, size -= n) {
+		n = size < sizeof(chunk) ? size : sizeof(chunk);
+		out->same = fread(chunk, 1, n, out->fp) == n && memcmp(chunk, p, n) == 0;
+	}
+}
+
+/**
+ * @brief Write a byte to an output, or compare it.
+ *
+ * @param out The output.
+ * @param c   The byte.
+ */
+void
+out_byte(out_t *out, int c)
+{
+	char b = c;
+	out_write(out, &b, 1);
+}
+
+/**
+ * @brief Tell whether a file holds the output already.
+ *
+ * Only a file of the right size is read, and only up to the first
+ * difference.
+ *
+ * @param outfile Name of the output file.
+ * @param size    Size of the output.
+ * @param write   Writes the output.
+ * @param src     What to pass to `write`.
+ * @return true if the file holds the same bytes.
+ */
+static bool
+output_current(const char *outfile, size_t size, writer_t write, const void *src)
+{
+	struct stat st;
+	if (stat(outfile, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size != size)
+		return false;
+	FILE *fp = fopen(outfile, "rb");
+	if (!fp)
+		return false;
+	out_t cmp = { .fp = fp, .compare = true, .same = true };
+	write(src, &cmp);
+	fclose(fp);
+	return cmp.same;
+}
+
+/**
+ * @brief Write the output to outfile or to the given stream.
+ *
+ * An outfile that holds the same bytes already is left untouched, along with
+ * its modification time, so that build systems do not rebuild what depends
+ * on it. This costs reading the file, which is only done when its size
+ * matches. A given stream is always written.
+ *
+ * @param outfile Name of the output file.
+ * @param out     The output stream, or NULL to open outfile.
+ * @param size    Size of the output.
+ * @param write   Writes the output.
+ * @param src     What to pass to `write`.
+ */
+void
+save_output(const char *outfile, FILE *out, size_t size, writer_t write, const void *src)
+{
+	if (!out && output_current(outfile, size, write, src))
+		return;
+	FILE *fp = out ? out : fopen(outfile, "wb");
+	if (!fp)
+		error("Open file '%s' failed.", outfile);
+	out_t o = { .fp = fp };
+	write(src, &o);
+	bool failed = fflush(fp) != 0 || ferror(fp);
+	if (!out)
+		failed |= fclose(fp) != 0;
+	if (failed)
+		error("Write file '%s' failed.", outfile);
+}
+
+/**
+ * @brief Write a file under a temporary name next to it.
+ *
+ * @param path  Name of the file.
+ * @param write Writes the contents.
+ * @param src   What to pass to `write`.
+ * @return The temporary name, which the caller is responsible for freeing,
+ *         or NULL if the file could not be written.
+ */
+static char *
+write_temp(const char *path, writer_t write, const void *src)
+{
+	static unsigned long counter;
+	size_t size = strlen(path) + 48;
+	char *tmp = malloc(size);
+	if (!tmp)
+		error("Memory allocation failed.");
+	snprintf(tmp, size, "%s.%ld.%lu.tmp", path, (long)getpid(),
+	         __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+	FILE *fp = fopen(tmp, "wb");
+	if (!fp) {
+		free(tmp);
+		return NULL;
+	}
+	out_t o = { .fp = fp };
+	write(src, &o);
+	bool failed = fflush(fp) != 0 || ferror(fp);
+	failed |= fclose(fp) != 0;
+	if (failed) {
+		remove(tmp);
+		free(tmp);
+		return NULL;
+	}
+	return tmp;
+}
+
+/**
+ * @brief Write a file under a temporary name next to it, then rename it
+ *        into place, so that other processes never read it half written.
+ *
+ * This is for files that only speed things up, such as cached outputs, where
+ * failing is not an error, and for outputs that replace the file they are
+ * streamed from.
+ *
+ * @param path  Name of the file.
+ * @param write Writes the contents.
+ * @param src   What to pass to `write`.
+ * @return true if the file was written.
+ */
+bool
+save_atomic(const char *path, writer_t write, const void *src)
+{
+	char *tmp = write_temp(path, write, src);
+	if (!tmp)
+		return false;
+	// Another process may have written the same file in the meantime.
+	bool ok = rename(tmp, path) == 0;
+	if (!ok)
+		remove(tmp);
+	free(tmp);
+	return ok;
+}
+
+/**
+ * @brief Write the output under a temporary name next to outfile, to be
+ *        renamed into place later, unless outfile holds it already.
+ *
+ * @param outfile Name of the output file.
+ * @param size    Size of the output.
+ * @param write   Writes the output.
+ * @param src     What to pass to `write`.
+ * @return The temporary name, which the caller renames or removes, then
+ *         frees, or NULL if outfile is left as it is.
+ */
+char *
+stage_output(const char *outfile, size_t size, writer_t write, const void *src)
+{
+	if (output_current(outfile, size, write, src))
+		return NULL;
+	char *tmp = write_temp(outfile, write, src);
+	if (!tmp)
+		error("Write file '%s' failed.", outfile);
+	return tmp;
+}
+
+/**
+ * @brief Tell whether two names refer to the same file.
+ *
+ * @param a The first name.
+ * @param b The second name.
+ * @return true if both exist and are the same file.
+ */
+static bool
+same_file(const char *a, const char *b)
+{
+	struct stat x, y;
+	return stat(a, &x) == 0 && stat(b, &y) == 0 && x.st_dev == y.st_dev && x.st_ino == y.st_ino;
+}
+
+/**
+ * @brief Rename the symbols of a COFF file streamed from disk, for
+ *        '--stream'.
+ *
+ * The output is copied from infile as it is written, so that an outfile that
+ * is infile itself is written under a temporary name and renamed into place.
+ *
+ * @param rules   Renaming rules to apply.
+ * @param infile  Name of the input file.
+ * @param outfile Name of the output file.
+ * @return false if infile is not a COFF file, which is then read whole.
+ */
+static bool
+stream_file(const rules_t *rules, const char *infile, const char *outfile)
+{
+	FILE *fp = fopen(infile, "rb");
+	if (!fp)
+		error("Open file '%s' failed.", infile);
+	coff_t *volatile coff = NULL;
+	bool *volatile hit = NULL;
+	// Release the file before passing an error on.
+	jmp_buf outer;
+	memcpy(outer, _buf, sizeof(jmp_buf));
+	if (setjmp(_buf)) {
+		if (coff)
+			del_coff(coff);
+		free(hit);
+		fclose(fp);
+		memcpy(_buf, outer, sizeof(jmp_buf));
+		longjmp(_buf, 1);
+	}
+	coff = new_coff(NULL, 0);
+	bool streamed = stream_coff(coff, fp, infile, rules->stream_buffer);
+	if (streamed) {
+		if (!(hit = calloc(rules->renames->count + 1, sizeof(bool))))
+			error("Memory allocation failed.");
+		index_coff(coff, infile, false, rules->jobs);
+		rename_coff(coff, rules, hit);
+		check_hits(rules, hit);
+		if (rules->dry_run) {
+			plan_t plan;
+			coff_plan(coff, &plan);
+			print_plan(infile, &plan);
+		} else if (same_file(infile, outfile)) {
+			if (!output_current(outfile, coff_size(coff), emit_coff, coff)
+			 && !save_atomic(outfile, emit_coff, coff))
+				error("Write file '%s' failed.", outfile);
+		} else {
+			save_output(outfile, NULL, coff_size(coff), emit_coff, coff);
+		}
+	}
+	memcpy(_buf, outer, sizeof(jmp_buf));
+	del_coff(coff);
+	free(hit);
+	fclose(fp);
+	return streamed;
+}
+
+/**
+ * @brief Rename the symbols of a COFF file or of every COFF member of an
+ *        archive, unless the output cache holds the result.
+ *
+ * With '--stream', a COFF infile is streamed by stream_file() instead, and
+ * the cache is not used.
+ *
+ * Everything allocated here is released even if an error occurs, since the
+ * daemon keeps running after a failed request.
+ *
+ * @param rules   Renaming rules to apply.
+ * @param infile  Name of the input file.
+ * @param in      The input stream, or NULL to open infile.
+ * @param outfile Name of the output file.
+ * @param out     The output stream, or NULL to open outfile.
+ */
+void
+rename_file(const rules_t *rules, const char *infile, FILE *in,
+            const char *outfile, FILE *out)
+{
+	if (rules->stream && !in && !out && stream_file(rules, infile, outfile))
+		return;
+	void *data;
+	size_t size = in ? read_stream(in, infile, &data) : read_file(infile, &data);
+	coff_t *volatile coff = NULL;
+	bool *hit = calloc(rules->renames->count + 1, sizeof(bool));
+	// Release the file before passing an error on.
+	jmp_buf outer;
+	memcpy(outer, _buf, sizeof(jmp_buf));
+	if (setjmp(_buf)) {
+		if (coff)
+			del_coff(coff);
+		free(hit);
+		free(data);
+		memcpy(_buf, outer, sizeof(jmp_buf));
+		longjmp(_buf, 1);
+	}
+	if (!hit)
+		error("Memory allocation failed.");
+	char key[CACHE_KEY_SIZE] = "";
+	if (!rules->dry_run && cache_fetch(rules, data, size, key, outfile, out)) {
+		// Renamed with the same rules before.
+	} else if (is_archive(data, size)) {
+		rename_archive(rules, infile, data, size, key, hit, outfile, out);
+	} else {
+		// Rename symbols and save changes to file.
+		coff = new_coff(data, size);
+		index_coff(coff, infile, rules->sidecar && !in, rules->jobs);
+		rename_coff(coff, rules, hit);
+		check_hits(rules, hit);
+		if (rules->dry_run) {
+			plan_t plan;
+			coff_plan(coff, &plan);
+			print_plan(infile, &plan);
+		} else {
+			cache_save(rules, key, outfile, out, coff_size(coff), emit_coff, coff);
+		}
+		del_coff(coff);
+		coff = NULL;
+	}
+	memcpy(_buf, outer, sizeof(jmp_buf));
+	free(hit);
+	free(data);
+}
+
+/**
+ * @brief Process a command line in this process.
+ *
+ * @param argc Number of arguments.
+ * @param argv Arguments.
+ * @return Exit code.
+ */
+int
+run(int argc, char *argv[])
+{
+	// Set a Non-local jump.
+	if (setjmp(_buf)) {
+		fprintf(stderr, "%s\n", _errmsg);
+		return 1;
+	}
+	if (argc - skip_options(argc, argv) < 2) {
+		fputs(help, stderr);
+		return 0;
+	}
+	// Parse options and all 'old new' pairs.
+	rules_t *rules = new_rules(NULL);
+	int arg = compile_rules(rules, argc, argv);
+	rename_file(rules, argv[arg], NULL, argv[arg + 1], NULL);
+	del_rules(rules);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		fputs(help, stderr);
+		return 0;
+	}
+	if (strcmp(argv[1], "--serve") == 0)
+		return serve(argc - 1, argv + 1);
+	if (strcmp(argv[1], "--client") == 0)
+		return client(argc - 1, argv + 1);
+	if (strcmp(argv[1], "--project") == 0)
+		return project(argc - 1, argv + 1);
+	return run(argc, argv);
+}
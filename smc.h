@@ -0,0 +1,132 @@
+#ifndef _SMC_H
+#define _SMC_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Renaming rules */
+typedef struct rules_t rules_t;
+
+rules_t *new_rules(const char *dir);
+void del_rules(rules_t *rules);
+int compile_rules(rules_t *rules, int argc, char *argv[]);
+void compile_project_rules(rules_t *rules, int argc, char *argv[]);
+int rules_jobs(const rules_t *rules);
+size_t rules_count(const rules_t *rules);
+bool rules_dry_run(const rules_t *rules);
+bool rules_sidecar(const rules_t *rules);
+const char *rules_cache(const rules_t *rules, size_t *size);
+const struct digest_t *rules_digest(const rules_t *rules);
+void check_hits(const rules_t *rules, const bool *hit);
+bool rules_stale(const rules_t *rules);
+
+/* Command line */
+const char *option_arg(int argc, char *argv[], int *i, const char *name);
+int parse_jobs(const char *arg);
+int skip_options(int argc, char *argv[]);
+bool is_absolute(const char *path);
+char *join_path(const char *dir, const char *path);
+
+/* Symbol attributes */
+enum {
+	CLS_EXTERNAL = 1 << 0, ///< IMAGE_SYM_CLASS_EXTERNAL; global and weak ELF symbols.
+	CLS_STATIC   = 1 << 1, ///< IMAGE_SYM_CLASS_STATIC; local ELF symbols.
+	CLS_WEAK     = 1 << 2, ///< IMAGE_SYM_CLASS_WEAK_EXTERNAL
+	CLS_ALL      = CLS_EXTERNAL | CLS_STATIC | CLS_WEAK,
+	SYM_DEFINED  = 1 << 3, ///< Defined in the file, including common symbols.
+	SYM_FUNCTION = 1 << 4, ///< A function.
+};
+
+/* Output */
+/**
+ * @brief An output stream that is either written to or compared with.
+ */
+typedef struct {
+	FILE *fp;      ///< The stream.
+	bool  compare; ///< Whether what is written is compared with what the stream holds.
+	bool  same;    ///< Whether everything compared so far matched.
+} out_t;
+
+typedef void (*writer_t)(const void *src, out_t *out);
+
+void out_write(out_t *out, const void *p, size_t size);
+void out_byte(out_t *out, int c);
+void save_output(const char *outfile, FILE *out, size_t size, writer_t write, const void *src);
+bool save_atomic(const char *path, writer_t write, const void *src);
+char *stage_output(const char *outfile, size_t size, writer_t write, const void *src);
+
+/* COFF files */
+typedef struct coff_t coff_t;
+
+bool is_coff(const void *data, size_t size);
+bool is_object(const void *data, size_t size);
+coff_t *new_coff(void *data, size_t size);
+void del_coff(coff_t *coff);
+void index_coff(coff_t *coff, const char *name, bool sidecar, int jobs);
+void rename_coff(coff_t *coff, const rules_t *rules, bool *hit);
+bool coff_changed(const coff_t *coff);
+size_t coff_size(const coff_t *coff);
+void write_coff(const coff_t *coff, out_t *out);
+char *stage_coff(const coff_t *coff, const char *outfile);
+size_t coff_renamed(const coff_t *coff, const char *name, size_t len);
+bool coff_localized(const coff_t *coff, const char *name, size_t len);
+const char *coff_next_defined(const coff_t *coff, size_t *i, size_t *len, size_t *e);
+size_t coff_name_length(const coff_t *coff, size_t e);
+void coff_emit_name(const coff_t *coff, size_t e, char *dst);
+
+/* Dry runs */
+typedef struct {
+	size_t renamed;   ///< Number of names renamed.
+	size_t localized; ///< Number of external symbols made static.
+	size_t stripped;  ///< Number of symbol records stripped.
+	size_t strsize;   ///< Size of the new string table.
+	size_t size;      ///< Size of the file that would be written.
+} plan_t;
+
+void coff_plan(const coff_t *coff, plan_t *plan);
+void print_plan(const char *name, const plan_t *plan);
+
+/* ELF files */
+typedef struct elf_t elf_t;
+
+bool is_elf(const void *data, size_t size);
+elf_t *new_elf(void *data, size_t size, const char *name);
+void del_elf(elf_t *elf);
+char *elf_symtab(const elf_t *elf, size_t *nsym, size_t *symsize);
+const char *elf_symbol(const elf_t *elf, size_t i, size_t *len, int *attrs);
+size_t elf_sections(const elf_t *elf, bool *shared);
+const char *elf_section(const elf_t *elf, size_t i, size_t *len);
+void build_elf(elf_t *elf, const char *symtab, const char *strtab, size_t strsize,
+               const size_t *secnames);
+size_t elf_size(const elf_t *elf);
+size_t elf_strsize(const elf_t *elf);
+void elf_digest(const elf_t *elf, struct digest_t *d);
+void write_elf(const elf_t *elf, out_t *out);
+
+/* Files */
+void rename_file(const rules_t *rules, const char *infile, FILE *in,
+                 const char *outfile, FILE *out);
+int run(int argc, char *argv[]);
+
+/* Archives */
+bool is_archive(const void *data, size_t size);
+void rename_archive(const rules_t *rules, const char *infile, void *data, size_t size,
+                    const char *key, bool *hit, const char *outfile, FILE *out);
+
+/* Output cache */
+#define CACHE_KEY_SIZE 33 ///< Size of a cache key in hex digits, with the null terminator.
+
+bool cache_fetch(const rules_t *rules, const void *data, size_t size, char key[CACHE_KEY_SIZE],
+                 const char *outfile, FILE *out);
+void cache_save(const rules_t *rules, const char *key, const char *outfile, FILE *out,
+                size_t outsize, writer_t write, const void *src);
+
+/* Projects */
+int project(int argc, char *argv[]);
+
+/* Rename daemon */
+int serve(int argc, char *argv[]);
+int client(int argc, char *argv[]);
+
+#endif
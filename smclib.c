@@ -1,311 +1,904 @@
-/**
- * @file smclib.c
- * @brief Library Support for Symbol Modifier for COFF (SMC).
- *
- * @author Dangfer
- * @date 2023-01-07
- * @version 1.0.0
- *
- * Note:
- *     This file is part of the SMC tool and is intended to be used in
- *     conjunction with the main application. It is not designed to be used
- *     independently.
- * 
- * License:
- *     This program is free software; you can redistribute it and/or modify it
- *     under the terms  of the GNU General Public License as published by the
- *     Free Software Foundation; either version 2 of the License, or (at your
- *     option) any later version.
- */
-
-
-#include "smclib.h"
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdarg.h>
-#include <string.h>
-
-
-/* Error handling */
-jmp_buf _buf;
-
-/**
- * @brief Prints an error message and performs a non-local jump.
- * 
- * @param fmt Error message format, analogous to printf.
- * @param ... Additional arguments for the format string.
- */
-void __attribute__((noreturn))
-error(const char *fmt, ...)
-{
-	va_list ap;
-	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
-	va_end(ap);
-	fputc('\n', stderr);
-
-	longjmp(_buf, 1);
-}
-
-/**
- * @brief Checks the validity of a pointer returned from memory allocation.
- *
- * @param ptr The pointer to be checked for NULL value.
- */
-static inline void
-check_ptr(void *ptr)
-{
-	if (!ptr)
-		error("Memory allocation failed.");
-}
-
-/* File IO */
-/**
- * @brief Opens a binary file, reads its contents into a buffer, and returns
- *        the file size.
- *
- * This function allocates memory for the content of the file and stores the
- * pointer in `buf`. The caller is responsible for freeing the allocated
- * memory.
- *
- * @param filename The name of the file to be opened.
- * @param buf      Pointer to the pointer of the buffer where the file
- *                 contents will be stored.
- * @return The size of the file in bytes.
- */
-size_t
-read_file(const char *filename, void **buf)
-{
-	if (!filename)
-		error("Invalid filename.");
-	FILE *fp = fopen(filename, "rb");
-	if (!fp)
-		error("Open file '%s' failed.", filename);
-
-	fseek(fp, 0, SEEK_END);
-	size_t size = ftell(fp);
-	rewind(fp);
-
-	*buf = malloc(size);
-	check_ptr(*buf);
-	fread(*buf, size, 1, fp);
-
-	fclose(fp);
-	return size;
-}
-
-
-/* Dictionary */
-/**
- * This dictionary is used within the context of smc (Symbol Modifier for COFF)
- * and is optimized for this use. The dictionary stores symbol names as keys
- * with their respective new symbols as values. If the value is NULL, the
- * original symbol name is to be used. If the value is not NULL, it indicates
- * that the symbol name should be modified to the value specified.
- * 
- * This dictionary does not support removing entries and hence does not contain
- * dummy entries.
- */
-
-#define DICT_INIT_BITS 5
-#define DICT_INIT_SIZE ((size_t)1 << DICT_INIT_BITS)
-
-#define DICT_SIZE(dict) ((size_t)1 << (dict)->size_bits)
-#define DICT_MASK(dict) (DICT_SIZE(dict) - 1)
-#define NEXT_INDEX(dict,i) ((((i) * 5) + 1) & DICT_MASK(dict))
-#define GET_ENTRY(dict,i) ((dict)->indices[i])
-#define IS_ENTRY(ent,h,k) ((ent)->hash == h && strcmp((ent)->key, k) == 0)
-
-#define IDX_EMPTY ((size_t)-1)
-
-/**
- * @brief Creates and initializes a new dictionary object.
- *
- * @return A pointer to the newly created dictionary object.
- */
-dict_t *
-new_dict(void)
-{
-	dict_t *dict = malloc(sizeof(dict_t));
-	check_ptr(dict);
-	dict->size_bits = DICT_INIT_BITS;
-	size_t size = DICT_SIZE(dict);
-	dict->entries = malloc(size * sizeof(entry_t*));
-	check_ptr(dict->entries);
-	dict->indices = malloc(size * sizeof(size_t));
-	check_ptr(dict->indices);
-	dict->count = 0;
-	memset(dict->indices, -1, size * sizeof(size_t));
-	return dict;
-}
-
-/**
- * @brief Deletes a dictionary object and frees all associated memory.
- *
- * @param dict The dictionary object to delete.
- */
-void
-del_dict(dict_t *dict)
-{
-	// As the dictionary does not contain dummy entries, we just iterate over
-	// the entries array.
-	for (size_t e = 0; e < dict->count; ++e) {
-		entry_t *entry = dict->entries[e];
-		free((void*)entry->key);
-		if (entry->key != entry->val) // The symbol name has been changed.
-			free((void*)entry->val);
-		free(entry);
-	}
-	free(dict->entries);
-	free(dict->indices);
-	free(dict);
-}
-
-/**
- * @brief Computes a hash value for the given key using shift operations.
- * 
- * @param key The key for which to compute the hash.
- * @return The computed hash value of the key.
- */
-static hash_t
-hash_key(key_t key)
-{
-	hash_t h = 1;
-	const uint8_t *k = (typeof(k))key;
-	while (*k)
-		h += (h << 5) + (h >> 27) + *k++;
-	return h;
-}
-
-/**
- * @brief Expands the storage capacity of the specified dictionary.
- *
- * @param dict The dictionary object to be expanded.
- */
-static void
-expand_dict(dict_t *dict)
-{
-	// Expand entries and indices arrays.
-	size_t size = (size_t)1 << ++dict->size_bits;
-	dict->entries = realloc(dict->entries, size * sizeof(entry_t*));
-	check_ptr(dict->entries);
-	dict->indices = realloc(dict->indices, size * sizeof(size_t));
-	check_ptr(dict->indices);
-	memset(dict->indices, -1, sizeof(size_t) * size);
-	// Rehash all existing entries to the new indices array.
-	for (size_t e = 0; e < dict->count; ++e) {
-		hash_t hash = dict->entries[e]->hash;
-		size_t i = hash & (size - 1);
-		while (GET_ENTRY(dict, i) != IDX_EMPTY)
-			i = NEXT_INDEX(dict, i);
-		dict->indices[i] = e;
-	}
-}
-
-/**
- * @brief Adds a key-value pair into the dictionary or updates an existing
- *        key's value.
- *
- * @param dict The dictionary to which the key-value pair should be added
- *             or updated.
- * @param key  The key for the new entry, representing the original symbol
- *             name.
- * @param val  The value for the entry, which should be NULL for new symbols.
- *             If the key already exists, `val` can be non-NULL to update the
- *             symbol's new name.
- *
- * @return true if the key-value pair was added or updated successfully; false
- *         if an error occurred.
- */
-bool
-dict_add(dict_t *dict, key_t key, val_t val)
-{
-	if (!dict)
-		return false;
-	hash_t hash = hash_key(key);
-	size_t i = hash & DICT_MASK(dict), e;
-	while ((e = GET_ENTRY(dict, i)) != IDX_EMPTY) {
-		entry_t *entry = dict->entries[e];
-		if (IS_ENTRY(entry, hash, key)) {
-			if (entry->val) // Change symbol more than once.
-				free((void*)entry->val);
-			entry->val = strdup(val);
-			check_ptr((void*)entry->val);
-			return true;
-		}
-		i = NEXT_INDEX(dict, i);
-	}
-	if (val) // Cannot find the symbol.
-		return false;
-	entry_t *entry = malloc(sizeof(entry_t));
-	check_ptr(entry);
-	entry->hash = hash;
-	entry->key = strdup(key);
-	check_ptr((void*)entry->key);
-	entry->val = NULL;
-	dict->indices[i] = dict->count;
-	dict->entries[dict->count++] = entry;
-	if (dict->count > DICT_SIZE(dict) * 2 / 3)
-		expand_dict(dict);
-	return true;
-}
-
-/* Buffer */
-/**
- * The buffer module provides a dynamic string buffer specifically designed to
- * facilitate fast and efficient string table construction where strings are
- * frequently appended to a growing buffer.
- */
-
-#define BUF_INIT_SIZE 256
-
-/**
- * @brief Creates and initializes a new buffer for string table construction.
- *
- * @return A pointer to the newly allocated buffer.
- */
-buf_t *
-new_buf(void)
-{
-	size_t size = BUF_INIT_SIZE;
-	buf_t *buf  = malloc(sizeof(buf_t));
-	check_ptr(buf);
-	buf->size = size;
-	buf->cnt  = 0;
-	buf->buf  = malloc(size);
-	check_ptr(buf->buf);
-	return buf;
-}
-
-/**
- * @brief Deletes a buffer object.
- *
- * @param buf The buffer object to delete.
- */
-void
-del_buf(buf_t *buf)
-{
-	free(buf->buf);
-	free(buf);
-}
-
-/**
- * @brief Concatenates a string to the end of the buffer, enlarging the buffer
- *        if necessary.
- *
- * @param buf The buffer to which the string will be concatenated.
- * @param s   The null-terminated string to be concatenated to the buffer.
- *
- * @return The offset in the buffer where the string was appended.
- */
-size_t
-buf_cat(buf_t *buf, const char *s)
-{
-	size_t len = strlen(s) + 1;
-	while (buf->cnt + len > buf->size) // Enlarge buffer.
-		buf->buf = realloc(buf->buf, buf->size <<= 1);
-	memcpy(buf->buf + buf->cnt, s, len);
-	size_t offset = buf->cnt;
-	buf->cnt += len;
-	return offset;
+/**
+ * @file smclib.c
+ * @brief Library Support for Symbol Modifier for COFF (SMC).
+ *
+ * @author Dangfer
+ * @date 2023-01-07
+ * @version 1.0.0
+ *
+ * Note:
+ *     This file is part of the SMC tool and is intended to be used in
+ *     conjunction with the main application. It is not designed to be used
+ *     independently.
+ * 
+ * License:
+ *     This program is free software; you can redistribute it and/or modify it
+ *     under the terms  of the GNU General Public License as published by the
+ *     Free Software Foundation; either version 2 of the License, or (at your
+ *     option) any later version.
+ */
+
+
+#include "smclib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+
+/* Error handling */
+/**
+ * Both the jump target and the message are per thread, so that requests
+ * processed concurrently by the daemon fail independently of each other.
+ */
+__thread jmp_buf _buf;
+__thread char _errmsg[ERROR_MAX];
+
+/**
+ * @brief Records an error message and performs a non-local jump.
+ *
+ * The message is left in `_errmsg` for whoever called setjmp to report.
+ * 
+ * @param fmt Error message format, analogous to printf.
+ * @param ... Additional arguments for the format string.
+ */
+void __attribute__((noreturn))
+error(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(_errmsg, ERROR_MAX, fmt, ap);
+	va_end(ap);
+
+	longjmp(_buf, 1);
+}
+
+/**
+ * @brief Checks the validity of a pointer returned from memory allocation.
+ *
+ * @param ptr The pointer to be checked for NULL value.
+ */
+static inline void
+check_ptr(void *ptr)
+{
+	if (!ptr)
+		error("Memory allocation failed.");
+}
+
+/* File IO */
+/**
+ * @brief Reads the rest of a stream into a newly allocated buffer that is
+ *        followed by a null byte.
+ *
+ * @param fp   The stream to read, which must be seekable.
+ * @param buf  Receives the buffer, or NULL on failure.
+ * @param size Receives the number of bytes read.
+ * @return true on success.
+ */
+static bool
+read_all(FILE *fp, void **buf, size_t *size)
+{
+	*buf = NULL;
+	long start = ftell(fp);
+	if (start < 0 || fseek(fp, 0, SEEK_END) != 0)
+		return false;
+	long end = ftell(fp);
+	if (end < start || fseek(fp, start, SEEK_SET) != 0)
+		return false;
+	*size = end - start;
+
+	if (!(*buf = malloc(*size + 1)))
+		return false;
+	if (fread(*buf, 1, *size, fp) != *size) {
+		free(*buf);
+		*buf = NULL;
+		return false;
+	}
+	((char*)*buf)[*size] = '\0';
+	return true;
+}
+
+/**
+ * @brief Opens a binary file, reads its contents into a buffer, and returns
+ *        the file size.
+ *
+ * This function allocates memory for the content of the file and stores the
+ * pointer in `buf`. The caller is responsible for freeing the allocated
+ * memory. The contents are followed by a null byte, so text files can be
+ * tokenized in place.
+ *
+ * @param filename The name of the file to be opened.
+ * @param buf      Pointer to the pointer of the buffer where the file
+ *                 contents will be stored.
+ * @return The size of the file in bytes.
+ */
+size_t
+read_file(const char *filename, void **buf)
+{
+	if (!filename)
+		error("Invalid filename.");
+	FILE *fp = fopen(filename, "rb");
+	if (!fp)
+		error("Open file '%s' failed.", filename);
+
+	size_t size;
+	bool ok = read_all(fp, buf, &size);
+	fclose(fp);
+	if (!ok)
+		error("Read file '%s' failed.", filename);
+	return size;
+}
+
+/**
+ * @brief Reads the rest of an already open binary stream, like read_file.
+ *
+ * The stream is left open, positioned at its end.
+ *
+ * @param fp       The stream to read, which must be seekable.
+ * @param filename Name of the file, used in error messages.
+ * @param buf      Pointer to the pointer of the buffer where the contents
+ *                 will be stored.
+ * @return The number of bytes read.
+ */
+size_t
+read_stream(FILE *fp, const char *filename, void **buf)
+{
+	size_t size;
+	if (!read_all(fp, buf, &size))
+		error("Read file '%s' failed.", filename);
+	return size;
+}
+
+
+/* Dictionary */
+/**
+ * This dictionary is used within the context of smc (Symbol Modifier for COFF)
+ * and is optimized for this use. It serves both as the index of the unique
+ * symbol names of an object and as the map of renaming rules, where the value
+ * is the new name of a symbol.
+ *
+ * Keys and values are borrowed: they usually point straight into the symbol
+ * and string tables of the mapped file, so the dictionary never copies or
+ * frees them. Since a short symbol name of exactly 8 characters is not
+ * null-terminated, every key carries its length.
+ * 
+ * This dictionary does not support removing entries and hence does not contain
+ * dummy entries.
+ */
+
+#define DICT_INIT_BITS 5
+#define DICT_INIT_SIZE ((size_t)1 << DICT_INIT_BITS)
+
+#define DICT_SIZE(dict) ((size_t)1 << (dict)->size_bits)
+#define DICT_MASK(dict) (DICT_SIZE(dict) - 1)
+#define NEXT_INDEX(dict,i) ((((i) * 5) + 1) & DICT_MASK(dict))
+#define GET_ENTRY(dict,i) ((dict)->indices[i])
+#define IS_ENTRY(ent,h,k,n) ((ent)->hash == h && (ent)->len == n && memcmp((ent)->key, k, n) == 0)
+
+#define IDX_EMPTY ((size_t)-1)
+
+/**
+ * @brief Creates and initializes a new dictionary object.
+ *
+ * @return A pointer to the newly created dictionary object.
+ */
+dict_t *
+new_dict(void)
+{
+	return new_dict_sized(DICT_INIT_BITS);
+}
+
+/**
+ * @brief Creates an empty dictionary of a given size, e.g. to restore the
+ *        entries and indices of a saved one into.
+ *
+ * @param size_bits The base-2 logarithm of the size.
+ * @return A pointer to the newly created dictionary object.
+ */
+dict_t *
+new_dict_sized(uint8_t size_bits)
+{
+	dict_t *dict = malloc(sizeof(dict_t));
+	check_ptr(dict);
+	dict->size_bits = size_bits;
+	size_t size = DICT_SIZE(dict);
+	dict->entries = malloc(size * sizeof(entry_t));
+	check_ptr(dict->entries);
+	dict->indices = malloc(size * sizeof(size_t));
+	check_ptr(dict->indices);
+	dict->count = 0;
+	memset(dict->indices, -1, size * sizeof(size_t));
+	return dict;
+}
+
+/**
+ * @brief Creates an empty dictionary large enough to hold some entries
+ *        without growing, e.g. to fill in before dict_reindex().
+ *
+ * @param count The number of entries.
+ * @return A pointer to the newly created dictionary object.
+ */
+dict_t *
+new_dict_for(size_t count)
+{
+	uint8_t size_bits = DICT_INIT_BITS;
+	while (count > ((size_t)1 << size_bits) * 2 / 3)
+		++size_bits;
+	return new_dict_sized(size_bits);
+}
+
+/**
+ * @brief Deletes a dictionary object and frees all associated memory.
+ *
+ * Keys and values are borrowed and are left to their owners.
+ *
+ * @param dict The dictionary object to delete.
+ */
+void
+del_dict(dict_t *dict)
+{
+	free(dict->entries);
+	free(dict->indices);
+	free(dict);
+}
+
+/**
+ * @brief Computes a hash value for the given key using shift operations.
+ * 
+ * @param key The key for which to compute the hash.
+ * @param len Length of the key.
+ * @return The computed hash value of the key.
+ */
+static hash_t
+hash_key(dkey_t key, size_t len)
+{
+	hash_t h = 1;
+	const uint8_t *k = (typeof(k))key;
+	while (len--)
+		h += (h << 5) + (h >> 27) + *k++;
+	return h;
+}
+
+/**
+ * @brief Computes the hash value a dictionary keeps for a key, e.g. to hash
+ *        keys apart from inserting them.
+ *
+ * @param key The key.
+ * @param len Length of the key.
+ * @return The hash value of the key.
+ */
+hash_t
+dict_hash(dkey_t key, size_t len)
+{
+	return hash_key(key, len);
+}
+
+/**
+ * @brief Places every entry of a dictionary in its indices array again.
+ *
+ * The entries must be distinct and fit the dictionary as dict_insert()
+ * keeps it.
+ *
+ * @param dict The dictionary.
+ */
+void
+dict_reindex(dict_t *dict)
+{
+	memset(dict->indices, -1, sizeof(size_t) * DICT_SIZE(dict));
+	for (size_t e = 0; e < dict->count; ++e) {
+		size_t i = dict->entries[e].hash & DICT_MASK(dict);
+		while (GET_ENTRY(dict, i) != IDX_EMPTY)
+			i = NEXT_INDEX(dict, i);
+		dict->indices[i] = e;
+	}
+}
+
+/**
+ * @brief Expands the storage capacity of the specified dictionary.
+ *
+ * @param dict The dictionary object to be expanded.
+ */
+static void
+expand_dict(dict_t *dict)
+{
+	// Expand entries and indices arrays.
+	size_t size = (size_t)1 << ++dict->size_bits;
+	dict->entries = realloc(dict->entries, size * sizeof(entry_t));
+	check_ptr(dict->entries);
+	dict->indices = realloc(dict->indices, size * sizeof(size_t));
+	check_ptr(dict->indices);
+	// Rehash all existing entries to the new indices array.
+	dict_reindex(dict);
+}
+
+/**
+ * @brief Looks up the slot of a key in the indices array.
+ *
+ * @param dict The dictionary to search.
+ * @param key  The key to look for.
+ * @param len  Length of the key.
+ * @param hash Hash value of the key.
+ * @return The slot holding the key, or the empty slot where it belongs.
+ */
+static size_t
+lookup(dict_t *dict, dkey_t key, size_t len, hash_t hash)
+{
+	size_t i = hash & DICT_MASK(dict), e;
+	while ((e = GET_ENTRY(dict, i)) != IDX_EMPTY) {
+		if (IS_ENTRY(&dict->entries[e], hash, key, len))
+			break;
+		i = NEXT_INDEX(dict, i);
+	}
+	return i;
+}
+
+/**
+ * @brief Finds the entry of a key.
+ *
+ * @param dict The dictionary to search.
+ * @param key  The key to look for, not necessarily null-terminated.
+ * @param len  Length of the key.
+ * @return Index of the entry in `dict->entries`, or DICT_NONE if absent.
+ */
+size_t
+dict_find(dict_t *dict, dkey_t key, size_t len)
+{
+	return GET_ENTRY(dict, lookup(dict, key, len, hash_key(key, len)));
+}
+
+/**
+ * @brief Inserts a key with a NULL value unless it is already present.
+ *
+ * @param dict The dictionary to insert into.
+ * @param key  The key to insert, which must outlive the dictionary.
+ * @param len  Length of the key.
+ * @return Index of the new or existing entry in `dict->entries`.
+ */
+size_t
+dict_insert(dict_t *dict, dkey_t key, size_t len)
+{
+	return dict_insert_hashed(dict, key, len, hash_key(key, len));
+}
+
+/**
+ * @brief Inserts a key whose hash value is known, as dict_insert() does.
+ *
+ * @param dict The dictionary to insert into.
+ * @param key  The key to insert, which must outlive the dictionary.
+ * @param len  Length of the key.
+ * @param hash Hash value of the key, as dict_hash() computes it.
+ * @return Index of the new or existing entry in `dict->entries`.
+ */
+size_t
+dict_insert_hashed(dict_t *dict, dkey_t key, size_t len, hash_t hash)
+{
+	size_t i = lookup(dict, key, len, hash);
+	if (GET_ENTRY(dict, i) != IDX_EMPTY)
+		return GET_ENTRY(dict, i);
+	size_t e = dict->count++;
+	dict->entries[e] = (entry_t){ .hash = hash, .key = key, .len = len };
+	dict->indices[i] = e;
+	if (dict->count > DICT_SIZE(dict) * 2 / 3)
+		expand_dict(dict);
+	return e;
+}
+
+/* Buffer */
+/**
+ * The buffer module provides a dynamic string buffer specifically designed to
+ * facilitate fast and efficient string table construction where strings are
+ * frequently appended to a growing buffer.
+ */
+
+#define BUF_INIT_SIZE 256
+
+/**
+ * @brief Creates and initializes a new buffer for string table construction.
+ *
+ * @return A pointer to the newly allocated buffer.
+ */
+buf_t *
+new_buf(void)
+{
+	size_t size = BUF_INIT_SIZE;
+	buf_t *buf  = malloc(sizeof(buf_t));
+	check_ptr(buf);
+	buf->size = size;
+	buf->cnt  = 0;
+	buf->buf  = malloc(size);
+	check_ptr(buf->buf);
+	return buf;
+}
+
+/**
+ * @brief Deletes a buffer object.
+ *
+ * @param buf The buffer object to delete.
+ */
+void
+del_buf(buf_t *buf)
+{
+	free(buf->buf);
+	free(buf);
+}
+
+/**
+ * @brief Ensures the buffer can hold at least `size` bytes without being
+ *        enlarged again.
+ *
+ * @param buf  The buffer to be reserved.
+ * @param size The total number of bytes required.
+ */
+void
+buf_reserve(buf_t *buf, size_t size)
+{
+	if (size <= buf->size)
+		return;
+	buf->buf = realloc(buf->buf, buf->size = size);
+	check_ptr(buf->buf);
+}
+
+/**
+ * @brief Appends `len` bytes to the end of the buffer, enlarging the buffer
+ *        if necessary.
+ *
+ * @param buf The buffer to which the bytes will be appended.
+ * @param s   The bytes to be appended, which need not be null-terminated.
+ * @param len Number of bytes to append.
+ *
+ * @return The offset in the buffer where the bytes were appended.
+ */
+size_t
+buf_ncat(buf_t *buf, const char *s, size_t len)
+{
+	if (buf->cnt + len > buf->size) { // Enlarge buffer.
+		size_t size = buf->size;
+		while (buf->cnt + len > size)
+			size <<= 1;
+		buf_reserve(buf, size);
+	}
+	memcpy(buf->buf + buf->cnt, s, len);
+	size_t offset = buf->cnt;
+	buf->cnt += len;
+	return offset;
+}
+
+/**
+ * @brief Concatenates a string to the end of the buffer, enlarging the buffer
+ *        if necessary.
+ *
+ * @param buf The buffer to which the string will be concatenated.
+ * @param s   The null-terminated string to be concatenated to the buffer.
+ *
+ * @return The offset in the buffer where the string was appended.
+ */
+size_t
+buf_cat(buf_t *buf, const char *s)
+{
+	return buf_ncat(buf, s, strlen(s) + 1);
+}
+
+
+/* Arena */
+/**
+ * The arena hands out memory from large chunks that are never moved, so the
+ * returned pointers stay valid until the whole arena is deleted. It is used
+ * where keys must outlive the buffer they were borrowed from.
+ */
+
+#define CHUNK_SIZE 65536
+
+struct chunk_t {
+	chunk_t *prev;   ///< Previously allocated chunk.
+	char     data[]; ///< Memory handed out by the arena.
+};
+
+/**
+ * @brief Creates an empty arena.
+ *
+ * @return A pointer to the newly allocated arena.
+ */
+arena_t *
+new_arena(void)
+{
+	arena_t *arena = malloc(sizeof(arena_t));
+	check_ptr(arena);
+	*arena = (arena_t){ 0 };
+	return arena;
+}
+
+/**
+ * @brief Deletes an arena along with everything allocated from it.
+ *
+ * @param arena The arena to delete.
+ */
+void
+del_arena(arena_t *arena)
+{
+	for (chunk_t *c = arena->head, *prev; c; c = prev) {
+		prev = c->prev;
+		free(c);
+	}
+	free(arena);
+}
+
+/**
+ * @brief Allocates memory from an arena.
+ *
+ * @param arena The arena to allocate from.
+ * @param size  Number of bytes to allocate.
+ * @return Pointer to the memory, aligned for any pointer-sized object.
+ */
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+	size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	if (size > arena->avail) {
+		size_t data = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+		chunk_t *c = malloc(sizeof(chunk_t) + data);
+		check_ptr(c);
+		c->prev      = arena->head;
+		arena->head  = c;
+		arena->next  = c->data;
+		arena->avail = data;
+	}
+	void *p = arena->next;
+	arena->next  += size;
+	arena->avail -= size;
+	return p;
+}
+
+/**
+ * @brief Copies `len` bytes into an arena as a null-terminated string.
+ *
+ * @param arena The arena to allocate from.
+ * @param s     The bytes to copy, which need not be null-terminated.
+ * @param len   Number of bytes to copy.
+ * @return The null-terminated copy.
+ */
+char *
+arena_strndup(arena_t *arena, const char *s, size_t len)
+{
+	char *p = arena_alloc(arena, len + 1);
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+
+/* Intern table */
+/**
+ * The intern table gives every distinct name seen by any thread a stable id.
+ * It is split into shards picked by the hash of the name, each a dictionary
+ * with its own lock and arena, so that threads interning different names
+ * seldom wait for one another. The id holds the index of the shard in its
+ * low bits and the index of the entry above them.
+ *
+ * Names are copied into the arena of their shard, so that they outlive the
+ * files they came from. Looking a name up by id takes no lock, and must not
+ * race with interning.
+ */
+
+#define INTERN_BITS   6
+#define INTERN_SHARDS (1 << INTERN_BITS)
+
+typedef struct {
+	pthread_mutex_t lock;  ///< Protects the dictionary and the arena.
+	dict_t         *dict;  ///< Names of the shard.
+	arena_t        *arena; ///< Copies of the names.
+} shard_t;
+
+struct intern_t {
+	shard_t shards[INTERN_SHARDS]; ///< Shards, by hash.
+};
+
+/**
+ * @brief Creates an empty intern table.
+ *
+ * @return A pointer to the newly created table.
+ */
+intern_t *
+new_intern(void)
+{
+	intern_t *it = malloc(sizeof(intern_t));
+	check_ptr(it);
+	for (int i = 0; i < INTERN_SHARDS; ++i) {
+		pthread_mutex_init(&it->shards[i].lock, NULL);
+		it->shards[i].dict  = new_dict();
+		it->shards[i].arena = new_arena();
+	}
+	return it;
+}
+
+/**
+ * @brief Deletes an intern table along with the names it holds.
+ *
+ * @param it The table to delete.
+ */
+void
+del_intern(intern_t *it)
+{
+	for (int i = 0; i < INTERN_SHARDS; ++i) {
+		pthread_mutex_destroy(&it->shards[i].lock);
+		del_dict(it->shards[i].dict);
+		del_arena(it->shards[i].arena);
+	}
+	free(it);
+}
+
+/**
+ * @brief Interns a name; may be called by several threads at once.
+ *
+ * @param it  The table.
+ * @param s   The name, which need not be null-terminated.
+ * @param len Length of the name.
+ * @return Id of the name, the same for every equal name.
+ */
+size_t
+intern(intern_t *it, const char *s, size_t len)
+{
+	// The high bits of a Fibonacci hash pick the shard, leaving the low bits
+	// of the hash to spread the names within it.
+	size_t i = (uint64_t)hash_key(s, len) * 0x9e3779b97f4a7c15u >> (64 - INTERN_BITS);
+	shard_t *shard = &it->shards[i];
+	pthread_mutex_lock(&shard->lock);
+	size_t count = shard->dict->count;
+	size_t e = dict_insert(shard->dict, s, len);
+	if (shard->dict->count != count)
+		shard->dict->entries[e].key = arena_strndup(shard->arena, s, len);
+	pthread_mutex_unlock(&shard->lock);
+	return e << INTERN_BITS | i;
+}
+
+/**
+ * @brief Gets an interned name by its id.
+ *
+ * @param it  The table, which no thread is interning names into.
+ * @param id  Id of the name.
+ * @param len Receives the length of the name.
+ * @return The null-terminated name.
+ */
+const char *
+intern_name(const intern_t *it, size_t id, size_t *len)
+{
+	const entry_t *entry = &it->shards[id & (INTERN_SHARDS - 1)].dict->entries[id >> INTERN_BITS];
+	*len = entry->len;
+	return entry->key;
+}
+
+
+/* Digest */
+/**
+ * Digests tell apart contents such as input files and rule sets, for the
+ * output cache. Two 64-bit lanes take the same 8-byte words with different
+ * multipliers, which keeps the loop at a multiplication per lane and word
+ * while making the digest 128 bits wide. It is fast rather than
+ * cryptographic, and not meant to hold up against crafted collisions.
+ *
+ * Each update is hashed as one piece along with its size and then folded
+ * into the lanes, so that a digest depends on how contents are split into
+ * updates as well as on the contents.
+ */
+
+/**
+ * @brief Scrambles the bits of a 64-bit value (the MurmurHash3 finalizer).
+ *
+ * @param x The value.
+ * @return The scrambled value.
+ */
+static inline uint64_t
+mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdu;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53u;
+	x ^= x >> 33;
+	return x;
+}
+
+/**
+ * @brief Starts a digest.
+ *
+ * @param d The digest.
+ */
+void
+digest_init(digest_t *d)
+{
+	d->h[0] = 0x243f6a8885a308d3u;
+	d->h[1] = 0x13198a2e03707344u;
+}
+
+/**
+ * @brief Adds contents to a digest.
+ *
+ * @param d    The digest.
+ * @param data The contents.
+ * @param size Size of the contents.
+ */
+void
+digest_update(digest_t *d, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	uint64_t a = d->h[0] ^ size, b = d->h[1] + size, w;
+	for (; size >= 8; p += 8, size -= 8) {
+		memcpy(&w, p, 8);
+		a = (a ^ w) * 0x9e3779b97f4a7c15u;
+		a ^= a >> 29;
+		b = (b + w) * 0xc2b2ae3d27d4eb4fu;
+		b ^= b >> 31;
+	}
+	w = 0;
+	memcpy(&w, p, size);
+	d->h[0] = mix64(a ^ w);
+	d->h[1] = mix64(b + w + d->h[0]);
+}
+
+
+/* Thread pool */
+/**
+ * A fixed set of worker threads taking tasks from a FIFO queue. Tasks run
+ * with no error handler of their own; a task that may fail must call setjmp
+ * itself, since `_buf` is per thread.
+ */
+
+typedef struct task_t task_t;
+struct task_t {
+	task_t *next;              ///< Next task in the queue.
+	void  (*fn)(void *arg);    ///< Function to run.
+	void   *arg;               ///< Argument passed to the function.
+};
+
+struct pool_t {
+	pthread_mutex_t lock;      ///< Protects all of the fields below.
+	pthread_cond_t  work;      ///< Signalled when a task is queued or on shutdown.
+	pthread_cond_t  done;      ///< Signalled when the pool becomes idle.
+	task_t         *head;      ///< First queued task.
+	task_t        **tail;      ///< Link to be filled by the next queued task.
+	size_t          pending;   ///< Number of tasks queued or running.
+	bool            stop;      ///< Set when the pool is being deleted.
+	int             nthreads;  ///< Number of worker threads.
+	pthread_t       threads[]; ///< The worker threads.
+};
+
+/**
+ * @brief Main loop of a worker thread.
+ *
+ * @param arg The pool the worker belongs to.
+ * @return Always NULL.
+ */
+static void *
+pool_worker(void *arg)
+{
+	pool_t *pool = arg;
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->head && !pool->stop)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		task_t *task = pool->head;
+		if (!task)
+			break;
+		if (!(pool->head = task->next))
+			pool->tail = &pool->head;
+		pthread_mutex_unlock(&pool->lock);
+
+		task->fn(task->arg);
+		free(task);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0)
+			pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/**
+ * @brief Creates a thread pool.
+ *
+ * @param nthreads Number of worker threads; values below 1 mean one per CPU.
+ * @return A pointer to the newly created pool.
+ */
+pool_t *
+new_pool(int nthreads)
+{
+	if (nthreads < 1)
+		nthreads = cpu_count();
+	pool_t *pool = malloc(sizeof(pool_t) + nthreads * sizeof(pthread_t));
+	check_ptr(pool);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->head     = NULL;
+	pool->tail     = &pool->head;
+	pool->pending  = 0;
+	pool->stop     = false;
+	pool->nthreads = 0;
+	for (int i = 0; i < nthreads; ++i) {
+		if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0) {
+			del_pool(pool);
+			error("Cannot create worker thread.");
+		}
+		pool->nthreads++;
+	}
+	return pool;
+}
+
+/**
+ * @brief Waits for all queued tasks, then deletes a thread pool.
+ *
+ * @param pool The pool to delete.
+ */
+void
+del_pool(pool_t *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->nthreads; ++i)
+		pthread_join(pool->threads[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	free(pool);
+}
+
+/**
+ * @brief Queues a task to be run by one of the workers of a pool.
+ *
+ * @param pool The pool to run the task.
+ * @param fn   Function to run.
+ * @param arg  Argument passed to the function.
+ */
+void
+pool_submit(pool_t *pool, void (*fn)(void *arg), void *arg)
+{
+	task_t *task = malloc(sizeof(task_t));
+	check_ptr(task);
+	*task = (task_t){ .fn = fn, .arg = arg };
+	pthread_mutex_lock(&pool->lock);
+	*pool->tail = task;
+	pool->tail  = &task->next;
+	pool->pending++;
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Waits until every task submitted to a pool has finished.
+ *
+ * @param pool The pool to wait for.
+ */
+void
+pool_wait(pool_t *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Returns the number of online processors.
+ *
+ * @return The number of processors, at least 1.
+ */
+int
+cpu_count(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	int n = info.dwNumberOfProcessors;
+#else
+	int n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return n > 0 ? n : 1;
 }
\ No newline at end of file
@@ -1,58 +1,118 @@
-#ifndef _DICT_H
-#define _DICT_H
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <setjmp.h>
-
-/* Error handling */
-extern jmp_buf _buf;
-void __attribute__((noreturn)) error(const char *fmt, ...);
-
-/* File IO */
-size_t read_file(const char *filename, void **buf);
-
-/* Dictionary */
-typedef size_t hash_t;
-typedef const char *key_t;
-typedef const char *val_t;
-/**
- * @brief Represents an individual entry in a dictionary.
- */
-struct entry_t {
-	hash_t hash; ///< Hash value of the key.
-	key_t  key;  ///< The actual key associated with the entry.
-	val_t  val;  ///< The value associated with the key.
-};
-typedef struct entry_t entry_t;
-/**
- * @brief Represents a hashtable-based dictionary.
- */
-struct dict_t {
-	entry_t **entries;   ///< Pointer to an array of entry pointers.
-	size_t   *indices;   ///< Array of indices for the dictionary, used for efficient lookup.
-	size_t    count;     ///< The number of entries currently in use.
-	uint8_t   size_bits; ///< The base-2 logarithm of the size of the dictionary.
-};
-typedef struct dict_t dict_t;
-
-dict_t *new_dict(void);
-void del_dict(dict_t *dict);
-val_t dict_query(dict_t *dict, key_t key);
-bool dict_add(dict_t *dict, key_t key, val_t val);
-
-/* Buffer */
-/**
- * @brief Buffer utility for efficient string concatenation.
- */
-typedef struct {
-	size_t size; ///< Total size of the allocated buffer.
-	size_t cnt;  ///< Current length of the content in the buffer.
-	void  *buf;  ///< Pointer to the buffer's content.
-} buf_t;
-
-buf_t *new_buf(void);
-void del_buf(buf_t *buf);
-size_t buf_cat(buf_t *buf, const char *s);
-
+#ifndef _DICT_H
+#define _DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <setjmp.h>
+
+/* Error handling */
+#define ERROR_MAX 512
+
+extern __thread jmp_buf _buf;
+extern __thread char _errmsg[ERROR_MAX];
+void __attribute__((noreturn)) error(const char *fmt, ...);
+
+/* File IO */
+size_t read_file(const char *filename, void **buf);
+size_t read_stream(FILE *fp, const char *filename, void **buf);
+
+/* Dictionary */
+typedef size_t hash_t;
+typedef const char *dkey_t;
+typedef const char *dval_t;
+/**
+ * @brief Represents an individual entry in a dictionary.
+ */
+struct entry_t {
+	hash_t hash; ///< Hash value of the key.
+	dkey_t key;  ///< The actual key associated with the entry.
+	size_t len;  ///< Length of the key, which need not be null-terminated.
+	dval_t val;  ///< The value associated with the key.
+};
+typedef struct entry_t entry_t;
+/**
+ * @brief Represents a hashtable-based dictionary.
+ */
+struct dict_t {
+	entry_t  *entries;   ///< Array of entries in insertion order.
+	size_t   *indices;   ///< Array of indices for the dictionary, used for efficient lookup.
+	size_t    count;     ///< The number of entries currently in use.
+	uint8_t   size_bits; ///< The base-2 logarithm of the size of the dictionary.
+};
+typedef struct dict_t dict_t;
+
+#define DICT_NONE ((size_t)-1) ///< Index returned when a key is not found.
+
+dict_t *new_dict(void);
+dict_t *new_dict_sized(uint8_t size_bits);
+dict_t *new_dict_for(size_t count);
+void del_dict(dict_t *dict);
+hash_t dict_hash(dkey_t key, size_t len);
+void dict_reindex(dict_t *dict);
+size_t dict_find(dict_t *dict, dkey_t key, size_t len);
+size_t dict_insert(dict_t *dict, dkey_t key, size_t len);
+size_t dict_insert_hashed(dict_t *dict, dkey_t key, size_t len, hash_t hash);
+
+/* Buffer */
+/**
+ * @brief Buffer utility for efficient string concatenation.
+ */
+typedef struct {
+	size_t size; ///< Total size of the allocated buffer.
+	size_t cnt;  ///< Current length of the content in the buffer.
+	void  *buf;  ///< Pointer to the buffer's content.
+} buf_t;
+
+buf_t *new_buf(void);
+void del_buf(buf_t *buf);
+void buf_reserve(buf_t *buf, size_t size);
+size_t buf_ncat(buf_t *buf, const char *s, size_t len);
+size_t buf_cat(buf_t *buf, const char *s);
+
+/* Arena */
+/**
+ * @brief Chunked allocator for many small objects that share a lifetime.
+ */
+typedef struct chunk_t chunk_t;
+typedef struct {
+	chunk_t *head;  ///< Most recently allocated chunk.
+	char    *next;  ///< Next free byte in the current chunk.
+	size_t   avail; ///< Number of free bytes in the current chunk.
+} arena_t;
+
+arena_t *new_arena(void);
+void del_arena(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+char *arena_strndup(arena_t *arena, const char *s, size_t len);
+
+/* Intern table */
+typedef struct intern_t intern_t;
+
+intern_t *new_intern(void);
+void del_intern(intern_t *it);
+size_t intern(intern_t *it, const char *s, size_t len);
+const char *intern_name(const intern_t *it, size_t id, size_t *len);
+
+/* Digest */
+/**
+ * @brief A 128-bit digest of some contents.
+ */
+typedef struct digest_t {
+	uint64_t h[2]; ///< The two lanes.
+} digest_t;
+
+void digest_init(digest_t *d);
+void digest_update(digest_t *d, const void *data, size_t size);
+
+/* Thread pool */
+typedef struct pool_t pool_t;
+
+pool_t *new_pool(int nthreads);
+void del_pool(pool_t *pool);
+void pool_submit(pool_t *pool, void (*fn)(void *arg), void *arg);
+void pool_wait(pool_t *pool);
+int cpu_count(void);
+
 #endif
\ No newline at end of file